@@ -28,7 +28,46 @@
 /// Header for demo version 2
 #define ALICE_S2_HEADER "PBDEMS2"_chash
 
-/// Number of bytes to allocate for decompression
-#define ALICE_SNAPPY_BUFFER_SIZE 102400
+/// Smallest buffer allocated for decompression, larger ones are rounded up to the next power of two
+#define ALICE_BUFFER_POOL_MIN_SIZE 4096
+/// Number of unused buffers each pool keeps for reuse
+#define ALICE_BUFFER_POOL_KEEP 8
+/// Size of the block kept by each parser for the packets of a single call to dem_file::get
+#define ALICE_ARENA_BLOCK_SIZE 65536
+
+/// Initial number of bytes buffered when reading from a source
+#define ALICE_STREAM_BUFFER_SIZE 65536
+/// Microseconds to wait before checking a replay that is being recorded for new data
+#define ALICE_STREAM_POLL_USEC 100000
+/// Number of bytes buffered between a background source and the parser
+#define ALICE_RING_BUFFER_SIZE 1048576
+/// Number of packets decompressed ahead when pipelining is turned on
+#define ALICE_PIPELINE_DEPTH 16
+/// Number of replays each batch worker may parse ahead of the oldest result not yet handed out
+#define ALICE_BATCH_BACKLOG 4
+/// Number of segments per worker a replay is split into when parsing it in parallel
+#define ALICE_PARALLEL_SEGMENTS 4
+
+/// Extension appended to the replay path for stored indices
+#define ALICE_INDEX_EXTENSION ".aidx"
+/// Magic bytes at the start of a stored index
+#define ALICE_INDEX_MAGIC "ALICEIDX"
+/// Version of the stored index format
+#define ALICE_INDEX_VERSION 1
+/// Number of bytes hashed at the start and end of a replay to identify it
+#define ALICE_INDEX_HASH_SIZE 65536
+
+/// Number of entities a Source 2 replay can reference, indices have 14 bits
+#define ALICE_ENTITY_MAX 16384
+/// Number of slots an entity class allocates first, doubled whenever they run out
+#define ALICE_ENTITY_CLASS_SLOTS 16
+/// Number of class ids, they are sent with 16 bits at most
+#define ALICE_ENTITY_CLASS_MAX 65536
+/// Number of elements a dynamic array property can grow to
+#define ALICE_ENTITY_ARRAY_MAX 1024
+/// Size of the buffer string properties are read into
+#define ALICE_ENTITY_STRING_SIZE 4096
+/// Size of the buffer string table keys are read into
+#define ALICE_STRING_TABLE_KEY_SIZE 1024
 
 #endif /* _ALICE_CONFIG_HPP_ */
\ No newline at end of file
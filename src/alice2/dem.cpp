@@ -26,13 +26,30 @@
 
 #include <snappy.h>
 
+#include "util/constexpr_hash.hpp"
 #include "util/expect.hpp"
 #include "util/varint.hpp"
 #include "proto/source2/demo.pb.h"
 
+#include "config.hpp"
 #include "dem.hpp"
 
 namespace alice {
+    engine dem_header::version() const {
+        // headerid is not guaranteed to be null-terminated
+        char id[sizeof(headerid) + 1] = {0};
+        memcpy(id, headerid, sizeof(headerid));
+
+        switch (constexpr_hash_rt(id)) {
+            case ALICE_S1_HEADER:
+                return engine::one;
+            case ALICE_S2_HEADER:
+                return engine::two;
+            default:
+                return engine::unkown;
+        }
+    }
+
     void dem_packet::compress(dem_packet& msg) {
         // compress
         std::string compressed;
@@ -69,6 +86,15 @@ namespace alice {
         msg.size = size_uncompressed;
     }
 
+    void dem_packet::uncompress(dem_packet& msg, buffer_pool::buffer& buffer) {
+        size_t size_uncompressed = 0;
+
+        if (snappy::GetUncompressedLength(msg.data, msg.size, &size_uncompressed))
+            buffer.reserve(size_uncompressed);
+
+        uncompress(msg, buffer.data(), buffer.size());
+    }
+
     size_t dem_packet::from_buffer(dem_packet& msg, char* buffer, size_t buffer_size, bool read_tick) {
         if (expect(buffer_size > 15)) { // fast version
             uint8_t* data = reinterpret_cast<uint8_t*>(buffer);
@@ -97,6 +123,31 @@ namespace alice {
         }
     }
 
+    size_t dem_packet::peek_size(const char* buffer, size_t buffer_size, bool read_tick) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(buffer);
+        size_t pos = 0;
+
+        // Reads a single varint, returns false if it's incomplete
+        auto read_varint = [&](uint64_t& value) {
+            value = 0;
+            for (uint32_t shift = 0; pos < buffer_size && shift < 64; shift += 7) {
+                const uint8_t b = data[pos++];
+                value |= static_cast<uint64_t>(b & 0x7F) << shift;
+
+                if (!(b & 0x80))
+                    return true;
+            }
+
+            return false;
+        };
+
+        uint64_t type, tick, size;
+        if (!read_varint(type) || (read_tick && !read_varint(tick)) || !read_varint(size))
+            return 0;
+
+        return pos + size;
+    }
+
     size_t dem_packet::to_buffer(dem_packet& msg, char* buffer, size_t buffer_size, bool pack) {
         if (pack)
             compress(msg);
@@ -26,6 +26,8 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "util/buffer_pool.hpp"
+
 namespace alice {
     /** Engine the replay was played in */
     enum class engine {
@@ -40,6 +42,9 @@ namespace alice {
         char headerid[ 8 ];
         /** Points to the location of the game summary */
         int32_t offset;
+
+        /** Returns the engine identified by headerid */
+        engine version() const;
     };
 
     /** A single dem message */
@@ -56,12 +61,22 @@ namespace alice {
         /** Compresses given message, require you to free msg.data memory */
         static void compress(dem_packet& msg);
 
-        /** Decompresses given message */
+        /** Decompresses given message, msg.data is set to nullptr if the buffer is to small */
         static void uncompress(dem_packet& msg, char* buffer, size_t buffer_size);
 
+        /** Decompresses given message, growing buffer to the uncompressed size if necessary */
+        static void uncompress(dem_packet& msg, buffer_pool::buffer& buffer);
+
         /** Reads data from buffer into msg and returns bytes read */
         static size_t from_buffer(dem_packet& msg, char* buffer, size_t buffer_size, bool read_tick = false);
 
+        /**
+         * Returns the number of bytes the packet at the start of buffer occupies, including its header.
+         *
+         * Unlike from_buffer this never reads past buffer_size and returns 0 if the header is incomplete.
+         */
+        static size_t peek_size(const char* buffer, size_t buffer_size, bool read_tick = false);
+
         /** Writes data in msg to given buffer */
         static size_t to_buffer(dem_packet& msg, char* buffer, size_t buffer_size, bool pack = false);
     };
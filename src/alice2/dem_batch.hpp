@@ -0,0 +1,232 @@
+/**
+ * @file dem_batch.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_DEM_BATCH_HPP_
+#define _ALICE_DEM_BATCH_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+#include "util/exception.hpp"
+#include "util/noncopyable.hpp"
+#include "config.hpp"
+#include "dem_file.hpp"
+#include "packets.hpp"
+
+namespace alice {
+    /** Outcome of a single replay in a batch */
+    template <typename Result>
+    struct dem_batch_result {
+        /** Path of the replay */
+        std::string path;
+        /** Whether the job finished without throwing */
+        bool ok;
+        /** Error message, empty if ok is set */
+        std::string error;
+        /** Value returned by the job, default constructed on error */
+        Result value;
+    };
+
+    /**
+     * Parses many replays on a fixed pool of worker threads.
+     *
+     * Each worker keeps its own snappy buffers for all replays it parses, packet lists are shared. Results
+     * are handed to the callback on the calling thread in the order the paths were given, no matter which
+     * worker finishes first. Result has to be default constructible and movable.
+     */
+    template <typename Result>
+    class dem_batch : private noncopyable {
+    public:
+        /** Result type */
+        typedef dem_batch_result<Result> result;
+        /** Job run for every replay */
+        typedef std::function<Result (dem_file&)> job;
+        /** Called for every result */
+        typedef std::function<void (result&)> callback;
+
+        /** Creates a batch with the given number of workers, 0 uses one per core */
+        explicit dem_batch(std::size_t workers = 0, dem_load mode = dem_load::map)
+            : workerCount(workers ? workers : std::max(1u, std::thread::hardware_concurrency())), mode(mode) {}
+
+        /** Returns the number of workers */
+        std::size_t workers() const {
+            return workerCount;
+        }
+
+        /**
+         * Runs j on every replay in paths and passes the results to cb in input order.
+         *
+         * Exceptions thrown by the job are recorded in the result, exceptions thrown by cb stop the
+         * batch and are rethrown. Returns the number of replays that failed.
+         */
+        std::size_t run(const std::vector<std::string>& paths, job j, callback cb) {
+            state s(paths.size());
+            const std::size_t window = workerCount * ALICE_BATCH_BACKLOG;
+
+            std::vector<std::thread> threads;
+            for (std::size_t i = 0; i < workerCount; ++i)
+                threads.emplace_back([&]() { work(s, paths, j, window); });
+
+            std::size_t failed = 0;
+
+#ifdef ALICE_NO_EXCEPTIONS
+            failed = emit(s, paths.size(), cb);
+#else
+            std::exception_ptr error;
+
+            try {
+                failed = emit(s, paths.size(), cb);
+            } catch (...) {
+                error = std::current_exception();
+
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.abort = true;
+                s.cond.notify_all();
+            }
+#endif /* ALICE_NO_EXCEPTIONS */
+
+            for (auto &t : threads)
+                t.join();
+
+#ifndef ALICE_NO_EXCEPTIONS
+            if (error)
+                std::rethrow_exception(error);
+#endif /* ALICE_NO_EXCEPTIONS */
+
+            return failed;
+        }
+    private:
+        /** State shared between the workers and the calling thread */
+        struct state {
+            state(std::size_t n) : results(n), ready(n, 0), next(0), emitted(0), abort(false) {}
+
+            /** Results in input order */
+            std::vector<result> results;
+            /** Whether results[i] is set */
+            std::vector<char> ready;
+            /** Next replay to hand to a worker */
+            std::size_t next;
+            /** Number of results handed to the callback */
+            std::size_t emitted;
+            /** Set if the callback has thrown */
+            bool abort;
+
+            /** Guards all members */
+            std::mutex mutex;
+            /** Signaled whenever a result is ready or has been emitted */
+            std::condition_variable cond;
+        };
+
+        /** Number of worker threads */
+        std::size_t workerCount;
+        /** How replays are loaded */
+        dem_load mode;
+
+        /** Passes the n results to cb in input order as they become ready, returns the number of failures */
+        std::size_t emit(state& s, std::size_t n, callback& cb) {
+            std::size_t failed = 0;
+
+            for (std::size_t i = 0; i < n; ++i) {
+                result r;
+
+                {
+                    std::unique_lock<std::mutex> lock(s.mutex);
+                    s.cond.wait(lock, [&]() { return s.ready[i]; });
+
+                    r = std::move(s.results[i]);
+                    s.emitted = i + 1;
+                }
+
+                // Workers may be waiting for the window to move
+                s.cond.notify_all();
+
+                if (!r.ok)
+                    ++failed;
+
+                cb(r);
+            }
+
+            return failed;
+        }
+
+        /** Worker loop, takes the next replay until all are done, each worker runs its own copy of j */
+        void work(state& s, const std::vector<std::string>& paths, job j, std::size_t window) {
+            while (true) {
+                std::size_t i;
+
+                {
+                    std::unique_lock<std::mutex> lock(s.mutex);
+
+                    // Don't get too far ahead of a slow callback
+                    s.cond.wait(lock, [&]() {
+                        return s.abort || s.next >= paths.size() || s.next < s.emitted + window;
+                    });
+
+                    if (s.abort || s.next >= paths.size())
+                        return;
+
+                    i = s.next++;
+                }
+
+                result r;
+                r.path = paths[i];
+                r.ok = false;
+
+#ifdef ALICE_NO_EXCEPTIONS
+                // Errors end the process, there is nothing to record
+                dem_file f(paths[i].c_str(), mode);
+                r.value = j(f);
+                r.ok = true;
+#else
+                try {
+                    dem_file f(paths[i].c_str(), mode);
+                    r.value = j(f);
+                    r.ok = true;
+                } catch (alice::exception &e) {
+                    r.error = e.what();
+                } catch (std::exception &e) {
+                    r.error = e.what();
+                }
+#endif /* ALICE_NO_EXCEPTIONS */
+
+                {
+                    std::lock_guard<std::mutex> lock(s.mutex);
+                    s.results[i] = std::move(r);
+                    s.ready[i] = 1;
+                }
+
+                s.cond.notify_all();
+            }
+        }
+    };
+}
+
+#endif /* _ALICE_DEM_BATCH_HPP_ */
@@ -20,10 +20,21 @@
  *    limitations under the License.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <thread>
+#include <utility>
 #include <cstdint>
 #include <cassert>
 
+#ifndef WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif /* WIN32 */
+
 #include <snappy.h>
 
 #include "proto/source2/demo.pb.h"
@@ -39,133 +50,558 @@
 #include "util/varint.hpp"
 
 namespace alice {
-    dem_file::dem_file(const char* path)
-        : data(nullptr), dataSize(0), dataPos(0), dataSnappy(nullptr),
-          packets(packet_list::instance()), ownsBuffer(true)
+    dem_file::dem_file(const char* path, dem_load mode, packet_list* registry)
+        : data(nullptr), dataSize(0), dataPos(0), dataCapacity(0), pool(buffer_pool::local()),
+          dataSnappy(pool->acquire(0)), dataMessage(pool->acquire(0)),
+          packets(registry), path(path),
+          indexed(false), source(nullptr), stopped(false), ownsBuffer(true), mapped(false), pipe(nullptr), pipeDepth(0),
+          keyframe(false)
     {
-        std::ifstream input(path, std::ifstream::in | std::ifstream::binary);
-
-        if (!input.is_open())
-            ALICE_THROW(DemFileIO, path);
-
-        const std::streampos fstart = input.tellg();
-        input.seekg (0, std::ios::end);
-        dataSize = input.tellg() - fstart;
-        input.seekg(fstart);
-
-        if (dataSize < sizeof(dem_header))
-            ALICE_THROW(DemFileSize, path);
+        create_arena();
 
-        // read everything into the buffer
-        data = new char[dataSize];
-        input.read(data, dataSize);
-        input.close();
+        if (mode == dem_load::map) {
+            load_map(path);
+        } else {
+            load_copy(path);
+        }
 
         // verify header
-        parse_header();
+        parse_header(registry);
 
         if (source_version == engine::unkown) {
-            delete[] data;
+            release();
             ALICE_THROW(DemInvalid, path);
         }
-
-        // create buffer for snappy
-        dataSnappy = new char[ALICE_SNAPPY_BUFFER_SIZE];
     }
 
-    dem_file::dem_file(char* data, std::size_t size)
-        : data(data), dataSize(size), dataPos(0), dataSnappy(new char[ALICE_SNAPPY_BUFFER_SIZE]),
-          packets(packet_list::instance()), ownsBuffer(false)
+    dem_file::dem_file(char* data, std::size_t size, packet_list* registry)
+        : data(data), dataSize(size), dataPos(0), dataCapacity(0), pool(buffer_pool::local()),
+          dataSnappy(pool->acquire(0)), dataMessage(pool->acquire(0)),
+          packets(registry), indexed(false),
+          source(nullptr), stopped(false), ownsBuffer(false), mapped(false), pipe(nullptr), pipeDepth(0),
+          keyframe(false)
     {
+        create_arena();
+
         // verify header
-        parse_header();
+        parse_header(registry);
 
-        if (source_version == engine::unkown) {
-            delete[] dataSnappy;
+        if (source_version == engine::unkown)
             ALICE_THROW(DemInvalid, "Construction from buffer");
-        }
+    }
+
+    dem_file::dem_file(dem_source* source, packet_list* registry)
+        : data(nullptr), dataSize(0), dataPos(0), dataCapacity(ALICE_STREAM_BUFFER_SIZE),
+          pool(buffer_pool::local()), dataSnappy(pool->acquire(0)), dataMessage(pool->acquire(0)),
+          packets(registry),
+          indexed(false), source(source), stopped(false), ownsBuffer(true), mapped(false), pipe(nullptr), pipeDepth(0),
+          keyframe(false)
+    {
+        // The destructor doesn't run if construction fails, free the buffer on every way out
+        struct buffer_guard {
+            dem_file* f;
+            ~buffer_guard() {
+                if (f)
+                    f->release();
+            }
+        } guard{this};
+
+        data = new char[dataCapacity];
+        create_arena();
+
+        // verify header
+        if (!fill(sizeof(dem_header), true))
+            ALICE_THROW(DemFileSize, "Construction from source");
+
+        parse_header(registry);
+
+        if (source_version == engine::unkown)
+            ALICE_THROW(DemInvalid, "Construction from source");
+
+        guard.f = nullptr;
+    }
+
+    dem_file::dem_file(dem_file&& f)
+        : data(f.data), dataSize(f.dataSize),
+          dataPos(f.dataPos), dataCapacity(f.dataCapacity),
+          pool(f.pool), dataSnappy(std::move(f.dataSnappy)),
+          dataMessage(std::move(f.dataMessage)), packets(f.packets),
+          packetErrors(f.packetErrors), arenaBlock(std::move(f.arenaBlock)),
+          arena(std::move(f.arena)), cache(std::move(f.cache)),
+          sendTables(std::move(f.sendTables)), classInfo(std::move(f.classInfo)),
+          signonTables(std::move(f.signonTables)), stringTables(std::move(f.stringTables)),
+          subscriptions(std::move(f.subscriptions)), source_version(f.source_version),
+          offset(f.offset), path(std::move(f.path)),
+          packetIndex(std::move(f.packetIndex)), indexed(f.indexed),
+          source(std::move(f.source)), stopped(f.stopped),
+          ownsBuffer(f.ownsBuffer), mapped(f.mapped),
+          pipe(std::move(f.pipe)), pipeDepth(f.pipeDepth),
+          keyframe(f.keyframe)
+    {
+        // f still runs its destructor, make sure it doesn't free what we took over
+        f.data = nullptr;
+        f.ownsBuffer = false;
+        f.mapped = false;
+    }
+
+    dem_file& dem_file::operator=(dem_file&& f) {
+        swap(f);
+        return *this;
     }
 
     dem_file::~dem_file() {
-        if (data && ownsBuffer)
-            delete[] data;
+        // Stop the pipeline before the data it reads from goes away
+        pipe.reset();
+        release();
+    }
 
-        if (dataSnappy)
-            delete[] dataSnappy;
+    void dem_file::swap(dem_file& f) {
+        std::swap(data, f.data);
+        std::swap(dataSize, f.dataSize);
+        std::swap(dataPos, f.dataPos);
+        std::swap(dataCapacity, f.dataCapacity);
+        std::swap(pool, f.pool);
+        std::swap(dataSnappy, f.dataSnappy);
+        std::swap(packets, f.packets);
+        std::swap(packetErrors, f.packetErrors);
+        std::swap(arenaBlock, f.arenaBlock);
+        std::swap(arena, f.arena);
+        std::swap(cache, f.cache);
+        std::swap(sendTables, f.sendTables);
+        std::swap(classInfo, f.classInfo);
+        std::swap(signonTables, f.signonTables);
+        std::swap(stringTables, f.stringTables);
+        std::swap(subscriptions, f.subscriptions);
+        std::swap(dataMessage, f.dataMessage);
+        std::swap(source_version, f.source_version);
+        std::swap(offset, f.offset);
+        std::swap(path, f.path);
+        std::swap(packetIndex, f.packetIndex);
+        std::swap(indexed, f.indexed);
+        std::swap(source, f.source);
+        std::swap(stopped, f.stopped);
+        std::swap(ownsBuffer, f.ownsBuffer);
+        std::swap(mapped, f.mapped);
+        std::swap(pipe, f.pipe);
+        std::swap(pipeDepth, f.pipeDepth);
+        std::swap(keyframe, f.keyframe);
     }
 
     dem_packet dem_file::get() {
+        subscriber v{*this, nullptr};
+        return read(v);
+    }
+
+    bool dem_file::good() {
+        if (source) {
+            if (stopped)
+                return false;
+
+            // Try to find out whether the source is exhausted
+            if (dataPos >= dataSize && !source->eof())
+                fill(0, false);
+
+            return (dataPos < dataSize) || !source->eof();
+        }
+
+        return (dataPos < dataSize);
+    }
+
+    bool dem_file::poll() {
+        return !source || (!stopped && fill(0, false));
+    }
+
+    const dem_index& dem_file::index() {
+        if (source)
+            ALICE_THROW(DemNotSeekable, "index");
+
+        if (!indexed) {
+            const std::string stored = path + ALICE_INDEX_EXTENSION;
+
+            if (path.empty() || !packetIndex.load(stored.c_str(), data, dataSize))
+                packetIndex = dem_index::scan(data, dataSize, sizeof(dem_header));
+
+            indexed = true;
+        }
+
+        return packetIndex;
+    }
+
+    void dem_file::write_index() {
+        if (path.empty())
+            ALICE_THROW(DemIndexIO, "Construction from buffer");
+
+        index().save((path + ALICE_INDEX_EXTENSION).c_str());
+    }
+
+    bool dem_file::seek(uint32_t tick) {
+        if (source)
+            ALICE_THROW(DemNotSeekable, tick);
+
+        const dem_keyframe* frame = index().find(tick);
+
+        dataPos = frame ? frame->offset : sizeof(dem_header);
+
+        // Restart the pipeline at the new position
+        if (pipeDepth)
+            pipeline(pipeDepth);
+
+        return frame != nullptr;
+    }
+
+    void dem_file::pipeline(std::size_t depth) {
+        if (source)
+            ALICE_THROW(DemNotPipelined, depth);
+
+        pipe.reset();
+        pipeDepth = depth;
+
+        if (depth && dataPos < dataSize)
+            pipe.reset(new dem_pipeline(data, dataSize, dataPos, depth, pool));
+    }
+
+    void dem_file::reuse_messages(bool enable) {
+        cache.reset(enable ? new packet_cache(packets) : nullptr);
+    }
+
+    std::vector<dem_segment> dem_file::segments(std::size_t count) {
+        const std::size_t begin = sizeof(dem_header);
+
+        // Offsets of all full packets, sync ticks don't carry the complete state
+        std::vector<dem_keyframe> full;
+        for (auto &k : index().frames()) {
+            if (k.type == ps2::DEM_FullPacket)
+                full.push_back(k);
+        }
+
+        std::vector<dem_segment> ret;
+        ret.push_back(dem_segment{begin, dataSize, 0});
+
+        // Split at the first full packet past each evenly spaced byte offset
+        auto it = full.begin();
+        for (std::size_t i = 1; i < count; ++i) {
+            const std::size_t target = begin + (dataSize - begin) / count * i;
+
+            it = std::find_if(it, full.end(), [&](const dem_keyframe& k) {
+                return k.offset >= target && k.offset > ret.back().begin;
+            });
+
+            if (it == full.end())
+                break;
+
+            ret.back().end = it->offset;
+            ret.push_back(dem_segment{static_cast<std::size_t>(it->offset), dataSize, it->tick});
+        }
+
+        // Segments past the first need the signon state to read their full packet
+        if (ret.size() > 1 && source_version == engine::two)
+            read_signon(ret.front().end);
+
+        return ret;
+    }
+
+    dem_file dem_file::segment(const dem_segment& s, packet_list* registry) {
+        if (source)
+            ALICE_THROW(DemNotSeekable, "segment");
+
+        dem_file ret(data, s.end, registry);
+        ret.dataPos = s.begin;
+        ret.sendTables = sendTables;
+        ret.classInfo = classInfo;
+
+        if (s.begin > sizeof(dem_header)) {
+            ret.signonTables = signonTables;
+            ret.keyframe = true;
+        }
+
+        return ret;
+    }
+
+    dem_packet dem_file::next() {
         assert(dataPos <= dataSize);
 
         dem_packet ret;
+
+        if (pipe) {
+            // Truncated replay, the pipeline stops at the last complete packet
+            if (!pipe->next(ret, dataPos)) {
+                dataPos = dataSize;
+                return dem_packet{0, ps2::DEM_Stop, 0, nullptr};
+            }
+
+            return ret;
+        }
+
+        if (source && !fill(0, true)) {
+            stopped = true;
+            return dem_packet{0, ps2::DEM_Stop, 0, nullptr};
+        }
+
         dataPos += dem_packet::from_buffer(ret, data+dataPos, dataSize-dataPos, true);
 
+        if (source && (ret.type & ~ps2::DEM_IsCompressed) == ps2::DEM_Stop)
+            stopped = true;
+
         if (ret.type & ps2::DEM_IsCompressed)
-            dem_packet::uncompress(ret, dataSnappy, ALICE_SNAPPY_BUFFER_SIZE);
-
-        /** Reads type from the header */
-        static auto read_type = [](bitstream &b) {
-            uint32_t initial = b.read(6);
-            uint32_t header  = initial >> 4; // low 2 bits for header
-
-            if (header) {
-                uint32_t bits = header * 4 + (((2 - header) >> 31) & 16);
-                return (initial & 15) | (b.read( bits ) << 4);
-            } else {
-                return initial;
+            dem_packet::uncompress(ret, dataSnappy);
+
+        return ret;
+    }
+
+    bool dem_file::fill(std::size_t n, bool block) {
+        while (true) {
+            const std::size_t avail = dataSize - dataPos;
+
+            // Check if we have enough data buffered
+            std::size_t needed = n;
+            if (needed == 0) {
+                needed = dem_packet::peek_size(data + dataPos, avail, true);
+
+                // Header incomplete, ask for the maximum size of three varints
+                if (needed == 0)
+                    needed = avail + 1;
             }
-        };
 
-        switch (ret.type)  {
-            case ps2::DEM_ClassInfo:
-                break;
-            case ps2::DEM_Packet: {
-            case ps2::DEM_SignonPacket:
-                // Both types are wrapped in a CDemoPacket
-                ps2::CDemoPacket* packet = packets->get<ps2::CDemoPacket>(
-                    PACKET_DEM, ret.type, ret.data, ret.size
-                );
-
-                // Read the packet
-                bitstream stream(packet->data());
-                while (stream.left() > 10) {
-                    uint32_t type = read_type(stream);
-                    uint32_t size = stream.readVarUInt32();
-
-                    // create packet here
-                    stream.seekForward(size << 3);
-                }
-            } break;
-            case ps2::DEM_SendTables:
+            if (needed <= avail)
+                return true;
+
+            // Move the remaining data to the front and grow the window if a single packet doesn't fit
+            if (dataPos > 0) {
+                memmove(data, data + dataPos, avail);
+                dataSize = avail;
+                dataPos = 0;
+            }
+
+            if (needed > dataCapacity) {
+                const std::size_t capacity = std::max(needed, dataCapacity * 2);
+                char* ndata = new char[capacity];
+                memcpy(ndata, data, dataSize);
+                delete[] data;
+
+                data = ndata;
+                dataCapacity = capacity;
+            }
+
+            const std::size_t r = source->read(data + dataSize, dataCapacity - dataSize);
+            dataSize += r;
+
+            if (r == 0) {
+                if (source->eof() || !block)
+                    return false;
+
+                // Replay is still being written
+                std::this_thread::sleep_for(std::chrono::microseconds(ALICE_STREAM_POLL_USEC));
+            }
+        }
+    }
+
+    void dem_file::create_arena() {
+        arenaBlock.reset(new char[ALICE_ARENA_BLOCK_SIZE]);
+
+        google::protobuf::ArenaOptions options;
+        options.initial_block = arenaBlock.get();
+        options.initial_block_size = ALICE_ARENA_BLOCK_SIZE;
+        options.start_block_size = ALICE_ARENA_BLOCK_SIZE;
+
+        arena.reset(new google::protobuf::Arena(options));
+    }
+
+    void dem_file::parse_send_tables(const char* data, std::size_t size) {
+        // The serializers are stored with their size in front
+        wire_send_tables tables;
+        wire_view msg;
+
+        if (!wire_decode(data, size, tables) || !wire_reader(tables.data.data, tables.data.size).bytes(msg)) {
+            packetErrors.report(packet_status::parse_error);
+            return;
+        }
+
+        // Checked up front, compiling throws and the serializers compiled before have to stay in place
+        ps2::CSVCMsg_FlattenedSerializer serializer;
+        if (!serializer.ParseFromArray(msg.data, msg.size) || !flattened_serializer::valid(serializer)) {
+            packetErrors.report(packet_status::parse_error);
+            return;
+        }
+
+        sendTables = std::make_shared<const flattened_serializer>(serializer);
+    }
+
+    void dem_file::parse_string_tables(const char* data, std::size_t size) {
+        if (!signonTables)
+            return;
+
+        ps2::CDemoStringTables msg;
+        if (!msg.ParseFromArray(data, size)) {
+            packetErrors.report(packet_status::parse_error);
+            return;
+        }
+
+        // Tables are stored in the order they were created, the signon ones keep their flags
+        auto tables = std::make_shared<std::vector<string_table>>(*signonTables);
+        const std::size_t count = std::min(tables->size(), static_cast<std::size_t>(msg.tables_size()));
+
+        for (std::size_t i = 0; i < count; ++i) {
+            if ((*tables)[i].name() == msg.tables(i).table_name())
+                (*tables)[i].reset(msg.tables(i));
+        }
+
+        stringTables = std::move(tables);
+    }
+
+    void dem_file::read_signon(std::size_t end) {
+        if (signonTables)
+            return;
+
+        // Collects string tables in the order they are created
+        struct handler {
+            std::vector<string_table> tables;
+            std::vector<uint32_t> changed;
+
+            void on(const wire_create_string_table& msg, uint32_t) {
+                tables.emplace_back(msg);
+            }
+
+            void on(const wire_update_string_table& msg, uint32_t) {
+                if (msg.table_id >= 0 && static_cast<uint32_t>(msg.table_id) < tables.size())
+                    tables[msg.table_id].update(msg, changed);
+
+                changed.clear();
+            }
+        } h;
+
+        dem_file s = segment(dem_segment{sizeof(dem_header), end, 0});
+        while (s.good()) {
+            if (s.get(h).type == ps2::DEM_SyncTick)
                 break;
         }
 
-        return ret;
+        sendTables = s.sendTables;
+        classInfo = s.classInfo;
+        signonTables = std::make_shared<const std::vector<string_table>>(std::move(h.tables));
     }
 
-    bool dem_file::good() {
-        return (dataPos < dataSize);
+    void dem_file::parse_class_info(const char* data, std::size_t size) {
+        ps2::CDemoClassInfo info;
+        if (!info.ParseFromArray(data, size)) {
+            packetErrors.report(packet_status::parse_error);
+            return;
+        }
+
+        auto names = std::make_shared<std::vector<std::string>>();
+        for (const auto& c : info.classes()) {
+            if (c.class_id() < 0 || c.class_id() >= ALICE_ENTITY_CLASS_MAX) {
+                packetErrors.report(packet_status::parse_error);
+                return;
+            }
+
+            if (names->size() <= static_cast<uint32_t>(c.class_id()))
+                names->resize(c.class_id() + 1);
+
+            (*names)[c.class_id()] = c.network_name();
+        }
+
+        classInfo = std::move(names);
+    }
+
+    void dem_file::load_copy(const char* path) {
+        std::ifstream input(path, std::ifstream::in | std::ifstream::binary);
+
+        if (!input.is_open())
+            ALICE_THROW(DemFileIO, path);
+
+        const std::streampos fstart = input.tellg();
+        input.seekg (0, std::ios::end);
+        dataSize = input.tellg() - fstart;
+        input.seekg(fstart);
+
+        if (dataSize < sizeof(dem_header))
+            ALICE_THROW(DemFileSize, path);
+
+        // read everything into the buffer
+        data = new char[dataSize];
+        input.read(data, dataSize);
+        input.close();
+    }
+
+    void dem_file::load_map(const char* path) {
+    #ifdef WIN32
+        // No mmap available, fall back to reading the whole file
+        load_copy(path);
+    #else
+        int fd = open(path, O_RDONLY);
+
+        if (fd < 0)
+            ALICE_THROW(DemFileIO, path);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            ALICE_THROW(DemFileIO, path);
+        }
+
+        dataSize = st.st_size;
+
+        if (dataSize < sizeof(dem_header)) {
+            close(fd);
+            ALICE_THROW(DemFileSize, path);
+        }
+
+        // The mapping stays valid after the descriptor is closed
+        void* mem = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mem == MAP_FAILED)
+            ALICE_THROW(DemFileIO, path);
+
+        // Packets are read front to back, let the kernel read ahead aggressively
+        madvise(mem, dataSize, MADV_SEQUENTIAL);
+        madvise(mem, dataSize, MADV_WILLNEED);
+
+        data = static_cast<char*>(mem);
+        mapped = true;
+    #endif /* WIN32 */
+    }
+
+    void dem_file::release() {
+        if (!data || !ownsBuffer)
+            return;
+
+    #ifndef WIN32
+        if (mapped) {
+            munmap(data, dataSize);
+            data = nullptr;
+            return;
+        }
+    #endif /* WIN32 */
+
+        delete[] data;
+        data = nullptr;
     }
 
-    void dem_file::parse_header() {
+    void dem_file::parse_header(packet_list* registry) {
         // load header
         dem_header head;
         memcpy((char*) &head, data, sizeof(dem_header));
 
         // set offset and version
         offset = head.offset;
+        source_version = head.version();
 
-        switch (constexpr_hash_rt(head.headerid)) {
-            case ALICE_S1_HEADER:
-                source_version = engine::one;
-                packet_register_s1();
+        // Custom registries are filled on every open, the shared ones are only built once
+        switch (source_version) {
+            case engine::one:
+                if (registry)
+                    packet_register_s1(registry);
+                else
+                    packets = packet_registry_s1();
                 break;
-            case ALICE_S2_HEADER:
-                source_version = engine::two;
-                packet_register_s2();
+            case engine::two:
+                if (registry)
+                    packet_register_s2(registry);
+                else
+                    packets = packet_registry_s2();
                 break;
             default:
-                source_version = engine::unkown;
                 break;
         }
 
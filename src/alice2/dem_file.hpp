@@ -23,14 +23,26 @@
 #ifndef _ALICE_DEM_FILE_HPP_
 #define _ALICE_DEM_FILE_HPP_
 
+#include <array>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstddef>
 
 #include "util/bitstream.hpp"
 #include "util/exception.hpp"
 #include "util/noncopyable.hpp"
+#include "config.hpp"
 #include "dem.hpp"
+#include "dem_index.hpp"
+#include "dem_pipeline.hpp"
+#include "dem_source.hpp"
+#include "packet_dispatch.hpp"
 #include "packets.hpp"
+#include "serializer.hpp"
+#include "string_table.hpp"
+#include "wire.hpp"
 
 namespace alice {
     /// Thrown when the parser fails to open the specified file
@@ -39,27 +51,227 @@ namespace alice {
     ALICE_CREATE_EXCEPTION(DemFileSize, "File to small");
     /// Invalid file format
     ALICE_CREATE_EXCEPTION(DemInvalid, "Invalid file format or header corrupt");
+    /// Thrown when seeking in a replay that is read from a stream
+    ALICE_CREATE_EXCEPTION(DemNotSeekable, "Replay is read from a stream");
+    /// Thrown when enabling the pipeline on a replay that is read from a stream
+    ALICE_CREATE_EXCEPTION(DemNotPipelined, "Pipelining requires the whole replay in memory");
+
+    /** How a replay file is brought into memory */
+    enum class dem_load {
+        /** Read the whole file into a heap allocated buffer */
+        copy,
+        /** Map the file read-only, packets are read directly from the page cache */
+        map
+    };
+
+    /** A contiguous range of packets */
+    struct dem_segment {
+        /** Offset of the first packet, a DEM_FullPacket for all but the first segment */
+        std::size_t begin;
+        /** Offset right after the last packet */
+        std::size_t end;
+        /** Tick of the first packet, 0 for the first segment */
+        uint32_t tick;
+    };
 
     /** Class representation of a single demo file */
     class dem_file : private noncopyable {
     public:
-        /** Default move constructor */
-        dem_file(dem_file&&) = default;
-        /** Default move assignment operator */
-        dem_file& operator=(dem_file&&) = default;
+        /** Move constructor */
+        dem_file(dem_file&& f);
+        /** Move assignment operator */
+        dem_file& operator=(dem_file&& f);
 
-        /** Loads specified file into memory to be parsed */
-        dem_file(const char* path);
+        /**
+         * Loads specified file into memory to be parsed.
+         *
+         * Packets are created from the shared, immutable list of the replay's engine. If registry is set,
+         * the packets are registered with it instead and it is used by this file only.
+         */
+        dem_file(const char* path, dem_load mode = dem_load::copy, packet_list* registry = nullptr);
         /** Read from the provided buffer */
-        dem_file(char* data, std::size_t size);
+        dem_file(char* data, std::size_t size, packet_list* registry = nullptr);
+        /**
+         * Read incrementally from source, takes ownership of the source.
+         *
+         * Only a small window of the replay is kept in memory. The window grows if a single packet
+         * exceeds it. Packets returned by get() stay valid until the next call.
+         */
+        dem_file(dem_source* source, packet_list* registry = nullptr);
 
         /** Destructor */
         ~dem_file();
 
-        /** Returns a single dem packet */
+        /** Swap this file with the given one */
+        void swap(dem_file& f);
+
+        /**
+         * Returns a single dem packet.
+         *
+         * When reading from a source, this blocks until the next packet is complete. A DEM_Stop packet
+         * without data is returned if the source is exhausted in the middle of a packet. Messages created
+         * while handling the packet are freed on the next call.
+         */
         dem_packet get();
+
+        /**
+         * Returns a single dem packet and calls h.on(msg, tick) for every embedded message.
+         *
+         * Message types are resolved at compile time, messages h has no on() overload for are skipped
+         * without being parsed. Subscriptions are not called. Messages that can't be parsed are skipped and
+         * counted in errors().
+         */
+        template <typename Handler>
+        dem_packet get(Handler& h) {
+            dispatcher<Handler> v{*this, h, PACKET_NET};
+            return read(v);
+        }
+        /** Returns the engine the replay was recorded with */
+        engine version() const {
+            return source_version;
+        }
+
+        /** Returns the packet list used to create messages */
+        const packet_list* registry() const {
+            return packets;
+        }
+
+        /** Returns how often packets and embedded messages read by this file couldn't be looked up or parsed */
+        const packet_errors& errors() const {
+            return packetErrors;
+        }
+
+        /**
+         * Returns the serializers compiled from the DEM_SendTables packet.
+         *
+         * nullptr until the packet has been read, which happens right at the start of Source 2 replays.
+         * Segments share the serializers their file has compiled by the time they are created.
+         */
+        const std::shared_ptr<const flattened_serializer>& serializers() const {
+            return sendTables;
+        }
+
+        /**
+         * Returns the network name of each class by class id, read from the DEM_ClassInfo packet.
+         *
+         * nullptr until the packet has been read, ids which weren't sent have an empty name. Segments share
+         * the names like the serializers.
+         */
+        const std::shared_ptr<const std::vector<std::string>>& classes() const {
+            return classInfo;
+        }
+
+        /**
+         * Returns the string tables a segment starts with, by table id.
+         *
+         * Only set for Source 2 segments starting at a full packet, once it has been read. Tables have the
+         * layout they were created with during signon and the entries stored in the full packet. nullptr
+         * for all other files, which create their string tables themselves.
+         */
+        const std::shared_ptr<const std::vector<string_table>>& string_tables() const {
+            return stringTables;
+        }
+
         /** Whether there is still data left to read */
         bool good();
+        /** Whether get() would return without blocking, always true unless reading from a source */
+        bool poll();
+
+        /**
+         * Returns the packet index.
+         *
+         * On first use the index stored next to the replay is loaded if it exists and matches the file,
+         * otherwise the packet headers are scanned.
+         */
+        const dem_index& index();
+
+        /** Stores the packet index next to the replay so it can be loaded next time */
+        void write_index();
+
+        /**
+         * Moves the read position to the last keyframe at or before tick.
+         *
+         * The next call to get() returns the keyframe packet itself. If there is no such keyframe the
+         * position is reset to the first packet and false is returned.
+         */
+        bool seek(uint32_t tick);
+
+        /**
+         * Reads and decompresses up to depth packets ahead on a background thread, 0 turns it off.
+         *
+         * Packets returned by get() stay valid until the next call. Only available if the whole
+         * replay is in memory.
+         */
+        void pipeline(std::size_t depth = ALICE_PIPELINE_DEPTH);
+
+        /**
+         * Calls handler with every embedded message of the given type and the tick it was sent at.
+         *
+         * type is either PACKET_NET or PACKET_USR, subscriptions are kept apart by type and id. Source 1
+         * packets only embed net messages, user message subscriptions are never called for them. Only
+         * messages someone subscribed to are parsed, all others are skipped by size. The message is only
+         * valid during the call. All handlers of the same message have to use the same Obj.
+         */
+        template <typename Obj>
+        void subscribe(packet_i type, uint32_t subtype, std::function<void (const Obj&, uint32_t)> handler) {
+            typedef std::vector<std::function<void (const Obj&, uint32_t)>> handler_list;
+
+            std::vector<subscription> &list = subscriptions[type == PACKET_USR];
+            if (list.size() <= subtype)
+                list.resize(subtype+1);
+
+            subscription &s = list[subtype];
+            if (!s.decode) {
+                auto handlers = std::make_shared<handler_list>();
+
+                s.handlers = handlers;
+                s.decode = [type, subtype, handlers](dem_file& f, const char* data, std::size_t size, uint32_t tick) {
+                    packet_status status;
+                    Obj* msg = f.cache
+                        ? f.cache->template get<Obj>(type, subtype, data, size, status)
+                        : f.packets->template get<Obj>(type, subtype, data, size, status, f.arena.get());
+
+                    if (!msg) {
+                        f.packetErrors.report(status);
+                        return;
+                    }
+
+                    for (auto &h : *handlers)
+                        h(*msg, tick);
+                };
+            }
+
+            static_cast<handler_list*>(s.handlers.get())->push_back(std::move(handler));
+        }
+
+        /**
+         * Reuses a single message per packet type instead of allocating new ones from the arena.
+         *
+         * Once warmed up, decoding packets doesn't allocate anymore. Each message is overwritten by the next
+         * packet of the same type.
+         */
+        void reuse_messages(bool enable);
+
+        /**
+         * Splits the replay into up to count segments of similar size.
+         *
+         * Every segment but the first starts at a DEM_FullPacket, the first one contains all packets
+         * before the first full packet. Segments are sorted by offset and cover the whole replay.
+         *
+         * If the replay is split, the signon packets of Source 2 replays are read once up front so every
+         * segment can start with the serializers, class names and string tables they contain.
+         */
+        std::vector<dem_segment> segments(std::size_t count);
+
+        /**
+         * Returns a file reading only the packets in s.
+         *
+         * The returned file shares the replay data with this one, which has to outlive it. Packets are created
+         * from registry, or from the shared list of the engine if none is given. Segments starting at a full
+         * packet apply it when it's read: its string tables are merged into the signon tables, see
+         * string_tables(), and its embedded messages are handled like those of a DEM_Packet.
+         */
+        dem_file segment(const dem_segment& s, packet_list* registry = nullptr);
     private:
         /** Data buffer */
         char* data;
@@ -67,21 +279,271 @@ namespace alice {
         std::size_t dataSize;
         /** Current position */
         std::size_t dataPos;
-        /** Buffer for uncompressed snappy data */
-        char* dataSnappy;
-        /** Packet factory */
-        packet_list *packets;
+        /** Allocated size of the data buffer when reading from a source */
+        std::size_t dataCapacity;
+        /** Pool snappy buffers are taken from */
+        std::shared_ptr<buffer_pool> pool;
+        /** Buffer for uncompressed snappy data, grows with the largest packet */
+        buffer_pool::buffer dataSnappy;
+        /** Buffer for embedded messages that don't start on a byte boundary */
+        buffer_pool::buffer dataMessage;
+        /** Packet factory, only read from */
+        const packet_list *packets;
+        /** Failed lookups and parses, the packet factory may be shared and is never written to */
+        packet_errors packetErrors;
+        /** Memory kept for the first block of the arena */
+        std::unique_ptr<char[]> arenaBlock;
+        /** Messages created by get() are allocated here, freed in bulk on the next call */
+        std::unique_ptr<google::protobuf::Arena> arena;
+        /** Cached messages, nullptr unless messages are reused */
+        std::unique_ptr<packet_cache> cache;
+        /** Compiled serializers, nullptr until DEM_SendTables has been read */
+        std::shared_ptr<const flattened_serializer> sendTables;
+        /** Class names by id, nullptr until DEM_ClassInfo has been read */
+        std::shared_ptr<const std::vector<std::string>> classInfo;
+        /** String tables at the end of signon, nullptr until segments() has read them */
+        std::shared_ptr<const std::vector<string_table>> signonTables;
+        /** String tables the file started with, see string_tables() */
+        std::shared_ptr<const std::vector<string_table>> stringTables;
+
+        /** Parses a subscribed message and passes it to all handlers */
+        typedef std::function<void (dem_file& f, const char* data, std::size_t size, uint32_t tick)> decoder;
+
+        /** Handlers of a single message type */
+        struct subscription {
+            /** Parses the message, empty if nobody subscribed to it */
+            decoder decode;
+            /** List of handlers, the type depends on the message */
+            std::shared_ptr<void> handlers;
+        };
+
+        /** Subscriptions to net and user messages by message id */
+        std::array<std::vector<subscription>, 2> subscriptions;
 
         /** Engine this replay was created from */
         engine source_version;
         /** Offset of summary packet */
         uint32_t offset;
 
+        /** Path of the replay, empty when reading from a buffer */
+        std::string path;
+        /** Packet index, only valid if indexed is set */
+        dem_index packetIndex;
+        /** Whether the packet index has been built */
+        bool indexed;
+
+        /** Source to read from, nullptr if the whole replay is in memory */
+        std::unique_ptr<dem_source> source;
+        /** Whether the source has reached the end of the replay */
+        bool stopped;
+
         /** Whether we own the underlying buffer */
         bool ownsBuffer;
+        /** Whether the underlying buffer is a memory mapping */
+        bool mapped;
+
+        /** Background reader, nullptr unless pipelining is turned on */
+        std::unique_ptr<dem_pipeline> pipe;
+        /** Number of packets read ahead by the pipeline */
+        std::size_t pipeDepth;
+        /** Whether the next packet is applied if it's a full packet, set for segments starting at one */
+        bool keyframe;
+
+        /** Reads the file at path into a newly allocated buffer */
+        void load_copy(const char* path);
+        /** Maps the file at path into memory */
+        void load_map(const char* path);
+        /** Frees or unmaps the underlying buffer if we own it */
+        void release();
+
+        /**
+         * Reads from the source until at least n bytes or a complete packet are buffered.
+         *
+         * Passing 0 as n waits for the next packet. Returns false if the source has no more data or,
+         * if block is not set, no data right now.
+         */
+        bool fill(std::size_t n, bool block);
+
+        /** Reads the next packet and decompresses it if necessary */
+        dem_packet next();
+
+        /** Passes embedded messages to subscriptions */
+        struct subscriber {
+            dem_file& f;
+            /** Subscriptions of the message accepted last, user messages are only embedded in source 2 */
+            std::vector<subscription>* list;
+
+            bool wants(uint32_t id) {
+                for (uint32_t i = 0; i < (f.source_version == engine::two ? 2u : 1u); ++i) {
+                    std::vector<subscription>& l = f.subscriptions[i];
+                    if (id < l.size() && l[id].decode) {
+                        list = &l;
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            void on(uint32_t id, const char* data, std::size_t size, uint32_t tick) {
+                (*list)[id].decode(f, data, size, tick);
+            }
+        };
+
+        /** Passes embedded messages to a typed handler */
+        template <typename Handler>
+        struct dispatcher {
+            dem_file& f;
+            Handler& h;
+            /**
+             * Kind of the message accepted last.
+             *
+             * Source 2 embeds net and user messages in the same packet, their ids don't overlap. Source 1 only
+             * embeds net messages, user messages are wrapped in svc_UserMessage and share ids with them.
+             */
+            unsigned kind;
+
+            bool wants(uint32_t id) {
+                if (packet_accepts<Handler, uint32_t>(f.source_version, PACKET_NET, id)) {
+                    kind = PACKET_NET;
+                    return true;
+                }
+
+                if (f.source_version == engine::two
+                        && packet_accepts<Handler, uint32_t>(f.source_version, PACKET_USR, id)) {
+                    kind = PACKET_USR;
+                    return true;
+                }
+
+                return false;
+            }
+
+            void on(uint32_t id, const char* data, std::size_t size, uint32_t tick) {
+                f.packetErrors.report(packet_dispatch(f.source_version, kind, id, data, size, f.arena.get(), h, tick));
+            }
+        };
+
+        /** Reads the type of an embedded message */
+        static uint32_t read_type(bitstream &b) {
+            uint32_t initial = b.read(6);
+            uint32_t header  = initial >> 4; // low 2 bits for header
+
+            if (header) {
+                uint32_t bits = header * 4 + (((2 - header) >> 31) & 16);
+                return (initial & 15) | (b.read( bits ) << 4);
+            } else {
+                return initial;
+            }
+        }
+
+        /**
+         * Reads a single packet and hands its embedded messages to v.
+         *
+         * v.wants(id) decides whether a message is needed, v.on(id, data, size, tick) receives it. Unwanted
+         * messages are skipped by size.
+         */
+        template <typename Visitor>
+        dem_packet read(Visitor& v) {
+            // Free the messages of the previous packet, the first block is kept
+            arena->Reset();
+
+            dem_packet ret = next();
+
+            // Only a full packet a segment starts at is read, all others repeat what came before
+            const bool first = keyframe;
+            keyframe = false;
+
+            switch (ret.type)  {
+                case ps2::DEM_ClassInfo:
+                    if (source_version == engine::two)
+                        parse_class_info(ret.data, ret.size);
+                    break;
+                case ps2::DEM_Packet: {
+                case ps2::DEM_SignonPacket:
+                    // Both types are wrapped in a CDemoPacket, its payload is used in place
+                    wire_demo_packet packet;
+                    if (!wire_decode(ret.data, ret.size, packet)) {
+                        packetErrors.report(packet_status::parse_error);
+                        break;
+                    }
+
+                    read_messages(v, packet, ret.tick);
+                } break;
+                case ps2::DEM_FullPacket: {
+                    if (!first)
+                        break;
+
+                    wire_full_packet full;
+                    wire_demo_packet packet;
+                    if (!wire_decode(ret.data, ret.size, full)
+                            || !wire_decode(full.packet.data, full.packet.size, packet)) {
+                        packetErrors.report(packet_status::parse_error);
+                        break;
+                    }
+
+                    // The string tables are in place before the entities which use them
+                    if (source_version == engine::two)
+                        parse_string_tables(full.string_table.data, full.string_table.size);
+
+                    read_messages(v, packet, ret.tick);
+                } break;
+                case ps2::DEM_SendTables:
+                    if (source_version == engine::two)
+                        parse_send_tables(ret.data, ret.size);
+                    break;
+            }
+
+            return ret;
+        }
+
+        /** Hands the messages embedded in packet to v, see read() */
+        template <typename Visitor>
+        void read_messages(Visitor& v, const wire_demo_packet& packet, uint32_t tick) {
+            bitstream stream(packet.data.data, packet.data.size);
+            while (stream.left() > 10) {
+                uint32_t type = read_type(stream);
+                uint32_t size = stream.readVarUInt32();
+
+                // Truncated message
+                if (static_cast<uint64_t>(size) * 8 > stream.left())
+                    break;
+
+                if (!v.wants(type)) {
+                    stream.seekForward(size << 3);
+                    continue;
+                }
+
+                const char* msg;
+                if ((stream.position() & 7) == 0) {
+                    msg = packet.data.data + (stream.position() >> 3);
+                    stream.seekForward(size << 3);
+                } else {
+                    dataMessage.reserve(size);
+                    stream.readBits(dataMessage.data(), size << 3);
+                    msg = dataMessage.data();
+                }
+
+                v.on(type, msg, size, tick);
+            }
+        }
+
+        /** Creates the arena */
+        void create_arena();
+
+        /** Compiles the serializers sent in a DEM_SendTables packet, invalid ones keep the previous serializers */
+        void parse_send_tables(const char* data, std::size_t size);
+
+        /** Sets the string tables of a segment from the signon tables and the ones stored in its full packet */
+        void parse_string_tables(const char* data, std::size_t size);
+
+        /** Reads the signon packets before end once, keeps their serializers, class names and string tables */
+        void read_signon(std::size_t end);
+
+        /** Reads the class names sent in a DEM_ClassInfo packet, ids past ALICE_ENTITY_CLASS_MAX are a parse error */
+        void parse_class_info(const char* data, std::size_t size);
 
-        /** Verifies the file signature and detects the correct engine */
-        void parse_header();
+        /** Verifies the file signature, detects the correct engine and selects its packet list */
+        void parse_header(packet_list* registry);
     };
 }
 
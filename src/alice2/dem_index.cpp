@@ -0,0 +1,227 @@
+/**
+ * @file dem_index.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+#include <snappy.h>
+
+#include "proto/source2/demo.pb.h"
+
+#include "util/constexpr_hash.hpp"
+
+#include "config.hpp"
+#include "dem.hpp"
+#include "dem_index.hpp"
+
+namespace alice {
+    namespace {
+        /** Header of a stored index */
+        struct index_header {
+            /** Always ALICE_INDEX_MAGIC */
+            char magic[8];
+            /** Format version */
+            uint32_t version;
+            /** Byte order marker, indices are stored in native byte order */
+            uint32_t order;
+            /** Size of the replay */
+            uint64_t size;
+            /** Fingerprint of the replay */
+            uint64_t hash;
+            /** Number of packets */
+            uint32_t packets;
+            /** Number of keyframes */
+            uint32_t keyframes;
+        };
+
+        /** Byte order marker */
+        constexpr uint32_t index_order = 0x01020304;
+
+        /** FNV-1a over data, same constants as constexpr_hash */
+        uint64_t hash_bytes(uint64_t hash, const char* data, std::size_t size) {
+            for (std::size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= detail::constexpr_hash_prime;
+            }
+
+            return hash;
+        }
+    }
+
+    static_assert(sizeof(dem_index_entry) == 24, "dem_index_entry is written to disk as is");
+
+    dem_index dem_index::scan(char* data, std::size_t size, std::size_t begin) {
+        dem_index ret;
+        ret.fileSize = size;
+        ret.fileHash = fingerprint(data, size);
+
+        std::size_t pos = begin;
+
+        while (pos < size) {
+            dem_packet p;
+            std::size_t read = dem_packet::from_buffer(p, data+pos, size-pos, true);
+
+            // Truncated packet, the replay is still being written or corrupt
+            if (read == 0 || read > size-pos)
+                break;
+
+            // Only the snappy preamble is read to get the uncompressed size
+            size_t size_uncompressed = p.size;
+            if (p.type & ps2::DEM_IsCompressed)
+                snappy::GetUncompressedLength(p.data, p.size, &size_uncompressed);
+
+            ret.push(dem_index_entry{
+                pos, p.tick, p.type, static_cast<uint32_t>(p.size), static_cast<uint32_t>(size_uncompressed)
+            });
+
+            pos += read;
+        }
+
+        return ret;
+    }
+
+    uint64_t dem_index::fingerprint(const char* data, std::size_t size) {
+        const uint64_t sample = std::min<uint64_t>(size, ALICE_INDEX_HASH_SIZE);
+
+        uint64_t hash = detail::constexpr_hash_basis;
+        hash = hash_bytes(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+        hash = hash_bytes(hash, data, sample);
+        hash = hash_bytes(hash, data + (size - sample), sample);
+        return hash;
+    }
+
+    bool dem_index::load(const char* path, const char* data, std::size_t size) {
+        std::ifstream input(path, std::ifstream::in | std::ifstream::binary);
+
+        if (!input.is_open())
+            return false;
+
+        index_header head;
+        if (!input.read(reinterpret_cast<char*>(&head), sizeof(head)))
+            return false;
+
+        // Make sure the index is for this replay, fingerprinting is the expensive part
+        if (memcmp(head.magic, ALICE_INDEX_MAGIC, sizeof(head.magic)) != 0
+            || head.version != ALICE_INDEX_VERSION
+            || head.order != index_order
+            || head.size != size
+            || head.hash != fingerprint(data, size))
+        {
+            return false;
+        }
+
+        // Every packet takes at least one byte, larger counts can't belong to this replay
+        if (head.packets > size || head.keyframes > head.packets)
+            return false;
+
+        std::vector<dem_index_entry> e(head.packets);
+        std::vector<uint32_t> k(head.keyframes);
+
+        if (!input.read(reinterpret_cast<char*>(e.data()), e.size() * sizeof(dem_index_entry)))
+            return false;
+
+        if (!input.read(reinterpret_cast<char*>(k.data()), k.size() * sizeof(uint32_t)))
+            return false;
+
+        // Packets have to be sorted and inside the replay, seeking relies on both
+        uint64_t end = 0;
+        for (auto &entry : e) {
+            if (entry.offset < end || entry.offset >= size || entry.size > size - entry.offset)
+                return false;
+
+            end = entry.offset + 1;
+        }
+
+        keyframes.clear();
+        keyframes.reserve(k.size());
+
+        for (auto idx : k) {
+            if (idx >= e.size())
+                return false;
+
+            keyframes.push_back(dem_keyframe{
+                e[idx].tick, e[idx].type & ~ps2::DEM_IsCompressed, e[idx].offset
+            });
+        }
+
+        entries.swap(e);
+        fileSize = head.size;
+        fileHash = head.hash;
+        return true;
+    }
+
+    void dem_index::save(const char* path) const {
+        std::ofstream output(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+
+        if (!output.is_open())
+            ALICE_THROW(DemIndexIO, path);
+
+        // Keyframes are stored as positions in the packet list
+        std::vector<uint32_t> k;
+        k.reserve(keyframes.size());
+
+        for (auto &frame : keyframes) {
+            auto it = std::lower_bound(entries.begin(), entries.end(), frame.offset,
+                [](const dem_index_entry& e, uint64_t offset) { return e.offset < offset; }
+            );
+
+            k.push_back(it - entries.begin());
+        }
+
+        index_header head;
+        memcpy(head.magic, ALICE_INDEX_MAGIC, sizeof(head.magic));
+        head.version = ALICE_INDEX_VERSION;
+        head.order = index_order;
+        head.size = fileSize;
+        head.hash = fileHash;
+        head.packets = entries.size();
+        head.keyframes = k.size();
+
+        output.write(reinterpret_cast<const char*>(&head), sizeof(head));
+        output.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(dem_index_entry));
+        output.write(reinterpret_cast<const char*>(k.data()), k.size() * sizeof(uint32_t));
+
+        if (!output.good())
+            ALICE_THROW(DemIndexIO, path);
+    }
+
+    void dem_index::push(const dem_index_entry& e) {
+        entries.push_back(e);
+
+        const uint32_t type = e.type & ~ps2::DEM_IsCompressed;
+        if (type == ps2::DEM_FullPacket || type == ps2::DEM_SyncTick)
+            keyframes.push_back(dem_keyframe{e.tick, type, e.offset});
+    }
+
+    const dem_keyframe* dem_index::find(uint32_t tick) const {
+        // Keyframes are sorted by offset which implies they are sorted by tick
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), tick,
+            [](uint32_t t, const dem_keyframe& k) { return t < k.tick; }
+        );
+
+        if (it == keyframes.begin())
+            return nullptr;
+
+        return &*(--it);
+    }
+}
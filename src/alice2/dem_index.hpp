@@ -0,0 +1,127 @@
+/**
+ * @file dem_index.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef _ALICE_DEM_INDEX_HPP_
+#define _ALICE_DEM_INDEX_HPP_
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "util/exception.hpp"
+
+namespace alice {
+    /// Thrown when the index can't be written to disk
+    ALICE_CREATE_EXCEPTION(DemIndexIO, "Unable to write index");
+
+    /** Header information of a single packet */
+    struct dem_index_entry {
+        /** Byte offset of the packet from the start of the file */
+        uint64_t offset;
+        /** Tick the packet was emitted at */
+        uint32_t tick;
+        /** Packet type, including the compression flag */
+        uint32_t type;
+        /** Size of the packet data as stored in the file */
+        uint32_t size;
+        /** Size of the packet data after decompression, equals size for uncompressed packets */
+        uint32_t size_uncompressed;
+    };
+
+    /** A packet the parser can resume from */
+    struct dem_keyframe {
+        /** Tick the packet was emitted at */
+        uint32_t tick;
+        /** Packet type, either DEM_FullPacket or DEM_SyncTick */
+        uint32_t type;
+        /** Byte offset of the packet from the start of the file */
+        uint64_t offset;
+    };
+
+    /**
+     * Maps ticks to file offsets so a replay can be entered in the middle.
+     *
+     * An index can be stored next to the replay it belongs to so the packet headers don't have to be
+     * scanned every time the file is opened. The stored index is keyed by the size and a fingerprint
+     * of the replay and is rejected if either doesn't match, or if any of its packets lies outside of
+     * the replay.
+     */
+    class dem_index {
+    public:
+        /** Creates an empty index */
+        dem_index() : entries{}, keyframes{}, fileSize{0}, fileHash{0} {}
+
+        /**
+         * Builds the index by walking the packet headers in data, starting at begin.
+         *
+         * Only the varint header of each packet is read, packet contents are skipped.
+         */
+        static dem_index scan(char* data, std::size_t size, std::size_t begin);
+
+        /**
+         * Returns a cheap fingerprint of the replay, hashing its size, head and tail.
+         *
+         * Only the first and last ALICE_INDEX_HASH_SIZE bytes are hashed so loading an index stays
+         * cheap for large replays. A replay modified in between without changing its size keeps its
+         * fingerprint, its stored index has to be deleted by hand.
+         */
+        static uint64_t fingerprint(const char* data, std::size_t size);
+
+        /** Loads index from path, returns false if it doesn't exist or doesn't belong to data */
+        bool load(const char* path, const char* data, std::size_t size);
+
+        /** Writes the index to path */
+        void save(const char* path) const;
+
+        /** Returns the last keyframe at or before tick, nullptr if there is none */
+        const dem_keyframe* find(uint32_t tick) const;
+
+        /** Whether the index contains any keyframes */
+        bool empty() const {
+            return keyframes.empty();
+        }
+
+        /** Returns a list of all keyframes sorted by offset */
+        const std::vector<dem_keyframe>& frames() const {
+            return keyframes;
+        }
+
+        /** Returns a list of all packets sorted by offset */
+        const std::vector<dem_index_entry>& packets() const {
+            return entries;
+        }
+    private:
+        /** Packets sorted by offset */
+        std::vector<dem_index_entry> entries;
+        /** Keyframes sorted by offset */
+        std::vector<dem_keyframe> keyframes;
+        /** Size of the indexed replay */
+        uint64_t fileSize;
+        /** Fingerprint of the indexed replay */
+        uint64_t fileHash;
+
+        /** Adds packet to the index */
+        void push(const dem_index_entry& e);
+    };
+}
+
+#endif /* _ALICE_DEM_INDEX_HPP_ */
@@ -0,0 +1,138 @@
+/**
+ * @file dem_parallel.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_DEM_PARALLEL_HPP_
+#define _ALICE_DEM_PARALLEL_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+#include "util/noncopyable.hpp"
+#include "config.hpp"
+#include "dem_file.hpp"
+#include "packets.hpp"
+
+namespace alice {
+    /**
+     * Parses a single replay on multiple threads.
+     *
+     * The replay is split at full packets into a few segments per worker, see dem_file::segments. Each
+     * segment is parsed by its own dem_file, results are returned in tick order. Since a full packet
+     * carries the complete game state, segments can be parsed independently.
+     * Data sent before the first full packet, like class info and send tables, is only part of the first
+     * segment. The others get the serializers, class names and signon string tables from f and read the
+     * full packet they start at first, see dem_file::segment.
+     */
+    template <typename Result>
+    class dem_parallel : private noncopyable {
+    public:
+        /** Job run for every segment */
+        typedef std::function<Result (dem_file&, const dem_segment&)> job;
+
+        /** Creates a parser with the given number of workers, 0 uses one per core */
+        explicit dem_parallel(std::size_t workers = 0)
+            : workerCount(workers ? workers : std::max(1u, std::thread::hardware_concurrency())) {}
+
+        /** Returns the number of workers */
+        std::size_t workers() const {
+            return workerCount;
+        }
+
+        /**
+         * Runs j on every segment of f and returns the results in tick order.
+         *
+         * f has to hold the whole replay in memory. If a job throws, the remaining segments are skipped and
+         * the first exception is rethrown once all workers are done.
+         */
+        std::vector<Result> run(dem_file& f, job j) {
+            // Building the index isn't thread safe, do it before the segments are handed out
+            const std::vector<dem_segment> parts = f.segments(workerCount * ALICE_PARALLEL_SEGMENTS);
+            // Wrapped so workers never share storage, like they would with std::vector<bool>
+            std::vector<slot> results(parts.size());
+
+            std::atomic<std::size_t> next(0);
+            std::exception_ptr error;
+            std::mutex mutex;
+
+            auto work = [&]() {
+#ifndef ALICE_NO_EXCEPTIONS
+                try {
+#endif /* ALICE_NO_EXCEPTIONS */
+                    for (std::size_t i = next++; i < parts.size(); i = next++) {
+                        dem_file segment = f.segment(parts[i]);
+                        results[i].value = j(segment, parts[i]);
+                    }
+#ifndef ALICE_NO_EXCEPTIONS
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+
+                    // Make the other workers stop after their current segment
+                    next = parts.size();
+                }
+#endif /* ALICE_NO_EXCEPTIONS */
+            };
+
+            std::vector<std::thread> threads;
+            for (std::size_t i = 1; i < std::min(workerCount, parts.size()); ++i)
+                threads.emplace_back(work);
+
+            // The calling thread works as well
+            work();
+
+            for (auto &t : threads)
+                t.join();
+
+#ifndef ALICE_NO_EXCEPTIONS
+            if (error)
+                std::rethrow_exception(error);
+#endif /* ALICE_NO_EXCEPTIONS */
+
+            std::vector<Result> ret;
+            ret.reserve(results.size());
+
+            for (auto &r : results)
+                ret.push_back(std::move(r.value));
+
+            return ret;
+        }
+    private:
+        /** Result of a single segment */
+        struct slot {
+            Result value;
+        };
+
+        /** Number of worker threads, including the calling thread */
+        std::size_t workerCount;
+    };
+}
+
+#endif /* _ALICE_DEM_PARALLEL_HPP_ */
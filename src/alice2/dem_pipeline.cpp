@@ -0,0 +1,111 @@
+/**
+ * @file dem_pipeline.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include "proto/source2/demo.pb.h"
+
+#include "dem_pipeline.hpp"
+
+namespace alice {
+    dem_pipeline::dem_pipeline(char* data, std::size_t size, std::size_t pos, std::size_t depth,
+        std::shared_ptr<buffer_pool> pool)
+        : data(data), size(size), pos(pos), slots(depth), head(0), count(0), held(false), finished(false), stop(false)
+    {
+        // Buffers grow on the background thread, make sure they come from the given pool
+        for (auto &s : slots)
+            s.buffer = pool->acquire(0);
+
+        worker = std::thread(&dem_pipeline::run, this);
+    }
+
+    dem_pipeline::~dem_pipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+
+        cond.notify_all();
+        worker.join();
+    }
+
+    bool dem_pipeline::next(dem_packet& packet, std::size_t& end) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // Hand the previous slot back to the background thread
+        if (held) {
+            head = (head + 1) % slots.size();
+            --count;
+            held = false;
+            cond.notify_all();
+        }
+
+        cond.wait(lock, [this]() { return count > 0 || finished; });
+
+        if (count == 0)
+            return false;
+
+        packet = slots[head].packet;
+        end = slots[head].end;
+        held = true;
+        return true;
+    }
+
+    void dem_pipeline::run() {
+        while (pos < size) {
+            std::size_t idx;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this]() { return stop || count < slots.size(); });
+
+                if (stop)
+                    break;
+
+                idx = (head + count) % slots.size();
+            }
+
+            // Only the background thread touches free slots, no need to lock here
+            slot &s = slots[idx];
+            std::size_t read = dem_packet::from_buffer(s.packet, data+pos, size-pos, true);
+
+            // Truncated packet
+            if (read == 0 || read > size-pos)
+                break;
+
+            if (s.packet.type & ps2::DEM_IsCompressed)
+                dem_packet::uncompress(s.packet, s.buffer);
+
+            pos += read;
+            s.end = pos;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++count;
+            }
+
+            cond.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        cond.notify_all();
+    }
+}
@@ -0,0 +1,101 @@
+/**
+ * @file dem_pipeline.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef _ALICE_DEM_PIPELINE_HPP_
+#define _ALICE_DEM_PIPELINE_HPP_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+#include "util/buffer_pool.hpp"
+#include "util/noncopyable.hpp"
+#include "dem.hpp"
+
+namespace alice {
+    /**
+     * Reads and decompresses packets ahead of the consumer on a background thread.
+     *
+     * The background thread walks the packet headers and decompresses up to depth packets into its own
+     * buffers. Each packet returned by next() stays valid until next() is called again.
+     */
+    class dem_pipeline : private noncopyable {
+    public:
+        /** Starts reading data at pos, keeping up to depth packets ready in buffers taken from pool */
+        dem_pipeline(char* data, std::size_t size, std::size_t pos, std::size_t depth, std::shared_ptr<buffer_pool> pool);
+
+        /** Destructor, stops the background thread */
+        ~dem_pipeline();
+
+        /**
+         * Returns the next packet and the offset right after it.
+         *
+         * Blocks until the packet is ready, returns false if there are no packets left.
+         */
+        bool next(dem_packet& packet, std::size_t& end);
+    private:
+        /** A packet ready to be consumed */
+        struct slot {
+            /** The packet, points either into the replay or into buffer */
+            dem_packet packet;
+            /** Offset of the following packet */
+            std::size_t end;
+            /** Holds the decompressed data */
+            buffer_pool::buffer buffer;
+        };
+
+        /** Replay data */
+        char* data;
+        /** Size of the replay data */
+        std::size_t size;
+        /** Read position of the background thread */
+        std::size_t pos;
+
+        /** Ring of slots */
+        std::vector<slot> slots;
+        /** First slot owned by the consumer */
+        std::size_t head;
+        /** Number of filled slots */
+        std::size_t count;
+        /** Whether the consumer holds the slot at head */
+        bool held;
+        /** Whether the background thread is done */
+        bool finished;
+        /** Whether the background thread should stop */
+        bool stop;
+
+        /** Guards the ring */
+        std::mutex mutex;
+        /** Signaled when the state of the ring changes */
+        std::condition_variable cond;
+        /** Background thread */
+        std::thread worker;
+
+        /** Runs on the background thread */
+        void run();
+    };
+}
+
+#endif /* _ALICE_DEM_PIPELINE_HPP_ */
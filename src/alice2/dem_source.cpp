@@ -0,0 +1,251 @@
+/**
+ * @file dem_source.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef ALICE_HAVE_BZIP2
+    #include <bzlib.h>
+#endif /* ALICE_HAVE_BZIP2 */
+
+#ifdef ALICE_HAVE_ZLIB
+    #include <zlib.h>
+#endif /* ALICE_HAVE_ZLIB */
+
+#include "dem_source.hpp"
+
+namespace alice {
+    namespace {
+        /** Whether str ends with suffix */
+        bool ends_with(const std::string& str, const char* suffix) {
+            const std::size_t n = strlen(suffix);
+            return str.size() >= n && str.compare(str.size() - n, n, suffix) == 0;
+        }
+    }
+
+    dem_source* dem_source::open(const char* path, bool follow) {
+        const std::string p(path);
+
+    #ifdef ALICE_HAVE_BZIP2
+        if (ends_with(p, ".bz2"))
+            return new dem_source_async(new dem_source_bz2(path));
+    #endif /* ALICE_HAVE_BZIP2 */
+
+    #ifdef ALICE_HAVE_ZLIB
+        if (ends_with(p, ".gz"))
+            return new dem_source_async(new dem_source_gz(path));
+    #endif /* ALICE_HAVE_ZLIB */
+
+        return new dem_source_fd(path, follow);
+    }
+
+    dem_source_fd::dem_source_fd(int fd, bool follow)
+        : fd(fd), ownsFd(false), follow(follow), done(false)
+    {
+        detect();
+    }
+
+    dem_source_fd::dem_source_fd(const char* path, bool follow)
+        : fd(::open(path, O_RDONLY)), ownsFd(true), follow(follow), done(false)
+    {
+        if (fd < 0)
+            ALICE_THROW(DemSourceIO, path);
+
+        detect();
+    }
+
+    dem_source_fd::~dem_source_fd() {
+        if (ownsFd && fd >= 0)
+            close(fd);
+    }
+
+    std::size_t dem_source_fd::read(char* buffer, std::size_t size) {
+        if (done)
+            return 0;
+
+        ssize_t r = ::read(fd, buffer, size);
+
+        if (r > 0)
+            return r;
+
+        if (r == 0) {
+            // A regular file might still grow, everything else is closed
+            if (!follow)
+                done = true;
+
+            return 0;
+        }
+
+        // Non-blocking descriptors without data and interrupted reads are retried later
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+
+        done = true;
+        ALICE_THROW(DemSourceIO, strerror(errno));
+    }
+
+    void dem_source_fd::detect() {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+            follow = false;
+    }
+
+#ifdef ALICE_HAVE_BZIP2
+    dem_source_bz2::dem_source_bz2(const char* path)
+        : file(fopen(path, "rb")), bz(nullptr), done(false)
+    {
+        if (!file)
+            ALICE_THROW(DemSourceIO, path);
+
+        int err;
+        bz = BZ2_bzReadOpen(&err, file, 0, 0, nullptr, 0);
+
+        if (err != BZ_OK) {
+            BZ2_bzReadClose(&err, bz);
+            fclose(file);
+            ALICE_THROW(DemSourceIO, path << " (bzip2 error " << err << ")");
+        }
+    }
+
+    dem_source_bz2::~dem_source_bz2() {
+        int err;
+        BZ2_bzReadClose(&err, bz);
+        fclose(file);
+    }
+
+    std::size_t dem_source_bz2::read(char* buffer, std::size_t size) {
+        if (done)
+            return 0;
+
+        int err;
+        int r = BZ2_bzRead(&err, bz, buffer, size);
+
+        if (err == BZ_STREAM_END) {
+            done = true;
+        } else if (err != BZ_OK) {
+            done = true;
+            ALICE_THROW(DemSourceIO, "bzip2 error " << err);
+        }
+
+        return r;
+    }
+#endif /* ALICE_HAVE_BZIP2 */
+
+#ifdef ALICE_HAVE_ZLIB
+    dem_source_gz::dem_source_gz(const char* path)
+        : gz(gzopen(path, "rb")), done(false)
+    {
+        if (!gz)
+            ALICE_THROW(DemSourceIO, path);
+
+        gzbuffer(static_cast<gzFile>(gz), ALICE_STREAM_BUFFER_SIZE);
+    }
+
+    dem_source_gz::~dem_source_gz() {
+        gzclose(static_cast<gzFile>(gz));
+    }
+
+    std::size_t dem_source_gz::read(char* buffer, std::size_t size) {
+        if (done)
+            return 0;
+
+        int r = gzread(static_cast<gzFile>(gz), buffer, size);
+
+        if (r < 0) {
+            done = true;
+
+            int err;
+            ALICE_THROW(DemSourceIO, gzerror(static_cast<gzFile>(gz), &err));
+        }
+
+        if (r == 0)
+            done = true;
+
+        return r;
+    }
+#endif /* ALICE_HAVE_ZLIB */
+
+    dem_source_async::dem_source_async(dem_source* source, std::size_t size)
+        : source(source), ring(size), error(nullptr), worker(&dem_source_async::run, this) {}
+
+    dem_source_async::~dem_source_async() {
+        // Closing the ring makes pending writes fail which ends the thread
+        ring.close();
+        worker.join();
+    }
+
+    std::size_t dem_source_async::read(char* buffer, std::size_t size) {
+        const std::size_t r = ring.read(buffer, size);
+
+#ifndef ALICE_NO_EXCEPTIONS
+        // Only rethrow once everything before the error has been consumed
+        if (r == 0 && error)
+            std::rethrow_exception(error);
+#endif /* ALICE_NO_EXCEPTIONS */
+
+        return r;
+    }
+
+    void dem_source_async::run() {
+#ifdef ALICE_NO_EXCEPTIONS
+        pump();
+#else
+        try {
+            pump();
+        } catch (...) {
+            error = std::current_exception();
+        }
+#endif /* ALICE_NO_EXCEPTIONS */
+
+        ring.close();
+    }
+
+    void dem_source_async::pump() {
+        std::vector<char> chunk(ALICE_STREAM_BUFFER_SIZE);
+
+        while (!source->eof()) {
+            const std::size_t r = source->read(chunk.data(), chunk.size());
+
+            if (r == 0) {
+                // The reader is gone, don't wait for a source that might never produce data
+                if (ring.is_closed())
+                    return;
+
+                // Nothing available right now, e.g. following a file that is being recorded
+                if (!source->eof())
+                    std::this_thread::sleep_for(std::chrono::microseconds(ALICE_STREAM_POLL_USEC));
+
+                continue;
+            }
+
+            if (!ring.write(chunk.data(), r))
+                return; // reader is gone
+        }
+    }
+}
\ No newline at end of file
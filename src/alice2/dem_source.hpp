@@ -0,0 +1,194 @@
+/**
+ * @file dem_source.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef _ALICE_DEM_SOURCE_HPP_
+#define _ALICE_DEM_SOURCE_HPP_
+
+#include <exception>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <cstdio>
+
+#include "util/exception.hpp"
+#include "util/noncopyable.hpp"
+#include "util/ring_buffer.hpp"
+#include "config.hpp"
+
+namespace alice {
+    /// Thrown when reading from a source fails
+    ALICE_CREATE_EXCEPTION(DemSourceIO, "Unable to read from source");
+
+    /** Replay data that is read incrementally instead of being loaded up front */
+    class dem_source : private noncopyable {
+    public:
+        /** Virtual destructor */
+        virtual ~dem_source() = default;
+
+        /**
+         * Reads up to size bytes into buffer and returns the number of bytes read.
+         *
+         * Returns 0 if no data is available right now. Whether more data can arrive later is indicated by eof().
+         */
+        virtual std::size_t read(char* buffer, std::size_t size) = 0;
+
+        /** Whether the source is exhausted and won't produce any more data */
+        virtual bool eof() const = 0;
+
+        /**
+         * Opens the replay at path, picking a source based on the extension.
+         *
+         * Compressed replays (.bz2, .gz) are decompressed on a background thread so parsing and
+         * decompression overlap. Everything else is read directly.
+         */
+        static dem_source* open(const char* path, bool follow = false);
+    };
+
+    /**
+     * Reads from a file descriptor.
+     *
+     * Works for pipes, sockets and regular files. When following a regular file, reaching the end is treated
+     * as "no data yet" so replays that are still being recorded can be parsed while they are written. Pipes
+     * and sockets are exhausted once the writing end is closed.
+     */
+    class dem_source_fd : public dem_source {
+    public:
+        /** Reads from fd, the descriptor is not closed on destruction */
+        dem_source_fd(int fd, bool follow = false);
+        /** Opens the file at path */
+        dem_source_fd(const char* path, bool follow = false);
+
+        /** Destructor, closes the file if opened from a path */
+        virtual ~dem_source_fd();
+
+        /** Reads up to size bytes into buffer */
+        virtual std::size_t read(char* buffer, std::size_t size);
+
+        /** Whether the source is exhausted */
+        virtual bool eof() const {
+            return done;
+        }
+    private:
+        /** File descriptor */
+        int fd;
+        /** Whether we opened and need to close the descriptor */
+        bool ownsFd;
+        /** Whether to wait for more data at the end of a regular file */
+        bool follow;
+        /** Whether the source is exhausted */
+        bool done;
+
+        /** Disables following for anything that is not a regular file */
+        void detect();
+    };
+
+#ifdef ALICE_HAVE_BZIP2
+    /** Decompresses a .bz2 replay while reading */
+    class dem_source_bz2 : public dem_source {
+    public:
+        /** Opens the file at path */
+        dem_source_bz2(const char* path);
+
+        /** Destructor */
+        virtual ~dem_source_bz2();
+
+        /** Reads up to size decompressed bytes into buffer */
+        virtual std::size_t read(char* buffer, std::size_t size);
+
+        /** Whether the end of the compressed stream has been reached */
+        virtual bool eof() const {
+            return done;
+        }
+    private:
+        /** Underlying file */
+        FILE* file;
+        /** bzip2 handle */
+        void* bz;
+        /** Whether the source is exhausted */
+        bool done;
+    };
+#endif /* ALICE_HAVE_BZIP2 */
+
+#ifdef ALICE_HAVE_ZLIB
+    /** Decompresses a .gz replay while reading */
+    class dem_source_gz : public dem_source {
+    public:
+        /** Opens the file at path */
+        dem_source_gz(const char* path);
+
+        /** Destructor */
+        virtual ~dem_source_gz();
+
+        /** Reads up to size decompressed bytes into buffer */
+        virtual std::size_t read(char* buffer, std::size_t size);
+
+        /** Whether the end of the compressed stream has been reached */
+        virtual bool eof() const {
+            return done;
+        }
+    private:
+        /** zlib handle */
+        void* gz;
+        /** Whether the source is exhausted */
+        bool done;
+    };
+#endif /* ALICE_HAVE_ZLIB */
+
+    /**
+     * Reads from another source on a background thread.
+     *
+     * Data is handed over through a ring buffer, which lets expensive sources like decompression run
+     * concurrently to the parser. read() blocks until data is available.
+     */
+    class dem_source_async : public dem_source {
+    public:
+        /** Reads from source, takes ownership of it */
+        dem_source_async(dem_source* source, std::size_t size = ALICE_RING_BUFFER_SIZE);
+
+        /** Destructor, stops the background thread */
+        virtual ~dem_source_async();
+
+        /** Reads up to size bytes into buffer */
+        virtual std::size_t read(char* buffer, std::size_t size);
+
+        /** Whether the underlying source is exhausted and everything has been read */
+        virtual bool eof() const {
+            return ring.done();
+        }
+    private:
+        /** Source read by the background thread */
+        std::unique_ptr<dem_source> source;
+        /** Data read but not consumed yet */
+        mutable ring_buffer ring;
+        /** Error thrown by the background thread */
+        std::exception_ptr error;
+        /** Background thread */
+        std::thread worker;
+
+        /** Runs on the background thread */
+        void run();
+        /** Copies data from the source to the ring until either is done */
+        void pump();
+    };
+}
+
+#endif /* _ALICE_DEM_SOURCE_HPP_ */
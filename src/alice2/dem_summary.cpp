@@ -0,0 +1,174 @@
+/**
+ * @file dem_summary.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstring>
+
+#include <snappy.h>
+
+#include "proto/source1/demo_s1.pb.h"
+#include "proto/source2/demo.pb.h"
+
+#include "dem_summary.hpp"
+
+namespace alice {
+    namespace {
+        /** Copies the fields of a CDemoFileInfo, the layout is the same for both engines */
+        template <typename Info>
+        void fill(dem_summary& s, const Info& info) {
+            s.playback_time = info.playback_time();
+            s.playback_ticks = info.playback_ticks();
+            s.playback_frames = info.playback_frames();
+
+            const auto &game = info.game_info().dota();
+            s.match_id = game.match_id();
+            s.game_mode = game.game_mode();
+            s.game_winner = game.game_winner();
+            s.league_id = game.leagueid();
+            s.radiant_team_id = game.radiant_team_id();
+            s.dire_team_id = game.dire_team_id();
+            s.radiant_team_tag = game.radiant_team_tag();
+            s.dire_team_tag = game.dire_team_tag();
+            s.end_time = game.end_time();
+
+            s.players.reserve(game.player_info_size());
+            for (auto &p : game.player_info()) {
+                s.players.push_back(dem_player{
+                    p.hero_name(), p.player_name(), p.is_fake_client(), p.steamid(), p.game_team()
+                });
+            }
+        }
+
+        /** Decodes the summary packet */
+        dem_summary decode(engine version, dem_packet& p) {
+            if ((p.type & ~ps2::DEM_IsCompressed) != ps2::DEM_FileInfo)
+                ALICE_THROW(DemInvalid, "Summary offset doesn't point to a summary");
+
+            std::string uncompressed;
+            if (p.type & ps2::DEM_IsCompressed) {
+                if (!snappy::Uncompress(p.data, p.size, &uncompressed))
+                    ALICE_THROW(DemInvalid, "Unable to decompress summary");
+
+                p.data = &uncompressed[0];
+                p.size = uncompressed.size();
+            }
+
+            dem_summary ret;
+            ret.source_version = version;
+
+            if (version == engine::one) {
+                ps1::CDemoFileInfo info;
+                if (!info.ParseFromArray(p.data, p.size))
+                    ALICE_THROW(DemInvalid, "Unable to parse summary");
+
+                fill(ret, info);
+            } else {
+                ps2::CDemoFileInfo info;
+                if (!info.ParseFromArray(p.data, p.size))
+                    ALICE_THROW(DemInvalid, "Unable to parse summary");
+
+                fill(ret, info);
+            }
+
+            return ret;
+        }
+
+        /** Verifies head and returns the engine, throws if there is no summary */
+        engine verify(const dem_header& head, std::size_t size) {
+            engine version = head.version();
+
+            if (version == engine::unkown)
+                ALICE_THROW(DemInvalid, "Unkown header");
+
+            // Replays that are still being recorded don't point anywhere yet
+            if (head.offset <= static_cast<int32_t>(sizeof(dem_header))
+                || static_cast<std::size_t>(head.offset) >= size)
+                ALICE_THROW(DemNoSummary, head.offset);
+
+            return version;
+        }
+    }
+
+    dem_summary dem_summary::from_file(const char* path) {
+        std::ifstream input(path, std::ifstream::in | std::ifstream::binary);
+
+        if (!input.is_open())
+            ALICE_THROW(DemFileIO, path);
+
+        input.seekg(0, std::ios::end);
+        const std::size_t size = input.tellg();
+        input.seekg(0);
+
+        if (size < sizeof(dem_header))
+            ALICE_THROW(DemFileSize, path);
+
+        dem_header head;
+        input.read(reinterpret_cast<char*>(&head), sizeof(dem_header));
+        engine version = verify(head, size);
+
+        // Read enough to decode the packet header, then the rest of the packet
+        const std::size_t remaining = size - head.offset;
+        std::string buffer(std::min<std::size_t>(remaining, 32), '\0');
+
+        input.seekg(head.offset);
+        input.read(&buffer[0], buffer.size());
+
+        dem_packet p;
+        const std::size_t total = dem_packet::from_buffer(p, &buffer[0], buffer.size(), true);
+        const std::size_t header = p.data - &buffer[0];
+
+        if (total > remaining)
+            ALICE_THROW(DemInvalid, path);
+
+        if (total > buffer.size()) {
+            const std::size_t read = buffer.size();
+            buffer.resize(total);
+            input.read(&buffer[read], total - read);
+        }
+
+        if (!input)
+            ALICE_THROW(DemFileIO, path);
+
+        p.data = &buffer[header];
+        return decode(version, p);
+    }
+
+    dem_summary dem_summary::from_buffer(const char* data, std::size_t size) {
+        if (size < sizeof(dem_header))
+            ALICE_THROW(DemFileSize, "Construction from buffer");
+
+        dem_header head;
+        memcpy(&head, data, sizeof(dem_header));
+        engine version = verify(head, size);
+
+        dem_packet p;
+        const std::size_t remaining = size - head.offset;
+        const std::size_t total = dem_packet::from_buffer(p, const_cast<char*>(data + head.offset), remaining, true);
+
+        if (total > remaining)
+            ALICE_THROW(DemInvalid, "Construction from buffer");
+
+        return decode(version, p);
+    }
+}
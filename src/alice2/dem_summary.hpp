@@ -0,0 +1,98 @@
+/**
+ * @file dem_summary.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef _ALICE_DEM_SUMMARY_HPP_
+#define _ALICE_DEM_SUMMARY_HPP_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "dem.hpp"
+#include "dem_file.hpp"
+
+namespace alice {
+    /// Thrown when the replay doesn't contain a summary, e.g. because it's still being recorded
+    ALICE_CREATE_EXCEPTION(DemNoSummary, "Replay has no summary");
+
+    /** A single player as listed in the replay summary */
+    struct dem_player {
+        /** Name of the hero played */
+        std::string hero;
+        /** Player name */
+        std::string name;
+        /** Whether the player is a bot */
+        bool fake;
+        /** 64 bit steam id */
+        uint64_t steamid;
+        /** Team the player was on */
+        int32_t team;
+    };
+
+    /**
+     * Summary of a replay, stored at the end of the file.
+     *
+     * The header of each replay points to the summary so it can be read without parsing anything else.
+     */
+    struct dem_summary {
+        /** Engine the replay was created from */
+        engine source_version;
+
+        /** Length of the replay in seconds */
+        float playback_time;
+        /** Number of ticks */
+        int32_t playback_ticks;
+        /** Number of frames */
+        int32_t playback_frames;
+
+        /** Match id */
+        uint32_t match_id;
+        /** Game mode */
+        int32_t game_mode;
+        /** Winning team */
+        int32_t game_winner;
+        /** League id, 0 for non-league matches */
+        uint32_t league_id;
+        /** Team id of radiant */
+        uint32_t radiant_team_id;
+        /** Team id of dire */
+        uint32_t dire_team_id;
+        /** Team tag of radiant */
+        std::string radiant_team_tag;
+        /** Team tag of dire */
+        std::string dire_team_tag;
+        /** Unix timestamp of the end of the match */
+        uint32_t end_time;
+
+        /** List of players */
+        std::vector<dem_player> players;
+
+        /** Reads the summary from the replay at path, only the header and the summary itself are read */
+        static dem_summary from_file(const char* path);
+
+        /** Reads the summary from a replay in memory */
+        static dem_summary from_buffer(const char* data, std::size_t size);
+    };
+}
+
+#endif /* _ALICE_DEM_SUMMARY_HPP_ */
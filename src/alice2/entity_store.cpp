@@ -0,0 +1,616 @@
+/**
+ * @file entity_store.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "proto/source2/netmessages.pb.h"
+
+#include "dem_file.hpp"
+#include "entity_store.hpp"
+
+namespace alice {
+    namespace {
+        /** Returns the number of bytes per value of a column type, 0 for strings */
+        uint32_t width(const column_type t) {
+            switch (t) {
+                case column_type::boolean:
+                    return 1;
+                case column_type::int64:
+                case column_type::uint64:
+                    return 8;
+                case column_type::string:
+                    return 0;
+                default:
+                    return 4;
+            }
+        }
+
+        /** Returns the column type a field kind is stored as, string for kinds without value */
+        column_type column_of(const field_kind k) {
+            switch (k) {
+                case field_kind::boolean:
+                case field_kind::pointer:
+                    return column_type::boolean;
+                case field_kind::signed_32:
+                    return column_type::int32;
+                case field_kind::signed_64:
+                    return column_type::int64;
+                case field_kind::unsigned_32:
+                case field_kind::array_length:
+                    return column_type::uint32;
+                case field_kind::unsigned_64:
+                    return column_type::uint64;
+                case field_kind::float_noscale:
+                case field_kind::float_quantized:
+                case field_kind::float_simtime:
+                case field_kind::qangle:
+                    return column_type::float32;
+                default:
+                    return column_type::string;
+            }
+        }
+
+        /** Returns the name of element i of an array */
+        std::string element_name(const std::string& name, const uint32_t i) {
+            char idx[16];
+            snprintf(idx, sizeof(idx), ".%04u", i);
+            return name + idx;
+        }
+
+        /** Reads a raw 32 bit float */
+        float read_float(bitstream& s) {
+            const uint32_t raw = s.read(32);
+            float ret;
+            memcpy(&ret, &raw, sizeof(ret));
+            return ret;
+        }
+    }
+
+    constexpr uint32_t entity_class::npos;
+    constexpr uint32_t entity_store::npos;
+
+    entity_class::entity_class(std::shared_ptr<const flattened_serializer> ser, uint32_t s)
+        : ser(ser), ser_index(s), live(0), baseStale(true)
+    {
+        const flattened_serializer::serializer& root = ser->get(s);
+        add_node(root.count, npos, 0, std::string());
+
+        for (uint32_t i = 0; i < root.count; ++i) {
+            const entry e = build(root.first + i, 0, ser->field_name(root.first + i));
+            entries[i] = e;
+        }
+    }
+
+    uint32_t entity_class::find(const std::string& name) const {
+        const auto it = names.find(name);
+        return it == names.end() ? npos : it->second;
+    }
+
+    uint32_t entity_class::find(const field_path& path) const {
+        uint32_t n = 0;
+
+        for (uint32_t i = 0;; ++i) {
+            const uint32_t idx = path[i];
+            if (idx >= nodes[n].count)
+                return npos;
+
+            const entry& e = entries[nodes[n].first + idx];
+            if (i == path.last)
+                return e.column;
+
+            if (e.node == npos)
+                return npos;
+
+            n = e.node;
+        }
+    }
+
+    uint32_t entity_class::acquire(uint32_t index) {
+        if (unused.empty())
+            reserve(owners.empty() ? ALICE_ENTITY_CLASS_SLOTS : owners.size() * 2);
+
+        const uint32_t slot = unused.back();
+        unused.pop_back();
+
+        owners[slot] = index;
+        ++live;
+
+        // Copy the baseline, columns added after it was decoded start zeroed
+        const uint32_t base = baseValues.size();
+        for (uint32_t c = 0; c < cols.size(); ++c) {
+            const uint32_t w = width(cols[c].type);
+
+            if (!w) {
+                if (c < base) {
+                    store[c].strings[slot] = baseStrings[c];
+                } else {
+                    store[c].strings[slot].clear();
+                }
+            } else if (c < base) {
+                memcpy(reinterpret_cast<char*>(store[c].words.data()) + slot * w, &baseValues[c], w);
+            } else {
+                memset(reinterpret_cast<char*>(store[c].words.data()) + slot * w, 0, w);
+            }
+        }
+
+        return slot;
+    }
+
+    void entity_class::baseline(const char* data, std::size_t size, std::vector<field_path>& paths, char* text) {
+        // Decode into a zeroed slot nobody owns
+        baseValues.clear();
+        baseStrings.clear();
+
+        const uint32_t slot = acquire(npos);
+        if (size) {
+            bitstream s(data, size);
+            field_path_decoder::get().read(s, paths);
+            read(s, slot, paths, text);
+        }
+
+        // The baseline may have grown arrays, so the row is sized afterwards
+        baseValues.resize(cols.size(), 0);
+        baseStrings.resize(cols.size());
+
+        for (uint32_t c = 0; c < cols.size(); ++c) {
+            const uint32_t w = width(cols[c].type);
+
+            if (w) {
+                memcpy(&baseValues[c], reinterpret_cast<const char*>(store[c].words.data()) + slot * w, w);
+            } else {
+                baseStrings[c].swap(store[c].strings[slot]);
+            }
+        }
+
+        release(slot);
+        baseStale = false;
+    }
+
+    void entity_class::release(uint32_t slot) {
+        owners[slot] = npos;
+        unused.push_back(slot);
+        --live;
+    }
+
+    void entity_class::read(bitstream& s, uint32_t slot, const std::vector<field_path>& paths, char* text) {
+        for (const field_path& p : paths) {
+            const entry e = resolve(p);
+            const serializer_field& f = ser->field(e.field);
+
+            switch (f.kind) {
+                case field_kind::boolean:
+                case field_kind::pointer:
+                    values<uint8_t>(e.column)[slot] = s.read(1);
+                    break;
+                case field_kind::signed_32:
+                    values<int32_t>(e.column)[slot] = s.readVarSInt32();
+                    break;
+                case field_kind::signed_64:
+                    values<int64_t>(e.column)[slot] = s.readVarSInt64();
+                    break;
+                case field_kind::unsigned_32:
+                case field_kind::array_length:
+                    values<uint32_t>(e.column)[slot] = s.readVarUInt32();
+                    break;
+                case field_kind::unsigned_64:
+                    values<uint64_t>(e.column)[slot] = s.readVarUInt64();
+                    break;
+                case field_kind::float_noscale:
+                    for (uint32_t c = 0; c < f.components; ++c)
+                        values<float>(e.column + c)[slot] = read_float(s);
+                    break;
+                case field_kind::float_quantized: {
+                    const quantized_float& q = ser->quantization(f);
+                    for (uint32_t c = 0; c < f.components; ++c)
+                        values<float>(e.column + c)[slot] = q.decode(s);
+                } break;
+                case field_kind::float_simtime:
+                    values<float>(e.column)[slot] = s.readVarUInt32() * (1.0f / 30.0f);
+                    break;
+                case field_kind::qangle:
+                    if (f.bits == 32) {
+                        for (uint32_t c = 0; c < 3; ++c)
+                            values<float>(e.column + c)[slot] = read_float(s);
+                    } else if (f.bits) {
+                        for (uint32_t c = 0; c < 3; ++c)
+                            values<float>(e.column + c)[slot] = s.readAngle(f.bits);
+                    } else {
+                        // Each coordinate is optional
+                        const uint32_t present = s.read(3);
+                        for (uint32_t c = 0; c < 3; ++c)
+                            values<float>(e.column + c)[slot] = (present >> c) & 1 ? s.readCoord() : 0.0f;
+                    }
+                    break;
+                case field_kind::string:
+                    s.readString(text, ALICE_ENTITY_STRING_SIZE);
+                    values<std::string>(e.column)[slot] = text;
+                    break;
+                default:
+                    // Embedded serializers are sent like pointers
+                    if (f.model != field_model::table)
+                        invalid(p);
+
+                    s.read(1);
+            }
+        }
+    }
+
+    entity_class::entry entity_class::build(uint32_t field, uint32_t level, const std::string& name) {
+        const serializer_field& f = ser->field(field);
+        entry ret{field, npos, npos};
+
+        if (f.kind != field_kind::none) {
+            const column_type t = column_of(f.kind);
+            ret.column = add_column(field, t, 0, name);
+
+            for (uint8_t c = 1; c < f.components; ++c)
+                add_column(field, t, c, std::string());
+        }
+
+        // Paths can't reach any deeper
+        if (level + 1 >= field_path::max_depth)
+            return ret;
+
+        switch (f.model) {
+            case field_model::fixed_array:
+                ret.node = add_node(f.size, npos, level + 1, name);
+
+                for (uint32_t i = 0; i < f.size; ++i) {
+                    const entry e = build(f.child, level + 1, element_name(name, i));
+                    entries[nodes[ret.node].first + i] = e;
+                }
+                break;
+            case field_model::dynamic_array:
+                ret.node = add_node(0, f.child, level + 1, name);
+                break;
+            case field_model::table: {
+                const flattened_serializer::serializer& child = ser->get(f.child);
+                ret.node = add_node(child.count, npos, level + 1, name);
+
+                for (uint32_t i = 0; i < child.count; ++i) {
+                    const entry e = build(child.first + i, level + 1, name + "." + ser->field_name(child.first + i));
+                    entries[nodes[ret.node].first + i] = e;
+                }
+            } break;
+            default:
+                break;
+        }
+
+        return ret;
+    }
+
+    uint32_t entity_class::add_node(uint32_t count, uint32_t element, uint32_t level, const std::string& name) {
+        nodes.push_back(node{static_cast<uint32_t>(entries.size()), count, element, level});
+        prefixes.push_back(name);
+        entries.resize(entries.size() + count, entry{npos, npos, npos});
+
+        return nodes.size() - 1;
+    }
+
+    uint32_t entity_class::add_column(uint32_t field, column_type type, uint8_t component, const std::string& name) {
+        const uint32_t ret = cols.size();
+        cols.push_back(column{field, type, component});
+        store.emplace_back();
+
+        const uint32_t w = width(type);
+        if (w) {
+            store.back().words.resize((owners.size() * w + 7) / 8);
+        } else {
+            store.back().strings.resize(owners.size());
+        }
+
+        if (!name.empty())
+            names.emplace(name, ret);
+
+        return ret;
+    }
+
+    void entity_class::grow(uint32_t n, const field_path& p, uint32_t i) {
+        const uint32_t count = static_cast<uint32_t>(p[i]) + 1;
+        if (nodes[n].element == npos || count > ALICE_ENTITY_ARRAY_MAX)
+            invalid(p);
+
+        // Move the entries behind all others unless they already are
+        const uint32_t old = nodes[n].count;
+        if (nodes[n].first + old != entries.size()) {
+            const uint32_t first = entries.size();
+            entries.insert(entries.end(), entries.begin() + nodes[n].first, entries.begin() + nodes[n].first + old);
+            nodes[n].first = first;
+        }
+
+        entries.resize(entries.size() + count - old, entry{npos, npos, npos});
+        nodes[n].count = count;
+
+        // Elements may add nodes and entries of their own
+        for (uint32_t j = old; j < count; ++j) {
+            const entry e = build(nodes[n].element, nodes[n].level, element_name(prefixes[n], j));
+            entries[nodes[n].first + j] = e;
+        }
+    }
+
+    void entity_class::reserve(uint32_t capacity) {
+        for (uint32_t c = 0; c < cols.size(); ++c) {
+            const uint32_t w = width(cols[c].type);
+
+            if (w) {
+                store[c].words.resize((capacity * w + 7) / 8);
+            } else {
+                store[c].strings.resize(capacity);
+            }
+        }
+
+        // Hand out the lowest slots first
+        for (uint32_t slot = capacity; slot > owners.size(); --slot)
+            unused.push_back(slot - 1);
+
+        owners.resize(capacity, npos);
+    }
+
+    void entity_class::invalid(const field_path& p) const {
+        std::string path;
+        for (uint32_t i = 0; i <= p.last; ++i)
+            path += (i ? "/" : "") + std::to_string(p[i]);
+
+        ALICE_THROW(EntityFieldPath, ser->name(ser->get(ser_index)) << " (serializer) " << path << " (path)");
+    }
+
+    void entity_class::type_mismatch(uint32_t c) const {
+        ALICE_THROW(EntityColumnType, ser->field_name(cols[c].field) << " (column) "
+            << static_cast<uint32_t>(cols[c].type) << " (type)");
+    }
+
+    entity_store::entity_store(const dem_file& f)
+        : file(&f), ser(nullptr), classes(nullptr), entities(ALICE_ENTITY_MAX, entity{npos, npos, 0}),
+          text(new char[ALICE_ENTITY_STRING_SIZE]), classBits(0), live(0), current(0), tables(0),
+          baselineTable(npos), seeded(false)
+    { }
+
+    entity_store::entity_store(std::shared_ptr<const flattened_serializer> ser,
+        std::shared_ptr<const std::vector<std::string>> classes)
+        : file(nullptr), ser(std::move(ser)), classes(std::move(classes)),
+          entities(ALICE_ENTITY_MAX, entity{npos, npos, 0}),
+          text(new char[ALICE_ENTITY_STRING_SIZE]), classBits(0), live(0), current(0), tables(0),
+          baselineTable(npos), seeded(false)
+    { }
+
+    void entity_store::on(const ps2::CSVCMsg_ServerInfo& msg, uint32_t) {
+        classBits = 0;
+        for (uint32_t n = msg.max_classes(); n; n >>= 1)
+            ++classBits;
+    }
+
+    void entity_store::on(const wire_packet_entities& msg, uint32_t tick) {
+        seed();
+
+        if (!ser && !bind())
+            return;
+
+        current = tick;
+        bitstream s(msg.entity_data.data, msg.entity_data.size);
+
+        uint32_t index = npos;
+        for (int32_t i = 0; i < msg.updated_entries; ++i) {
+            index += s.readUBitVar() + 1;
+            if (index >= ALICE_ENTITY_MAX)
+                ALICE_THROW(EntityIndex, index << " (index)");
+
+            const uint32_t cmd = s.read(2);
+
+            // Entities leaving the PVS keep their state
+            if (cmd & 1) {
+                if (cmd & 2)
+                    remove(index);
+
+                continue;
+            }
+
+            if (cmd & 2) {
+                create(s, index);
+                continue;
+            }
+
+            const entity& e = entities[index];
+            if (e.cls == npos)
+                ALICE_THROW(EntityMissing, index << " (index)");
+
+            field_path_decoder::get().read(s, paths);
+            types[e.cls]->read(s, e.slot, paths, text.get());
+        }
+    }
+
+    void entity_store::on(const wire_create_string_table& msg, uint32_t) {
+        if (!source_two())
+            return;
+
+        seed();
+        const uint32_t id = tables++;
+        if (msg.name.str() != "instancebaseline")
+            return;
+
+        baselines.reset(new string_table(msg));
+        baselineTable = id;
+        baselineEntries.clear();
+
+        for (auto& t : types) {
+            if (t)
+                t->baseStale = true;
+        }
+
+        for (uint32_t i = 0; i < baselines->size(); ++i)
+            changed.push_back(i);
+
+        update_baselines();
+    }
+
+    void entity_store::on(const wire_update_string_table& msg, uint32_t) {
+        seed();
+
+        if (!baselines || msg.table_id < 0 || static_cast<uint32_t>(msg.table_id) != baselineTable)
+            return;
+
+        baselines->update(msg, changed);
+        update_baselines();
+    }
+
+    const entity_store::entity& entity_store::get(uint32_t index) const {
+        if (index >= entities.size())
+            ALICE_THROW(EntityIndex, index << " (index)");
+
+        return entities[index];
+    }
+
+    const entity_class* entity_store::find(const std::string& name) const {
+        if (!classes)
+            return nullptr;
+
+        const auto it = std::find(classes->begin(), classes->end(), name);
+        return it == classes->end() ? nullptr : find(it - classes->begin());
+    }
+
+    bool entity_store::source_two() const {
+        return !file || file->version() == engine::two;
+    }
+
+    void entity_store::update_baselines() {
+        for (const uint32_t i : changed) {
+            // Keys are class ids
+            const std::string& key = baselines->get(i).key;
+            char* end;
+            const unsigned long id = strtoul(key.c_str(), &end, 10);
+
+            if (key.empty() || *end || id >= ALICE_ENTITY_CLASS_MAX)
+                continue;
+
+            if (baselineEntries.size() <= id)
+                baselineEntries.resize(id + 1, npos);
+
+            baselineEntries[id] = i;
+
+            if (id < types.size() && types[id])
+                types[id]->baseStale = true;
+        }
+
+        changed.clear();
+    }
+
+    void entity_store::seed() {
+        if (seeded || !file || !file->string_tables())
+            return;
+
+        // The tables of a segment are only there once its full packet has been read
+        seeded = true;
+
+        const std::vector<string_table>& t = *file->string_tables();
+        tables = t.size();
+
+        for (uint32_t i = 0; i < t.size(); ++i) {
+            if (t[i].name() != "instancebaseline")
+                continue;
+
+            baselines.reset(new string_table(t[i]));
+            baselineTable = i;
+            baselineEntries.clear();
+
+            for (auto& c : types) {
+                if (c)
+                    c->baseStale = true;
+            }
+
+            for (uint32_t j = 0; j < baselines->size(); ++j)
+                changed.push_back(j);
+
+            update_baselines();
+        }
+    }
+
+    bool entity_store::bind() {
+        if (!file || !file->serializers() || !file->classes())
+            return false;
+
+        ser = file->serializers();
+        classes = file->classes();
+        return true;
+    }
+
+    entity_class& entity_store::type(uint32_t id) {
+        if (id < types.size() && types[id])
+            return *types[id];
+
+        if (id >= classes->size() || (*classes)[id].empty())
+            ALICE_THROW(EntityUnknownClass, id << " (class id)");
+
+        const uint32_t s = ser->find((*classes)[id]);
+        if (s == flattened_serializer::npos)
+            ALICE_THROW(EntityUnknownClass, (*classes)[id] << " (class)");
+
+        if (types.size() <= id)
+            types.resize(id + 1);
+
+        types[id].reset(new entity_class(ser, s));
+        return *types[id];
+    }
+
+    void entity_store::create(bitstream& s, uint32_t index) {
+        // Without server info the ids are as wide as the highest one
+        if (!classBits) {
+            for (std::size_t n = classes->size(); n; n >>= 1)
+                ++classBits;
+        }
+
+        const uint32_t id = s.read(classBits);
+        const uint32_t serial = s.read(17);
+        s.readVarUInt32();
+
+        entity_class& c = type(id);
+        remove(index);
+
+        if (c.baseStale) {
+            if (id < baselineEntries.size() && baselineEntries[id] != npos) {
+                const std::string& data = baselines->get(baselineEntries[id]).value;
+                c.baseline(data.data(), data.size(), paths, text.get());
+            } else {
+                c.baseline(nullptr, 0, paths, text.get());
+            }
+        }
+
+        entities[index] = entity{id, c.acquire(index), serial};
+        ++live;
+
+        field_path_decoder::get().read(s, paths);
+        c.read(s, entities[index].slot, paths, text.get());
+    }
+
+    void entity_store::remove(uint32_t index) {
+        entity& e = entities[index];
+        if (e.cls == npos)
+            return;
+
+        types[e.cls]->release(e.slot);
+        e.cls = npos;
+        --live;
+    }
+}
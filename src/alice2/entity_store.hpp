@@ -0,0 +1,465 @@
+/**
+ * @file entity_store.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_ENTITY_STORE_HPP_
+#define _ALICE_ENTITY_STORE_HPP_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "util/bitstream.hpp"
+#include "util/exception.hpp"
+#include "config.hpp"
+#include "field_path.hpp"
+#include "serializer.hpp"
+#include "string_table.hpp"
+#include "wire.hpp"
+
+namespace alice {
+    namespace ps2 {
+        class CSVCMsg_ServerInfo;
+    }
+
+    class dem_file;
+
+    /// Thrown when an entity is created with a class that has no name or serializer
+    ALICE_CREATE_EXCEPTION(EntityUnknownClass, "Entity of unknown class");
+    /// Thrown when an entity index exceeds ALICE_ENTITY_MAX
+    ALICE_CREATE_EXCEPTION(EntityIndex, "Entity index out of range");
+    /// Thrown when updating an entity which doesn't exist
+    ALICE_CREATE_EXCEPTION(EntityMissing, "Entity doesn't exist");
+    /// Thrown when a field path doesn't lead to a property of the entity's class
+    ALICE_CREATE_EXCEPTION(EntityFieldPath, "Field path doesn't lead to a property");
+    /// Thrown when a column is accessed as a different type than it stores
+    ALICE_CREATE_EXCEPTION(EntityColumnType, "Column accessed with the wrong type");
+
+    /** Type of the values in a column */
+    enum class column_type : uint8_t {
+        /** uint8_t, booleans and whether a nested serializer is present */
+        boolean = 0,
+        /** int32_t */
+        int32,
+        /** int64_t */
+        int64,
+        /** uint32_t, also the length of dynamic arrays */
+        uint32,
+        /** uint64_t */
+        uint64,
+        /** float, vectors and angles take one column per component */
+        float32,
+        /** std::string */
+        string
+    };
+
+    /** Maps a C++ type to the column type it's stored as */
+    template <typename T>
+    struct column_traits;
+
+    /// Defines the column type of a C++ type
+    #define ALICE_COLUMN_TYPE(__type, __column)                         \
+    template <>                                                         \
+    struct column_traits<__type> {                                      \
+        static constexpr column_type type = column_type::__column;      \
+    };
+
+    ALICE_COLUMN_TYPE(uint8_t, boolean)
+    ALICE_COLUMN_TYPE(int32_t, int32)
+    ALICE_COLUMN_TYPE(int64_t, int64)
+    ALICE_COLUMN_TYPE(uint32_t, uint32)
+    ALICE_COLUMN_TYPE(uint64_t, uint64)
+    ALICE_COLUMN_TYPE(float, float32)
+    ALICE_COLUMN_TYPE(std::string, string)
+    #undef ALICE_COLUMN_TYPE
+
+    /**
+     * Properties of all entities of a single class
+     *
+     * Each property is a column, an array with one value per slot. An entity occupies the same slot in all
+     * columns of its class for its whole life, so reading a property of all entities is a linear scan of a
+     * single array.
+     *
+     * Field paths are resolved through a tree built from the serializer when the class is created. Each level
+     * of a path indexes the entries of a node, the entry at the last level holds the column. Dynamic arrays
+     * start out empty and get columns for further elements the first time a path reaches them.
+     *
+     * New entities start as a copy of the class's instance baseline. It's decoded into a row of its own the
+     * first time an entity is created after the baseline was sent or changed.
+     */
+    class entity_class {
+        public:
+            /** Returned for slots without entity and properties without column */
+            static constexpr uint32_t npos = 0xFFFFFFFF;
+
+            /** Property stored in a column */
+            struct column {
+                /** Serializer field of the property */
+                uint32_t field;
+                /** Type of the values */
+                column_type type;
+                /** Index of the component for vectors and angles, 0 otherwise */
+                uint8_t component;
+            };
+
+            /** Creates the columns for serializer s */
+            entity_class(std::shared_ptr<const flattened_serializer> ser, uint32_t s);
+
+            /** Returns the index of the serializer */
+            uint32_t serializer() const {
+                return ser_index;
+            }
+
+            /** Returns the number of entities */
+            uint32_t size() const {
+                return live;
+            }
+
+            /** Returns the number of slots, each column has this many values */
+            uint32_t capacity() const {
+                return owners.size();
+            }
+
+            /** Returns the index of the entity in slot, npos if the slot is unused */
+            uint32_t entity(const uint32_t slot) const {
+                return owners[slot];
+            }
+
+            /** Returns the number of columns */
+            uint32_t columns() const {
+                return cols.size();
+            }
+
+            /** Returns column c */
+            const column& get(const uint32_t c) const {
+                return cols[c];
+            }
+
+            /**
+             * Returns the column of the property called name, npos if there is none.
+             *
+             * Nested properties are separated by dots, array elements are named by their index with 4 digits,
+             * e.g. m_hAbilities.0003. Vectors and angles return their first component.
+             */
+            uint32_t find(const std::string& name) const;
+
+            /** Returns the column path leads to, npos if it doesn't lead to a property that has one */
+            uint32_t find(const field_path& path) const;
+
+            /**
+             * Returns the values of column c, one per slot.
+             *
+             * Returns nullptr if c is npos, throws EntityColumnType if the column doesn't store T. The pointer is
+             * valid until the next update.
+             */
+            template <typename T>
+            const T* data(const uint32_t c) const {
+                if (c >= cols.size())
+                    return nullptr;
+
+                if (cols[c].type != column_traits<T>::type)
+                    type_mismatch(c);
+
+                return values<T>(c);
+            }
+        private:
+            friend class entity_store;
+
+            /** Position of a level of a field path */
+            struct entry {
+                /** Serializer field */
+                uint32_t field;
+                /** First column of its value, npos if it has none */
+                uint32_t column;
+                /** Node of the next level, npos if it can't have one */
+                uint32_t node;
+            };
+
+            /** Entries of one level below a field */
+            struct node {
+                /** Index of the first entry */
+                uint32_t first;
+                /** Number of entries */
+                uint32_t count;
+                /** Element field of dynamic arrays, npos for all others */
+                uint32_t element;
+                /** Level of its entries within a field path */
+                uint32_t level;
+            };
+
+            /** Values of a column */
+            struct storage {
+                /** Fixed size values, 8 byte aligned */
+                std::vector<uint64_t> words;
+                /** Strings */
+                std::vector<std::string> strings;
+            };
+
+            /** Serializers, kept alive in case the file compiles new ones */
+            std::shared_ptr<const flattened_serializer> ser;
+            /** Index of the serializer */
+            uint32_t ser_index;
+            /** Column descriptions */
+            std::vector<column> cols;
+            /** Column values */
+            std::vector<storage> store;
+            /** Column by property name */
+            std::unordered_map<std::string, uint32_t> names;
+            /** Nodes of the field path tree, the first one contains the serializer's fields */
+            std::vector<node> nodes;
+            /** Name of the property each node belongs to, used to name array elements */
+            std::vector<std::string> prefixes;
+            /** Entries of all nodes */
+            std::vector<entry> entries;
+            /** Entity index of each slot */
+            std::vector<uint32_t> owners;
+            /** Unused slots, lowest last */
+            std::vector<uint32_t> unused;
+            /** Number of entities */
+            uint32_t live;
+            /** Values new entities start with, one word per column, columns added later start zeroed */
+            std::vector<uint64_t> baseValues;
+            /** Strings new entities start with, by column */
+            std::vector<std::string> baseStrings;
+            /** Whether the baseline has to be decoded before the next entity is created */
+            bool baseStale;
+
+            /** Returns the values of column c */
+            template <typename T>
+            const T* values(const uint32_t c) const {
+                return column_values<T>::get(store[c]);
+            }
+
+            /** Returns the values of column c for writing */
+            template <typename T>
+            T* values(const uint32_t c) {
+                return const_cast<T*>(static_cast<const entity_class*>(this)->values<T>(c));
+            }
+
+            /** Picks the storage of a type */
+            template <typename T, typename = void>
+            struct column_values {
+                static const T* get(const storage& s) {
+                    return reinterpret_cast<const T*>(s.words.data());
+                }
+            };
+
+            template <typename Void>
+            struct column_values<std::string, Void> {
+                static const std::string* get(const storage& s) {
+                    return s.strings.data();
+                }
+            };
+
+            /** Returns the entry p leads to, grows dynamic arrays if necessary */
+            entry resolve(const field_path& p) {
+                uint32_t n = 0;
+
+                for (uint32_t i = 0;; ++i) {
+                    const uint32_t idx = p[i];
+                    if (idx >= nodes[n].count)
+                        grow(n, p, i);
+
+                    const entry& e = entries[nodes[n].first + idx];
+                    if (i == p.last)
+                        return e;
+
+                    if (e.node == npos)
+                        invalid(p);
+
+                    n = e.node;
+                }
+            }
+
+            /** Takes a slot for the entity with the given index and copies the baseline into it */
+            uint32_t acquire(uint32_t index);
+
+            /** Decodes the baseline from the size bytes at data, no data resets it to all zeroes */
+            void baseline(const char* data, std::size_t size, std::vector<field_path>& paths, char* text);
+
+            /** Frees slot */
+            void release(uint32_t slot);
+
+            /** Reads the values of paths into slot, strings are read into text */
+            void read(bitstream& s, uint32_t slot, const std::vector<field_path>& paths, char* text);
+
+            /** Creates the entry of field with its columns and nodes below it */
+            entry build(uint32_t field, uint32_t level, const std::string& name);
+
+            /** Adds a node with count entries at the given level */
+            uint32_t add_node(uint32_t count, uint32_t element, uint32_t level, const std::string& name);
+
+            /** Adds a column */
+            uint32_t add_column(uint32_t field, column_type type, uint8_t component, const std::string& name);
+
+            /** Makes room for the index at level i of p in node n, throws if n isn't a dynamic array */
+            void grow(uint32_t n, const field_path& p, uint32_t i);
+
+            /** Resizes all columns to capacity slots */
+            void reserve(uint32_t capacity);
+
+            /** Throws when p doesn't lead to a property */
+            [[noreturn]] void invalid(const field_path& p) const;
+
+            /** Throws when column c is accessed with the wrong type */
+            [[noreturn]] void type_mismatch(uint32_t c) const;
+    };
+
+    /**
+     * Current state of all entities of a Source 2 replay
+     *
+     * Applies CSVCMsg_PacketEntities to a column per property and class, see entity_class. Pass it to
+     * dem_file::get(h) to keep it up to date:
+     *
+     *     entity_store entities(file);
+     *     while (file.good()) {
+     *         file.get(entities);
+     *
+     *         const entity_class* c = entities.find("CDOTA_Unit_Hero_Axe");
+     *         if (c) {
+     *             const int32_t* health = c->data<int32_t>(c->find("m_iHealth"));
+     *             ...
+     *         }
+     *     }
+     *
+     * New entities start from the instancebaseline string table entry of their class, properties it
+     * doesn't set are zeroed. Stores of a segment starting at a full packet take the table from there.
+     */
+    class entity_store {
+        public:
+            /** Returned for entities and classes that don't exist */
+            static constexpr uint32_t npos = 0xFFFFFFFF;
+
+            /** Where the properties of an entity are */
+            struct entity {
+                /** Class id, npos if the entity doesn't exist */
+                uint32_t cls;
+                /** Slot within the columns of its class */
+                uint32_t slot;
+                /** Serial number */
+                uint32_t serial;
+            };
+
+            /**
+             * Tracks the entities of f, which has to outlive the store.
+             *
+             * Serializers and class names are taken from f once the first entities are sent. Replays without
+             * them are ignored, which includes all Source 1 replays.
+             */
+            explicit entity_store(const dem_file& f);
+
+            /** Tracks entities with the given serializers and class names */
+            entity_store(std::shared_ptr<const flattened_serializer> ser,
+                std::shared_ptr<const std::vector<std::string>> classes);
+
+            /** Takes the number of bits class ids are sent with from the highest number of classes */
+            void on(const ps2::CSVCMsg_ServerInfo& msg, uint32_t tick);
+
+            /** Creates, updates and deletes the entities in msg */
+            void on(const wire_packet_entities& msg, uint32_t tick);
+
+            /** Counts string tables to know their ids, reads the instance baselines */
+            void on(const wire_create_string_table& msg, uint32_t tick);
+
+            /** Applies changes to the instance baselines */
+            void on(const wire_update_string_table& msg, uint32_t tick);
+
+            /** Returns the tick of the last update */
+            uint32_t tick() const {
+                return current;
+            }
+
+            /** Returns the number of entities */
+            uint32_t size() const {
+                return live;
+            }
+
+            /** Returns where the entity with the given index is, throws EntityIndex if it's out of range */
+            const entity& get(uint32_t index) const;
+
+            /** Returns the class with the given id, nullptr if no entity of it has been created yet */
+            const entity_class* find(uint32_t id) const {
+                return id < types.size() ? types[id].get() : nullptr;
+            }
+
+            /** Returns the class with the given name, nullptr if no entity of it has been created yet */
+            const entity_class* find(const std::string& name) const;
+        private:
+            /** File serializers and class names are taken from, nullptr if they were given */
+            const dem_file* file;
+            /** Serializers, nullptr until bound, shared with the file so replacing them there is safe */
+            std::shared_ptr<const flattened_serializer> ser;
+            /** Class names by id, nullptr until bound, shared like the serializers */
+            std::shared_ptr<const std::vector<std::string>> classes;
+            /** Classes by id, created with their first entity */
+            std::vector<std::unique_ptr<entity_class>> types;
+            /** All entities by index */
+            std::vector<entity> entities;
+            /** Field paths of the entity being read */
+            std::vector<field_path> paths;
+            /** Buffer for string properties */
+            std::unique_ptr<char[]> text;
+            /** Number of bits class ids are sent with, 0 until known */
+            uint32_t classBits;
+            /** Number of entities */
+            uint32_t live;
+            /** Tick of the last update */
+            uint32_t current;
+            /** Number of string tables created, their ids are assigned in order */
+            uint32_t tables;
+            /** Instance baselines, nullptr until the table is created */
+            std::unique_ptr<string_table> baselines;
+            /** Id of the baseline table */
+            uint32_t baselineTable;
+            /** Baseline entry of each class id, npos if there is none */
+            std::vector<uint32_t> baselineEntries;
+            /** Entries changed by the last string table message */
+            std::vector<uint32_t> changed;
+            /** Whether the string tables a segment of the file starts with have been taken over */
+            bool seeded;
+
+            /** Whether string tables are Source 2 ones */
+            bool source_two() const;
+
+            /** Maps changed baseline entries to their classes and marks those for decoding */
+            void update_baselines();
+
+            /** Takes the baselines from the string tables a segment starts with, see dem_file::string_tables */
+            void seed();
+
+            /** Takes serializers and class names from the file, returns whether both are there */
+            bool bind();
+
+            /** Returns the class with the given id, creates it if necessary */
+            entity_class& type(uint32_t id);
+
+            /** Creates the entity at index */
+            void create(bitstream& s, uint32_t index);
+
+            /** Deletes the entity at index if it exists */
+            void remove(uint32_t index);
+    };
+}
+
+#endif /* _ALICE_ENTITY_STORE_HPP_ */
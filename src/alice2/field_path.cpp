@@ -0,0 +1,323 @@
+/**
+ * @file field_path.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "field_path.hpp"
+
+namespace alice {
+    namespace {
+        /** Weight of each op, the huffman tree is built from these */
+        constexpr uint32_t opWeights[field_path_decoder::op_count] = {
+            36271, 10334, 1375, 646, 4128, 35, 3, 521, 2942, 560, 471, 10530, 251, 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0, 0, 0, 310, 2, 0, 1837, 149, 300, 634, 0, 0, 1, 76, 271, 99, 25474
+        };
+
+        /** Tree node during construction */
+        struct weighted_node {
+            /** Sum of the weights below */
+            uint32_t weight;
+            /** Op for leafs, index of the inner node otherwise */
+            uint32_t node;
+        };
+
+        /** Orders the nodes so the lowest weight comes first, equal weights are ordered by the highest node */
+        struct weighted_node_order {
+            bool operator()(const weighted_node& a, const weighted_node& b) const {
+                if (a.weight == b.weight)
+                    return a.node < b.node;
+
+                return a.weight > b.weight;
+            }
+        };
+
+        /** Applies the non topological changes, the levels with a set bit are moved by a signed delta */
+        template <typename Policy>
+        void non_topo(basic_bitstream<Policy>& s, field_path& path, const int32_t offset) {
+            for (uint32_t i = 0; i <= path.last; ++i) {
+                if (s.read(1))
+                    path.data[i] += s.readVarSInt32() + offset;
+            }
+        }
+    }
+
+    constexpr uint32_t field_path::max_depth;
+    constexpr uint32_t field_path_decoder::op_count;
+    constexpr uint32_t field_path_decoder::lookup_bits;
+
+    field_path_decoder::field_path_decoder() : tree{}, root{0}, codes{}, table{} {
+        std::priority_queue<weighted_node, std::vector<weighted_node>, weighted_node_order> nodes;
+
+        // Unused ops still get a code
+        for (uint32_t i = 0; i < op_count; ++i)
+            nodes.push(weighted_node{opWeights[i] ? opWeights[i] : 1, i});
+
+        // Merge the two lightest nodes, the first one becomes the left child
+        uint32_t next = op_count;
+        while (nodes.size() > 1) {
+            const weighted_node left = nodes.top();
+            nodes.pop();
+            const weighted_node right = nodes.top();
+            nodes.pop();
+
+            tree[next - op_count] = {{static_cast<uint16_t>(left.node), static_cast<uint16_t>(right.node)}};
+            nodes.push(weighted_node{left.weight + right.weight, next++});
+        }
+
+        root = nodes.top().node;
+        assign(root, 0, 0);
+    }
+
+    const field_path_decoder& field_path_decoder::get() {
+        static const field_path_decoder decoder;
+        return decoder;
+    }
+
+    void field_path_decoder::assign(const uint32_t node, const uint32_t bits, const uint32_t length) {
+        if (node < op_count) {
+            codes[node] = code{bits, length};
+
+            // Every lookup starting with the code resolves to the op
+            if (length <= lookup_bits) {
+                for (uint32_t i = 0; i < (1u << (lookup_bits - length)); ++i)
+                    table[bits | (i << length)] = entry{static_cast<uint16_t>(node), static_cast<uint16_t>(length)};
+            }
+
+            return;
+        }
+
+        // Longer codes continue from here
+        if (length == lookup_bits)
+            table[bits] = entry{static_cast<uint16_t>(node), static_cast<uint16_t>(length)};
+
+        assign(tree[node - op_count][0], bits, length + 1);
+        assign(tree[node - op_count][1], bits | (1u << length), length + 1);
+    }
+
+    template <typename Policy>
+    void field_path_decoder::read(basic_bitstream<Policy>& s, std::vector<field_path>& paths) const {
+        paths.clear();
+
+        field_path path;
+        for (;;) {
+            const field_op op = next(s);
+            if (op == field_op::finish)
+                return;
+
+            apply(op, s, path);
+
+            // Only unchecked streams get here, they return 0 past the end
+            if (s.position() > s.end())
+                ALICE_THROW(FieldPathTruncated, s.position() << " (position) " << s.end() << " (size)");
+
+            paths.push_back(path);
+        }
+    }
+
+    template <typename Policy>
+    void field_path_decoder::apply(const field_op op, basic_bitstream<Policy>& s, field_path& path) {
+        switch (op) {
+            case field_op::plus_one:
+                path.data[path.last] += 1;
+                break;
+            case field_op::plus_two:
+                path.data[path.last] += 2;
+                break;
+            case field_op::plus_three:
+                path.data[path.last] += 3;
+                break;
+            case field_op::plus_four:
+                path.data[path.last] += 4;
+                break;
+            case field_op::plus_n:
+                path.data[path.last] += s.readUBitVarFP() + 5;
+                break;
+            case field_op::push_one_left_delta_zero_right_zero:
+                path.push(0);
+                break;
+            case field_op::push_one_left_delta_zero_right_non_zero:
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_one_left_delta_one_right_zero:
+                path.data[path.last] += 1;
+                path.push(0);
+                break;
+            case field_op::push_one_left_delta_one_right_non_zero:
+                path.data[path.last] += 1;
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_one_left_delta_n_right_zero:
+                path.data[path.last] += s.readUBitVarFP();
+                path.push(0);
+                break;
+            case field_op::push_one_left_delta_n_right_non_zero:
+                path.data[path.last] += s.readUBitVarFP() + 2;
+                path.push(s.readUBitVarFP() + 1);
+                break;
+            case field_op::push_one_left_delta_n_right_non_zero_pack6_bits:
+                path.data[path.last] += s.read(3) + 2;
+                path.push(s.read(3) + 1);
+                break;
+            case field_op::push_one_left_delta_n_right_non_zero_pack8_bits:
+                path.data[path.last] += s.read(4) + 2;
+                path.push(s.read(4) + 1);
+                break;
+            case field_op::push_two_left_delta_zero:
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_two_pack5_left_delta_zero:
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_three_left_delta_zero:
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_three_pack5_left_delta_zero:
+                path.push(s.read(5));
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_two_left_delta_one:
+                path.data[path.last] += 1;
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_two_pack5_left_delta_one:
+                path.data[path.last] += 1;
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_three_left_delta_one:
+                path.data[path.last] += 1;
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_three_pack5_left_delta_one:
+                path.data[path.last] += 1;
+                path.push(s.read(5));
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_two_left_delta_n:
+                path.data[path.last] += s.readUBitVar() + 2;
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_two_pack5_left_delta_n:
+                path.data[path.last] += s.readUBitVar() + 2;
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_three_left_delta_n:
+                path.data[path.last] += s.readUBitVar() + 2;
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                path.push(s.readUBitVarFP());
+                break;
+            case field_op::push_three_pack5_left_delta_n:
+                path.data[path.last] += s.readUBitVar() + 2;
+                path.push(s.read(5));
+                path.push(s.read(5));
+                path.push(s.read(5));
+                break;
+            case field_op::push_n: {
+                const uint32_t n = s.readUBitVar();
+                path.data[path.last] += s.readUBitVar();
+
+                for (uint32_t i = 0; i < n; ++i)
+                    path.push(s.readUBitVarFP());
+            } break;
+            case field_op::push_n_and_non_topological: {
+                non_topo(s, path, 1);
+
+                const uint32_t n = s.readUBitVar();
+                for (uint32_t i = 0; i < n; ++i)
+                    path.push(s.readUBitVarFP());
+            } break;
+            case field_op::pop_one_plus_one:
+                path.pop(1);
+                path.data[path.last] += 1;
+                break;
+            case field_op::pop_one_plus_n:
+                path.pop(1);
+                path.data[path.last] += s.readUBitVarFP() + 1;
+                break;
+            case field_op::pop_all_but_one_plus_one:
+                path.pop(path.last);
+                path.data[path.last] += 1;
+                break;
+            case field_op::pop_all_but_one_plus_n:
+                path.pop(path.last);
+                path.data[path.last] += s.readUBitVarFP() + 1;
+                break;
+            case field_op::pop_all_but_one_plus_n_pack3_bits:
+                path.pop(path.last);
+                path.data[path.last] += s.read(3) + 1;
+                break;
+            case field_op::pop_all_but_one_plus_n_pack6_bits:
+                path.pop(path.last);
+                path.data[path.last] += s.read(6) + 1;
+                break;
+            case field_op::pop_n_plus_one:
+                path.pop(s.readUBitVarFP());
+                path.data[path.last] += 1;
+                break;
+            case field_op::pop_n_plus_n:
+                path.pop(s.readUBitVarFP());
+                path.data[path.last] += s.readVarSInt32();
+                break;
+            case field_op::pop_n_and_non_topographical:
+                path.pop(s.readUBitVarFP());
+                non_topo(s, path, 0);
+                break;
+            case field_op::non_topo_complex:
+                non_topo(s, path, 0);
+                break;
+            case field_op::non_topo_penultimate_plus_one:
+                if (path.last == 0)
+                    ALICE_THROW(FieldPathDepth, "1 (levels)");
+
+                path.data[path.last - 1] += 1;
+                break;
+            case field_op::non_topo_complex_pack4_bits:
+                for (uint32_t i = 0; i <= path.last; ++i) {
+                    if (s.read(1))
+                        path.data[i] += static_cast<int32_t>(s.read(4)) - 7;
+                }
+                break;
+            case field_op::finish:
+                break;
+        }
+    }
+
+    template void field_path_decoder::read(bitstream&, std::vector<field_path>&) const;
+    template void field_path_decoder::read(unchecked_bitstream&, std::vector<field_path>&) const;
+    template void field_path_decoder::apply(const field_op, bitstream&, field_path&);
+    template void field_path_decoder::apply(const field_op, unchecked_bitstream&, field_path&);
+}
@@ -0,0 +1,234 @@
+/**
+ * @file field_path.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_FIELD_PATH_HPP_
+#define _ALICE_FIELD_PATH_HPP_
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "util/bitstream.hpp"
+#include "util/exception.hpp"
+#include "util/expect.hpp"
+
+namespace alice {
+    /// Thrown when a field path is nested deeper than supported or pops more levels than it has
+    ALICE_CREATE_EXCEPTION(FieldPathDepth, "Field path depth out of range");
+    /// Thrown when a list of field paths doesn't end before its data does
+    ALICE_CREATE_EXCEPTION(FieldPathTruncated, "Field paths run past the end of the data");
+
+    /**
+     * Position of a property in a nested serializer
+     *
+     * Each level holds the index of the field in the serializer selected by the level above it. Levels below
+     * the last one are always 0.
+     */
+    struct field_path {
+        /** Maximum number of levels */
+        static constexpr uint32_t max_depth = 7;
+
+        /** Index at each level */
+        std::array<int32_t, max_depth> data;
+        /** Index of the deepest valid level */
+        uint32_t last;
+
+        /** Creates the path every list starts with, it's advanced to the first field by the first op */
+        field_path() : data{{-1, 0, 0, 0, 0, 0, 0}}, last{0} { }
+
+        /** Returns the number of levels */
+        uint32_t size() const {
+            return last + 1;
+        }
+
+        /** Returns the index at level i */
+        int32_t operator[](const uint32_t i) const {
+            return data[i];
+        }
+
+        /** Compares the valid levels of both paths */
+        bool operator==(const field_path& p) const {
+            return last == p.last && data == p.data;
+        }
+
+        /** Adds a level with index v */
+        void push(const int32_t v) {
+            if (last + 1 >= max_depth)
+                ALICE_THROW(FieldPathDepth, last + 2 << " (levels)");
+
+            data[++last] = v;
+        }
+
+        /** Removes the n deepest levels */
+        void pop(const uint32_t n) {
+            if (n > last)
+                ALICE_THROW(FieldPathDepth, n << " (popping) " << last + 1 << " (levels)");
+
+            for (uint32_t i = 0; i < n; ++i)
+                data[last--] = 0;
+        }
+    };
+
+    /** Operations a list of field paths is encoded with, values are their huffman symbols */
+    enum class field_op : uint8_t {
+        plus_one = 0,
+        plus_two,
+        plus_three,
+        plus_four,
+        plus_n,
+        push_one_left_delta_zero_right_zero,
+        push_one_left_delta_zero_right_non_zero,
+        push_one_left_delta_one_right_zero,
+        push_one_left_delta_one_right_non_zero,
+        push_one_left_delta_n_right_zero,
+        push_one_left_delta_n_right_non_zero,
+        push_one_left_delta_n_right_non_zero_pack6_bits,
+        push_one_left_delta_n_right_non_zero_pack8_bits,
+        push_two_left_delta_zero,
+        push_two_pack5_left_delta_zero,
+        push_three_left_delta_zero,
+        push_three_pack5_left_delta_zero,
+        push_two_left_delta_one,
+        push_two_pack5_left_delta_one,
+        push_three_left_delta_one,
+        push_three_pack5_left_delta_one,
+        push_two_left_delta_n,
+        push_two_pack5_left_delta_n,
+        push_three_left_delta_n,
+        push_three_pack5_left_delta_n,
+        push_n,
+        push_n_and_non_topological,
+        pop_one_plus_one,
+        pop_one_plus_n,
+        pop_all_but_one_plus_one,
+        pop_all_but_one_plus_n,
+        pop_all_but_one_plus_n_pack3_bits,
+        pop_all_but_one_plus_n_pack6_bits,
+        pop_n_plus_one,
+        pop_n_plus_n,
+        pop_n_and_non_topographical,
+        non_topo_complex,
+        non_topo_penultimate_plus_one,
+        non_topo_complex_pack4_bits,
+        finish
+    };
+
+    /**
+     * Decoder for the field paths of Source 2 entity updates
+     *
+     * Each update lists the paths of the properties it changes, encoded as a sequence of huffman coded ops
+     * which modify the previous path. The huffman tree is fixed and built from the op weights once.
+     *
+     * Instead of walking the tree one bit at a time, next() peeks lookup_bits bits and resolves the op with a
+     * single table lookup. Only the rarely used ops with longer codes continue bit by bit from the tree node
+     * the lookup ended in.
+     */
+    class field_path_decoder {
+        public:
+            /** Number of ops */
+            static constexpr uint32_t op_count = static_cast<uint32_t>(field_op::finish) + 1;
+            /** Number of bits resolved with a single lookup */
+            static constexpr uint32_t lookup_bits = 10;
+
+            /** Huffman code of an op, the first bit in the stream is the lowest one */
+            struct code {
+                /** Bits of the code */
+                uint32_t bits;
+                /** Number of bits */
+                uint32_t length;
+            };
+
+            /** Builds the huffman tree and the lookup table */
+            field_path_decoder();
+
+            /** Returns the shared decoder, it's built on first use */
+            static const field_path_decoder& get();
+
+            /** Returns the huffman code of op */
+            code encoding(const field_op op) const {
+                return codes[static_cast<uint32_t>(op)];
+            }
+
+            /** Reads the next op */
+            template <typename Policy>
+            field_op next(basic_bitstream<Policy>& s) const {
+                const entry e = table[s.peek(lookup_bits)];
+                s.consume(e.length);
+
+                uint32_t node = e.node;
+                while (!expect(node < op_count))
+                    node = tree[node - op_count][s.read(1)];
+
+                return static_cast<field_op>(node);
+            }
+
+            /** Reads the next op walking the tree one bit at a time, reference implementation of next() */
+            template <typename Policy>
+            field_op next_bitwise(basic_bitstream<Policy>& s) const {
+                uint32_t node = root;
+                while (node >= op_count)
+                    node = tree[node - op_count][s.read(1)];
+
+                return static_cast<field_op>(node);
+            }
+
+            /**
+             * Reads the paths of an update into paths, replacing its previous contents.
+             *
+             * Reading stops after the finish op. Reusing the same vector for all updates avoids allocating.
+             */
+            template <typename Policy>
+            void read(basic_bitstream<Policy>& s, std::vector<field_path>& paths) const;
+
+            /** Applies op to path, reading its operands from s */
+            template <typename Policy>
+            static void apply(const field_op op, basic_bitstream<Policy>& s, field_path& path);
+        private:
+            /** Lookup table entry */
+            struct entry {
+                /** Op if smaller than op_count, tree node to continue from otherwise */
+                uint16_t node;
+                /** Number of bits used */
+                uint16_t length;
+            };
+
+            /** Children of the inner nodes, node n is stored at n - op_count */
+            std::array<std::array<uint16_t, 2>, op_count - 1> tree;
+            /** Root of the tree */
+            uint16_t root;
+            /** Code of each op */
+            std::array<code, op_count> codes;
+            /** Result of looking at the next lookup_bits bits */
+            std::array<entry, 1 << lookup_bits> table;
+
+            /** Assigns the codes below node and fills the lookup table */
+            void assign(const uint32_t node, const uint32_t bits, const uint32_t length);
+    };
+
+    extern template void field_path_decoder::read(bitstream&, std::vector<field_path>&) const;
+    extern template void field_path_decoder::read(unchecked_bitstream&, std::vector<field_path>&) const;
+    extern template void field_path_decoder::apply(const field_op, bitstream&, field_path&);
+    extern template void field_path_decoder::apply(const field_op, unchecked_bitstream&, field_path&);
+}
+
+#endif /* _ALICE_FIELD_PATH_HPP_ */
@@ -0,0 +1,244 @@
+/**
+ * @file packet_dispatch.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_PACKET_DISPATCH_HPP_
+#define _ALICE_PACKET_DISPATCH_HPP_
+
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+
+#include <google/protobuf/arena.h>
+
+#include "dem.hpp"
+#include "packets.hpp"
+#include "wire.hpp"
+
+/// Combines packet kind and id into a single switch label
+#define ALICE_PACKET_KEY(__kind, __id) ((static_cast<unsigned>(__kind) << 16) | static_cast<unsigned>(__id))
+
+namespace alice {
+    /**
+     * Maps a packet kind and id to its message type at compile time.
+     *
+     * packet_type<engine::two, PACKET_NET, ps2::svc_ServerInfo>::type is ps2::CSVCMsg_ServerInfo. Unknown
+     * packets have no type member.
+     */
+    template <engine E, unsigned Kind, unsigned Id>
+    struct packet_type {};
+
+    #define ALICE_PACKET(__kind, __id, __obj)                   \
+    template <>                                                 \
+    struct packet_type<engine::one, __kind, __id> {             \
+        typedef __obj type;                                     \
+    };
+    #include "packets.s1.types.hpp.inline"
+    #undef ALICE_PACKET
+
+    #define ALICE_PACKET(__kind, __id, __obj)                   \
+    template <>                                                 \
+    struct packet_type<engine::two, __kind, __id> {             \
+        typedef __obj type;                                     \
+    };
+    #include "packets.s2.types.hpp.inline"
+    #undef ALICE_PACKET
+
+    /** Placeholder for messages without a zero-copy decoder */
+    struct wire_none {};
+
+    /**
+     * Maps a message to the type returned by its zero-copy decoder, see wire.hpp.
+     *
+     * Handlers that take the wire type instead of the message get views into the packet instead of copies.
+     */
+    template <typename Obj>
+    struct wire_message {
+        typedef wire_none type;
+    };
+
+    #define ALICE_WIRE_MESSAGE(__obj, __wire)                   \
+    template <>                                                 \
+    struct wire_message<__obj> {                                \
+        typedef __wire type;                                    \
+    };
+
+    ALICE_WIRE_MESSAGE(ps1::CDemoPacket, wire_demo_packet)
+    ALICE_WIRE_MESSAGE(ps2::CDemoPacket, wire_demo_packet)
+    ALICE_WIRE_MESSAGE(ps1::CSVCMsg_PacketEntities, wire_packet_entities)
+    ALICE_WIRE_MESSAGE(ps2::CSVCMsg_PacketEntities, wire_packet_entities)
+    ALICE_WIRE_MESSAGE(ps1::CSVCMsg_CreateStringTable, wire_create_string_table)
+    ALICE_WIRE_MESSAGE(ps2::CSVCMsg_CreateStringTable, wire_create_string_table)
+    ALICE_WIRE_MESSAGE(ps1::CSVCMsg_UpdateStringTable, wire_update_string_table)
+    ALICE_WIRE_MESSAGE(ps2::CSVCMsg_UpdateStringTable, wire_update_string_table)
+    #undef ALICE_WIRE_MESSAGE
+
+    /** Whether Handler has a method on(const Obj&, Args...) */
+    template <typename Handler, typename Obj, typename... Args>
+    struct packet_handles {
+    private:
+        template <typename H>
+        static auto test(int) -> decltype(
+            std::declval<H&>().on(std::declval<const Obj&>(), std::declval<Args>()...), std::true_type()
+        );
+
+        template <typename H>
+        static std::false_type test(...);
+    public:
+        static constexpr bool value = decltype(test<Handler>(0))::value;
+    };
+
+    /** Whether Handler takes Obj or its zero-copy counterpart */
+    template <typename Handler, typename Obj, typename... Args>
+    struct packet_wanted {
+        static constexpr bool value = packet_handles<Handler, Obj, Args...>::value
+            || packet_handles<Handler, typename wire_message<Obj>::type, Args...>::value;
+    };
+
+    namespace detail {
+        /** Parses the message and passes it to the handler */
+        template <typename Obj, typename Handler, typename... Args>
+        packet_status packet_invoke(std::true_type, const char* data, std::size_t size,
+            google::protobuf::Arena* arena, Handler& h, Args&&... args)
+        {
+            if (arena) {
+                Obj* msg = google::protobuf::Arena::CreateMessage<Obj>(arena);
+                if (!msg->ParseFromArray(data, size))
+                    return packet_status::parse_error;
+
+                h.on(*msg, std::forward<Args>(args)...);
+            } else {
+                Obj msg;
+                if (!msg.ParseFromArray(data, size))
+                    return packet_status::parse_error;
+
+                h.on(msg, std::forward<Args>(args)...);
+            }
+
+            return packet_status::ok;
+        }
+
+        /** Handler is not interested in this message, it's never parsed */
+        template <typename Obj, typename Handler, typename... Args>
+        packet_status packet_invoke(std::false_type, const char*, std::size_t, google::protobuf::Arena*,
+            Handler&, Args&&...)
+        {
+            return packet_status::ignored;
+        }
+
+        /** Handler takes the zero-copy view, decodes it in place */
+        template <typename Obj, typename Handler, typename... Args>
+        packet_status packet_route(std::true_type, const char* data, std::size_t size, google::protobuf::Arena*,
+            Handler& h, Args&&... args)
+        {
+            typename wire_message<Obj>::type msg;
+            if (!wire_decode(data, size, msg))
+                return packet_status::parse_error;
+
+            h.on(msg, std::forward<Args>(args)...);
+            return packet_status::ok;
+        }
+
+        /** Parses the protobuf message if handler takes it */
+        template <typename Obj, typename Handler, typename... Args>
+        packet_status packet_route(std::false_type, const char* data, std::size_t size,
+            google::protobuf::Arena* arena, Handler& h, Args&&... args)
+        {
+            return packet_invoke<Obj>(
+                std::integral_constant<bool, packet_handles<Handler, Obj, Args...>::value>(),
+                data, size, arena, h, std::forward<Args>(args)...
+            );
+        }
+    }
+
+    /**
+     * Whether handler has an on() overload for the given packet.
+     *
+     * Used to skip packets without copying them out of the stream first.
+     */
+    template <typename Handler, typename... Args>
+    bool packet_accepts(engine e, unsigned kind, unsigned id) {
+        #define ALICE_PACKET(__kind, __id, __obj) \
+            case ALICE_PACKET_KEY(__kind, __id): return packet_wanted<Handler, __obj, Args...>::value;
+
+        switch (e) {
+            case engine::one:
+                switch (ALICE_PACKET_KEY(kind, id)) {
+                    #include "packets.s1.types.hpp.inline"
+                    default: return false;
+                }
+            case engine::two:
+                switch (ALICE_PACKET_KEY(kind, id)) {
+                    #include "packets.s2.types.hpp.inline"
+                    default: return false;
+                }
+            default:
+                return false;
+        }
+
+        #undef ALICE_PACKET
+    }
+
+    /**
+     * Parses the packet as its actual type and calls h.on(msg, args...).
+     *
+     * The message type is resolved through a switch generated from the proto files instead of a list of
+     * type-erased factories. Packets the handler has no overload for are not parsed at all. The message
+     * is allocated from arena if set, otherwise it lives on the stack for the duration of the call. If the
+     * handler takes the type from wire_message instead, the packet is decoded in place without copies.
+     *
+     * Returns packet_status::ok if the handler was called, ignored if it has no overload for the packet,
+     * out_of_range if no type is known for the id or engine, like packet_list does, and parse_error if the
+     * payload is invalid. Nothing is thrown.
+     */
+    template <typename Handler, typename... Args>
+    packet_status packet_dispatch(engine e, unsigned kind, unsigned id, const char* data, std::size_t size,
+        google::protobuf::Arena* arena, Handler& h, Args&&... args)
+    {
+        #define ALICE_PACKET(__kind, __id, __obj)                                               \
+            case ALICE_PACKET_KEY(__kind, __id):                                                \
+                return detail::packet_route<__obj>(                                             \
+                    std::integral_constant<bool,                                                \
+                        packet_handles<Handler, wire_message<__obj>::type, Args...>::value>(),  \
+                    data, size, arena, h, std::forward<Args>(args)...                           \
+                );
+
+        switch (e) {
+            case engine::one:
+                switch (ALICE_PACKET_KEY(kind, id)) {
+                    #include "packets.s1.types.hpp.inline"
+                    default: return packet_status::out_of_range;
+                }
+            case engine::two:
+                switch (ALICE_PACKET_KEY(kind, id)) {
+                    #include "packets.s2.types.hpp.inline"
+                    default: return packet_status::out_of_range;
+                }
+            default:
+                return packet_status::out_of_range;
+        }
+
+        #undef ALICE_PACKET
+    }
+}
+
+#endif /* _ALICE_PACKET_DISPATCH_HPP_ */
@@ -23,13 +23,32 @@
 #include "packets.hpp"
 
 namespace alice {
-    void packet_register_s1() {
-        packet_list* p = packet_list::instance();
+    void packet_register_s1(packet_list* p) {
         #include "packets.s1.hpp.inline"
     }
 
-    void packet_register_s2() {
-        packet_list* p = packet_list::instance();
+    void packet_register_s2(packet_list* p) {
         #include "packets.s2.hpp.inline"
     }
+
+    const packet_list* packet_registry_s1() {
+        // Initialization of local statics is thread safe, the list is never freed like instance()
+        static const packet_list* registry = []() {
+            packet_list* p = new packet_list;
+            packet_register_s1(p);
+            return p;
+        }();
+
+        return registry;
+    }
+
+    const packet_list* packet_registry_s2() {
+        static const packet_list* registry = []() {
+            packet_list* p = new packet_list;
+            packet_register_s2(p);
+            return p;
+        }();
+
+        return registry;
+    }
 }
\ No newline at end of file
@@ -26,7 +26,13 @@
 #include <array>
 #include <vector>
 #include <functional>
-#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <cstdint>
+
+#include <google/protobuf/arena.h>
+
+#include "util/noncopyable.hpp"
 
 // Source 1 files containing packets
 #include "proto/source1/netmessages_s1.pb.h"
@@ -59,6 +65,44 @@ namespace alice {
         usr = PACKET_USR
     };
 
+    /** Result of looking up and parsing a packet */
+    enum class packet_status {
+        /** Packet was parsed */
+        ok = 0,
+        /** Nobody is interested in the packet, it hasn't been parsed */
+        ignored,
+        /** Type or subtype is outside of the registered range */
+        out_of_range,
+        /** Subtype is in range but no message has been registered for it */
+        unknown,
+        /** Payload is not a valid message */
+        parse_error
+    };
+
+    /**
+     * Number of failed lookups and parses by packet_status
+     *
+     * Kept by each parser, the lists packets are created from are shared and don't count anything.
+     */
+    class packet_errors {
+    public:
+        /** Counts status if it's an error and returns it */
+        packet_status report(packet_status status) {
+            if (status != packet_status::ok && status != packet_status::ignored)
+                ++counts[static_cast<unsigned>(status)];
+
+            return status;
+        }
+
+        /** Returns how often lookups or parsing failed with status */
+        uint64_t count(packet_status status) const {
+            return counts[static_cast<unsigned>(status)];
+        }
+    private:
+        /** Number of failures by status */
+        std::array<uint64_t, 5> counts{};
+    };
+
     /** A list of all possible packet types, used in conjuction with protobuf and is especially written for it */
     class packet_list {
     public:
@@ -78,22 +122,57 @@ namespace alice {
 
             // We use non-capturing lambdas instead of util/delegate as those are optimized
             // for small functions, relying soley on the stack for this function
-            v[subtype] = [](const char* data, size_t size) {
-                Obj* msg = new Obj;
-                msg->ParseFromArray(data, size);
-                return (void*)msg;
+            v[subtype] = [](google::protobuf::Arena* arena, const char* data, size_t size) {
+                Obj* msg = create<Obj>(arena, std::is_base_of<google::protobuf::MessageLite, Obj>());
+                if (msg->ParseFromArray(data, size))
+                    return (void*)msg;
+
+                if (!arena)
+                    delete msg;
+
+                return (void*)nullptr;
            };
         }
 
-        /** Creates packet from given type */
+        /**
+         * Creates packet from given type.
+         *
+         * If arena is set the packet is allocated from it and freed together with the arena, otherwise
+         * the caller owns the returned packet. Returns nullptr and sets status if the packet isn't
+         * registered or can't be parsed, counting the failure is up to the caller.
+         */
         template <typename Obj>
-        Obj* get(unsigned type, unsigned subtype, const char* data, size_t size) {
-            try {
-                return reinterpret_cast<Obj*>(list[type][subtype](data, size));
-            } catch (std::exception &e) { // if subtype() is undefined, will throw
-                std::cout << e.what() << std::endl;
+        Obj* get(unsigned type, unsigned subtype, const char* data, size_t size, packet_status& status,
+            google::protobuf::Arena* arena = nullptr) const
+        {
+            if (type >= list.size() || subtype >= list[type].size()) {
+                status = packet_status::out_of_range;
+                return nullptr;
+            }
+
+            auto &f = list[type][subtype];
+            if (!f) {
+                status = packet_status::unknown;
+                return nullptr;
+            }
+
+            void* msg = f(arena, data, size);
+            if (!msg) {
+                status = packet_status::parse_error;
                 return nullptr;
             }
+
+            status = packet_status::ok;
+            return reinterpret_cast<Obj*>(msg);
+        }
+
+        /** Creates packet from given type, returns nullptr on failure */
+        template <typename Obj>
+        Obj* get(unsigned type, unsigned subtype, const char* data, size_t size,
+            google::protobuf::Arena* arena = nullptr) const
+        {
+            packet_status status;
+            return get<Obj>(type, subtype, data, size, status, arena);
         }
 
         /** Returns packet list */
@@ -102,19 +181,110 @@ namespace alice {
             return instance;
         }
     private:
+        /** Creates a protobuf message owned by arena, so its fields are allocated there as well */
+        template <typename Obj>
+        static Obj* create(google::protobuf::Arena* arena, std::true_type) {
+            return google::protobuf::Arena::CreateMessage<Obj>(arena);
+        }
+
+        /** Creates any other object, destroyed together with arena */
+        template <typename Obj>
+        static Obj* create(google::protobuf::Arena* arena, std::false_type) {
+            return google::protobuf::Arena::Create<Obj>(arena);
+        }
+
         // array of T vectors of factory functions
         std::array<
             std::vector<
-                std::function<void* (const char* data, size_t size)>
+                std::function<void* (google::protobuf::Arena* arena, const char* data, size_t size)>
             >, 3 // default to 3 packet slots
         > list;
     };
 
+    /**
+     * Keeps a single instance per packet type and parses into it again on every use.
+     *
+     * ParseFromArray clears the message first, repeated and bytes fields keep their capacity. Once every
+     * type has been seen and its largest instance parsed, decoding a packet doesn't allocate anymore.
+     * A packet returned by get() stays valid until the next packet of the same type is requested.
+     */
+    class packet_cache : private noncopyable {
+    public:
+        /** Creates an empty cache, new instances are created from list */
+        explicit packet_cache(const packet_list* list) : list(list) {}
+
+        /** Frees all cached instances */
+        ~packet_cache() {
+            for (auto &v : cache) {
+                for (auto &e : v) {
+                    if (e.first)
+                        e.second(e.first);
+                }
+            }
+        }
+
+        /**
+         * Parses data into the cached instance of the given type, creating it on first use.
+         *
+         * Returns nullptr and sets status if the packet is unknown or can't be parsed.
+         */
+        template <typename Obj>
+        Obj* get(unsigned type, unsigned subtype, const char* data, size_t size, packet_status& status) {
+            auto &v = cache[type];
+            if (v.size() <= subtype)
+                v.resize(subtype+1, entry(nullptr, nullptr));
+
+            auto &e = v[subtype];
+            if (e.first) {
+                Obj* msg = static_cast<Obj*>(e.first);
+                if (msg->ParseFromArray(data, size)) {
+                    status = packet_status::ok;
+                    return msg;
+                }
+
+                status = packet_status::parse_error;
+                return nullptr;
+            }
+
+            Obj* msg = list->get<Obj>(type, subtype, data, size, status);
+            if (msg)
+                e = entry(msg, [](void* p) { delete static_cast<Obj*>(p); });
+
+            return msg;
+        }
+
+        /** Parses data into the cached instance of the given type, returns nullptr on failure */
+        template <typename Obj>
+        Obj* get(unsigned type, unsigned subtype, const char* data, size_t size) {
+            packet_status status;
+            return get<Obj>(type, subtype, data, size, status);
+        }
+    private:
+        /** Cached instance and the function to free it */
+        typedef std::pair<void*, void (*)(void*)> entry;
+
+        /** Creates new instances */
+        const packet_list* list;
+        /** Instances by type and subtype */
+        std::array<std::vector<entry>, 3> cache;
+    };
+
     /** Registers all source 1 packets */
-    void packet_register_s1();
+    void packet_register_s1(packet_list* p = packet_list::instance());
 
     /** Registers all source 2 packets */
-    void packet_register_s2();
+    void packet_register_s2(packet_list* p = packet_list::instance());
+
+    /**
+     * Returns a list with all source 1 packets.
+     *
+     * The list is built once on first use and never modified afterwards, so it can be shared by parsers
+     * running on any number of threads.
+     */
+    const packet_list* packet_registry_s1();
+
+    /** Returns a list with all source 2 packets, see packet_registry_s1 */
+    const packet_list* packet_registry_s2();
 }
 
 #endif /* _ALICE_PACKETS_HPP_ */
\ No newline at end of file
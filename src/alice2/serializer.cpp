@@ -0,0 +1,377 @@
+/**
+ * @file serializer.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <map>
+#include <set>
+#include <utility>
+#include <cmath>
+#include <cstdlib>
+
+#include "proto/source2/netmessages.pb.h"
+
+#include "serializer.hpp"
+
+namespace alice {
+    namespace {
+        /** Removes surrounding spaces */
+        std::string trim(const std::string& str) {
+            const std::size_t begin = str.find_first_not_of(' ');
+            if (begin == std::string::npos)
+                return std::string();
+
+            return str.substr(begin, str.find_last_not_of(' ') - begin + 1);
+        }
+
+        /** Sets inner to T if type is templ< T > */
+        bool unwrap(const std::string& type, const std::string& templ, std::string& inner) {
+            if (type.compare(0, templ.size(), templ) != 0 || type.size() < templ.size() + 2)
+                return false;
+
+            if (type[templ.size()] != '<' || type.back() != '>')
+                return false;
+
+            inner = trim(type.substr(templ.size() + 1, type.size() - templ.size() - 2));
+            return true;
+        }
+
+        /** Returns how many floats a value of type consists of, 0 if it isn't a float type */
+        uint8_t float_components(const std::string& type) {
+            if (type == "float32" || type == "CNetworkedQuantizedFloat")
+                return 1;
+
+            if (type == "Vector2D")
+                return 2;
+
+            if (type == "Vector")
+                return 3;
+
+            if (type == "Vector4D" || type == "Quaternion")
+                return 4;
+
+            return 0;
+        }
+
+        /** Returns the kind of all other value types, everything unknown is an unsigned varint */
+        field_kind base_kind(const std::string& type) {
+            static const std::map<std::string, field_kind> kinds = {
+                {"bool", field_kind::boolean},
+                {"char", field_kind::string},
+                {"CUtlString", field_kind::string},
+                {"CUtlSymbolLarge", field_kind::string},
+                {"int8", field_kind::signed_32},
+                {"int16", field_kind::signed_32},
+                {"int32", field_kind::signed_32},
+                {"int64", field_kind::signed_64},
+                {"uint64", field_kind::unsigned_64},
+                {"CStrongHandle", field_kind::unsigned_64},
+                {"QAngle", field_kind::qangle},
+                {"GameTime_t", field_kind::float_noscale}
+            };
+
+            // Handles and the like are templates
+            const auto it = kinds.find(type.substr(0, type.find('<')));
+            return it == kinds.end() ? field_kind::unsigned_32 : it->second;
+        }
+    }
+
+    constexpr uint32_t quantized_float::round_down;
+    constexpr uint32_t quantized_float::round_up;
+    constexpr uint32_t quantized_float::encode_zero;
+    constexpr uint32_t quantized_float::encode_integers;
+    constexpr uint32_t flattened_serializer::npos;
+
+    quantized_float::quantized_float(uint32_t bit_count, float low, float high, uint32_t flags)
+        : low(low), high(high), high_low_mul(0.0f), dec_mul(0.0f), bits(bit_count), flags(flags)
+    {
+        if (bit_count == 0 || bit_count >= 32) {
+            bits = 32;
+            this->flags = 0;
+            return;
+        }
+
+        uint32_t& f = this->flags;
+        f = adjust(low, high, f);
+
+        if ((f & (round_down | round_up)) == (round_down | round_up))
+            ALICE_THROW(SerializerInvalid, f << " (quantization flags)");
+
+        // One step at the rounded end is reserved for the exact value
+        uint64_t steps = static_cast<uint64_t>(1) << bits;
+        if (f & round_down) {
+            this->high -= (this->high - this->low) / steps;
+        } else if (f & round_up) {
+            this->low += (this->high - this->low) / steps;
+        }
+
+        if (f & encode_integers) {
+            float delta = this->high - this->low;
+            if (delta < 1.0f)
+                delta = 1.0f;
+
+            const uint64_t range = static_cast<uint64_t>(1) << static_cast<uint32_t>(std::ceil(std::log2(delta)));
+            while (bits < 31 && (static_cast<uint64_t>(1) << bits) <= range)
+                ++bits;
+
+            steps = static_cast<uint64_t>(1) << bits;
+            this->high = this->low + range - static_cast<float>(range) / steps;
+        }
+
+        // Largest multiplier which doesn't overflow the number of steps
+        const uint32_t max = (1u << bits) - 1;
+        const float r = this->high - this->low;
+
+        high_low_mul = std::fabs(r) <= 0.0f ? static_cast<float>(max) : max / r;
+        if (high_low_mul * r > max) {
+            for (const float m : {0.9999f, 0.99f, 0.9f, 0.8f, 0.7f}) {
+                high_low_mul = max / r * m;
+                if (high_low_mul * r <= max)
+                    break;
+            }
+        }
+
+        dec_mul = 1.0f / (steps - 1);
+
+        // Values which end up on the range anyway don't need a bit
+        if ((f & round_down) && quantize(this->low) == this->low)
+            f &= ~round_down;
+
+        if ((f & round_up) && quantize(this->high) == this->high)
+            f &= ~round_up;
+
+        if ((f & encode_zero) && quantize(0.0f) == 0.0f)
+            f &= ~encode_zero;
+    }
+
+    uint32_t quantized_float::adjust(const float low, const float high, uint32_t f) {
+        // Drop flags which contradict the range
+        if ((low == 0.0f && (f & round_up)) || (high == 0.0f && (f & round_down)))
+            f &= ~encode_zero;
+
+        if (low == 0.0f && (f & encode_zero)) {
+            f |= round_down;
+            f &= ~encode_zero;
+        }
+
+        if (high == 0.0f && (f & encode_zero)) {
+            f |= round_up;
+            f &= ~encode_zero;
+        }
+
+        if (low > 0.0f || high < 0.0f)
+            f &= ~encode_zero;
+
+        if (f & encode_integers)
+            f &= ~(round_up | round_down | encode_zero);
+
+        return f;
+    }
+
+    float quantized_float::quantize(const float v) const {
+        if (v < low)
+            return low;
+
+        if (v > high)
+            return high;
+
+        const uint32_t i = static_cast<uint32_t>((v - low) * high_low_mul);
+        return low + (high - low) * (static_cast<float>(i) * dec_mul);
+    }
+
+    flattened_serializer::flattened_serializer(const ps2::CSVCMsg_FlattenedSerializer& msg)
+        : symbols(msg.symbols().begin(), msg.symbols().end()), quantizations(1)
+    {
+        // Index all serializers first, fields may reference ones sent later
+        std::map<std::pair<uint32_t, int32_t>, uint32_t> versions;
+        uint32_t total = 0;
+
+        for (const auto& s : msg.serializers()) {
+            const uint32_t name = symbol(s.serializer_name_sym());
+            const uint32_t index = serializers.size();
+
+            serializers.push_back(serializer{name, s.serializer_version(), total, static_cast<uint32_t>(s.fields_size())});
+            versions[std::make_pair(name, s.serializer_version())] = index;
+            total += s.fields_size();
+
+            const auto it = newest.find(symbols[name]);
+            if (it == newest.end() || serializers[it->second].version < s.serializer_version())
+                newest[symbols[name]] = index;
+        }
+
+        fields.resize(total);
+        fieldNames.resize(total);
+        fieldTypes.resize(total);
+
+        for (uint32_t i = 0; i < serializers.size(); ++i) {
+            const auto& s = msg.serializers(i);
+
+            for (uint32_t j = 0; j < serializers[i].count; ++j) {
+                const auto& f = s.fields(j);
+                const uint32_t index = serializers[i].first + j;
+
+                uint32_t child = npos;
+                if (f.has_field_serializer_name_sym()) {
+                    const auto it = versions.find(std::make_pair(symbol(f.field_serializer_name_sym()),
+                        f.field_serializer_version()));
+
+                    if (it == versions.end())
+                        ALICE_THROW(SerializerInvalid, symbols[f.field_serializer_name_sym()] << " (missing serializer)");
+
+                    child = it->second;
+                }
+
+                fieldNames[index] = symbol(f.var_name_sym());
+                fieldTypes[index] = symbol(f.var_type_sym());
+                compile(index, trim(symbols[fieldTypes[index]]), child, f);
+            }
+        }
+    }
+
+    bool flattened_serializer::valid(const ps2::CSVCMsg_FlattenedSerializer& msg) {
+        const auto known = [&msg](const int32_t sym) {
+            return sym >= 0 && sym < msg.symbols_size();
+        };
+
+        std::set<std::pair<int32_t, int32_t>> versions;
+        for (const auto& s : msg.serializers()) {
+            if (!known(s.serializer_name_sym()))
+                return false;
+
+            versions.insert(std::make_pair(s.serializer_name_sym(), s.serializer_version()));
+        }
+
+        for (const auto& s : msg.serializers()) {
+            for (const auto& f : s.fields()) {
+                if (!known(f.var_name_sym()) || !known(f.var_type_sym()))
+                    return false;
+
+                if (f.has_field_serializer_name_sym() && (!known(f.field_serializer_name_sym())
+                        || !versions.count(std::make_pair(f.field_serializer_name_sym(), f.field_serializer_version()))))
+                    return false;
+
+                if (f.bit_count() > 0 && f.bit_count() < 32 && !quantized_float::valid(
+                        f.has_low_value() ? f.low_value() : 0.0f, f.has_high_value() ? f.high_value() : 1.0f,
+                        f.encode_flags()))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    uint32_t flattened_serializer::find(const std::string& name) const {
+        const auto it = newest.find(name);
+        return it == newest.end() ? npos : it->second;
+    }
+
+    uint32_t flattened_serializer::find(const std::string& name, int32_t version) const {
+        for (uint32_t i = 0; i < serializers.size(); ++i) {
+            if (serializers[i].version == version && symbols[serializers[i].name] == name)
+                return i;
+        }
+
+        return npos;
+    }
+
+    void flattened_serializer::invalid(const uint32_t s, const field_path& p) const {
+        std::string path;
+        for (uint32_t i = 0; i <= p.last; ++i)
+            path += (i ? "/" : "") + std::to_string(p[i]);
+
+        ALICE_THROW(SerializerFieldPath, symbols[serializers[s].name] << " (serializer) " << path << " (path)");
+    }
+
+    uint32_t flattened_serializer::symbol(const int32_t sym) const {
+        if (sym < 0 || static_cast<uint32_t>(sym) >= symbols.size())
+            ALICE_THROW(SerializerInvalid, sym << " (symbol)");
+
+        return sym;
+    }
+
+    void flattened_serializer::compile(const uint32_t index, const std::string& type, const uint32_t child,
+        const ps2::ProtoFlattenedSerializerField_t& f)
+    {
+        serializer_field d{field_kind::none, field_model::simple, 1, 0, npos, 0, 0};
+        const uint8_t floats = float_components(type);
+        std::string inner;
+
+        const std::size_t bracket = type.find('[');
+        const std::string base = bracket != std::string::npos && type.back() == ']'
+            ? trim(type.substr(0, bracket)) : type;
+
+        if (base == "char") {
+            // Char arrays are strings
+            d.kind = field_kind::string;
+        } else if (base != type) {
+            d.model = field_model::fixed_array;
+            d.size = strtoul(type.c_str() + bracket + 1, nullptr, 10);
+            d.child = element(index, base, child, f);
+        } else if (unwrap(type, "CUtlVector", inner) || unwrap(type, "CNetworkUtlVectorBase", inner)
+            || unwrap(type, "CUtlVectorEmbeddedNetworkVar", inner)) {
+            d.kind = field_kind::array_length;
+            d.model = field_model::dynamic_array;
+            d.child = element(index, inner, child, f);
+        } else if (child != npos) {
+            // Pointers can be unset, embedded serializers are always there
+            d.kind = type.back() == '*' ? field_kind::pointer : field_kind::none;
+            d.model = field_model::table;
+            d.child = child;
+        } else if (floats) {
+            const std::string& name = symbols[fieldNames[index]];
+            d.components = floats;
+
+            if (name == "m_flSimulationTime" || name == "m_flAnimTime") {
+                d.kind = field_kind::float_simtime;
+            } else if (f.bit_count() <= 0 || f.bit_count() >= 32) {
+                d.kind = field_kind::float_noscale;
+            } else {
+                d.kind = field_kind::float_quantized;
+                d.quantization = quantizations.size();
+                quantizations.push_back(quantized_float(f.bit_count(), f.has_low_value() ? f.low_value() : 0.0f,
+                    f.has_high_value() ? f.high_value() : 1.0f, f.encode_flags()));
+            }
+        } else {
+            d.kind = base_kind(type);
+            d.bits = f.bit_count() > 0 && f.bit_count() < 32 ? f.bit_count() : 0;
+
+            // Angles with 32 bits are raw floats
+            if (d.kind == field_kind::qangle) {
+                d.components = 3;
+                d.bits = f.bit_count() == 32 ? 32 : d.bits;
+            }
+        }
+
+        fields[index] = d;
+    }
+
+    uint32_t flattened_serializer::element(const uint32_t parent, const std::string& type, const uint32_t child,
+        const ps2::ProtoFlattenedSerializerField_t& f)
+    {
+        const uint32_t index = fields.size();
+        fields.emplace_back();
+        fieldNames.push_back(fieldNames[parent]);
+        fieldTypes.push_back(fieldTypes[parent]);
+
+        compile(index, type, child, f);
+        return index;
+    }
+}
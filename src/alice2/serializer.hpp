@@ -0,0 +1,324 @@
+/**
+ * @file serializer.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_SERIALIZER_HPP_
+#define _ALICE_SERIALIZER_HPP_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "util/bitstream.hpp"
+#include "util/exception.hpp"
+#include "field_path.hpp"
+
+namespace alice {
+    namespace ps2 {
+        class CSVCMsg_FlattenedSerializer;
+        class ProtoFlattenedSerializerField_t;
+    }
+
+    /// Thrown when a flattened serializer references symbols or serializers that don't exist
+    ALICE_CREATE_EXCEPTION(SerializerInvalid, "Invalid flattened serializer");
+    /// Thrown when a field path doesn't lead to a field of the serializer
+    ALICE_CREATE_EXCEPTION(SerializerFieldPath, "Field path doesn't match the serializer");
+
+    /** How the value of a field is decoded */
+    enum class field_kind : uint8_t {
+        /** Single bit */
+        boolean = 0,
+        /** Zigzag encoded varint */
+        signed_32,
+        /** Zigzag encoded 64 bit varint */
+        signed_64,
+        /** Varint */
+        unsigned_32,
+        /** 64 bit varint */
+        unsigned_64,
+        /** Raw 32 bit float */
+        float_noscale,
+        /** Float quantized between a low and a high value, see quantized_float */
+        float_quantized,
+        /** Time as a varint number of ticks */
+        float_simtime,
+        /** Three angles with bits each, three raw floats if bits is 32 or three optional coordinates if it's 0 */
+        qangle,
+        /** Null terminated string */
+        string,
+        /** Number of elements of a dynamic array as a varint */
+        array_length,
+        /** Single bit telling whether a nested serializer is present */
+        pointer,
+        /** Nested serializers and fixed arrays have no value of their own */
+        none
+    };
+
+    /** How a field nests, decides what the next level of a field path refers to */
+    enum class field_model : uint8_t {
+        /** Plain value, nothing below it */
+        simple = 0,
+        /** Fixed number of elements, the next level is the index of the element */
+        fixed_array,
+        /** Variable number of elements, the next level is the index of the element */
+        dynamic_array,
+        /** Nested serializer, the next level is the index of its field */
+        table
+    };
+
+    /**
+     * Parameters of a quantized float
+     *
+     * The value is stored as bits steps between low and high. Depending on the flags a few bits in front of it
+     * mark values which are encoded exactly. Flags which make no difference for the range are removed when
+     * the parameters are computed.
+     */
+    struct quantized_float {
+        /** Decode to the low value if the first bit is set */
+        static constexpr uint32_t round_down = 1;
+        /** Decode to the high value if the next bit is set */
+        static constexpr uint32_t round_up = 2;
+        /** Decode to 0 if the next bit is set */
+        static constexpr uint32_t encode_zero = 4;
+        /** Widen the range so integers are encoded exactly */
+        static constexpr uint32_t encode_integers = 8;
+
+        /** Lowest value */
+        float low;
+        /** Highest value */
+        float high;
+        /** Multiplier from the value to the number of steps, used to check the flags */
+        float high_low_mul;
+        /** Size of a single step relative to the range */
+        float dec_mul;
+        /** Number of bits per value */
+        uint32_t bits;
+        /** Flags still in effect */
+        uint32_t flags;
+
+        /**
+         * Computes the parameters, bit counts of 0 or 32 and more are read as raw floats.
+         *
+         * Throws SerializerInvalid if the flags round to both ends of the range, see valid().
+         */
+        quantized_float(uint32_t bit_count = 0, float low = 0.0f, float high = 1.0f, uint32_t flags = 0);
+
+        /** Returns flags without the ones which contradict the range or are implied by encode_integers */
+        static uint32_t adjust(float low, float high, uint32_t flags);
+
+        /** Whether the flags don't round to both ends of the range once adjusted */
+        static bool valid(float low, float high, uint32_t flags) {
+            return (adjust(low, high, flags) & (round_down | round_up)) != (round_down | round_up);
+        }
+
+        /** Whether the value is a raw float */
+        bool noscale() const {
+            return bits == 32;
+        }
+
+        /** Returns the value v is encoded as */
+        float quantize(const float v) const;
+
+        /** Reads a value */
+        template <typename Policy>
+        float decode(basic_bitstream<Policy>& s) const {
+            if ((flags & round_down) && s.read(1))
+                return low;
+
+            if ((flags & round_up) && s.read(1))
+                return high;
+
+            if ((flags & encode_zero) && s.read(1))
+                return 0.0f;
+
+            return low + (high - low) * static_cast<float>(s.read(bits)) * dec_mul;
+        }
+    };
+
+    /**
+     * Compiled field of a serializer
+     *
+     * Only what's needed to decode values is kept here, names live in separate arrays so a serializer's fields
+     * stay packed into as few cache lines as possible.
+     */
+    struct serializer_field {
+        /** How a path ending at this field is decoded */
+        field_kind kind;
+        /** How the field nests */
+        field_model model;
+        /** Number of values per field, 3 for a Vector or QAngle */
+        uint8_t components;
+        /** Number of bits per angle */
+        uint8_t bits;
+        /** Serializer of tables, element field of arrays */
+        uint32_t child;
+        /** Number of elements of fixed arrays, 0 otherwise */
+        uint32_t size;
+        /** Quantization parameters of quantized floats */
+        uint32_t quantization;
+    };
+
+    /**
+     * Compiled form of a CSVCMsg_FlattenedSerializer
+     *
+     * All fields of all serializers are stored in a single array, the fields of a serializer follow each other.
+     * Types are resolved into a field_kind and nested serializers into their index once, so decoding an entity
+     * only indexes arrays. Array elements get a field of their own which is appended after all serializers.
+     */
+    class flattened_serializer {
+        public:
+            /** Returned by find() if there is no such serializer */
+            static constexpr uint32_t npos = 0xFFFFFFFF;
+
+            /** Compiled serializer */
+            struct serializer {
+                /** Symbol of its name */
+                uint32_t name;
+                /** Version */
+                int32_t version;
+                /** Index of its first field */
+                uint32_t first;
+                /** Number of fields */
+                uint32_t count;
+            };
+
+            /** Compiles msg, throws SerializerInvalid if it references symbols or serializers that don't exist */
+            flattened_serializer(const ps2::CSVCMsg_FlattenedSerializer& msg);
+
+            /**
+             * Whether msg can be compiled without throwing SerializerInvalid.
+             *
+             * Fields with a bit count below 32 have their quantization flags checked whether they turn out to be
+             * floats or not.
+             */
+            static bool valid(const ps2::CSVCMsg_FlattenedSerializer& msg);
+
+            /** Returns the number of serializers */
+            uint32_t size() const {
+                return serializers.size();
+            }
+
+            /** Returns the index of the newest version of the serializer called name, npos if there is none */
+            uint32_t find(const std::string& name) const;
+
+            /** Returns the index of the given version of the serializer called name, npos if there is none */
+            uint32_t find(const std::string& name, int32_t version) const;
+
+            /** Returns serializer i */
+            const serializer& get(const uint32_t i) const {
+                return serializers[i];
+            }
+
+            /** Returns field i */
+            const serializer_field& field(const uint32_t i) const {
+                return fields[i];
+            }
+
+            /** Returns the quantization parameters of field f */
+            const quantized_float& quantization(const serializer_field& f) const {
+                return quantizations[f.quantization];
+            }
+
+            /** Returns the name of serializer s */
+            const std::string& name(const serializer& s) const {
+                return symbols[s.name];
+            }
+
+            /** Returns the name of field i, elements are named after their array */
+            const std::string& field_name(const uint32_t i) const {
+                return symbols[fieldNames[i]];
+            }
+
+            /** Returns the type of field i as sent */
+            const std::string& field_type(const uint32_t i) const {
+                return symbols[fieldTypes[i]];
+            }
+
+            /** Returns the index of the field of serializer s which p leads to, throws SerializerFieldPath if none */
+            uint32_t resolve(const uint32_t s, const field_path& p) const {
+                const serializer& root = serializers[s];
+                if (static_cast<uint32_t>(p[0]) >= root.count)
+                    invalid(s, p);
+
+                uint32_t ret = root.first + p[0];
+                for (uint32_t i = 1; i <= p.last; ++i) {
+                    const serializer_field& f = fields[ret];
+                    const uint32_t idx = p[i];
+
+                    switch (f.model) {
+                        case field_model::fixed_array:
+                            if (idx >= f.size)
+                                invalid(s, p);
+
+                            ret = f.child;
+                            break;
+                        case field_model::dynamic_array:
+                            ret = f.child;
+                            break;
+                        case field_model::table: {
+                            const serializer& child = serializers[f.child];
+                            if (idx >= child.count)
+                                invalid(s, p);
+
+                            ret = child.first + idx;
+                        } break;
+                        default:
+                            invalid(s, p);
+                    }
+                }
+
+                return ret;
+            }
+        private:
+            /** Symbol table of the message */
+            std::vector<std::string> symbols;
+            /** All serializers */
+            std::vector<serializer> serializers;
+            /** Fields of all serializers followed by array elements */
+            std::vector<serializer_field> fields;
+            /** Name symbol of each field */
+            std::vector<uint32_t> fieldNames;
+            /** Type symbol of each field */
+            std::vector<uint32_t> fieldTypes;
+            /** Parameters of all quantized floats */
+            std::vector<quantized_float> quantizations;
+            /** Newest version of each serializer by name */
+            std::unordered_map<std::string, uint32_t> newest;
+
+            /** Throws when p doesn't match serializer s, kept out of line so resolve() stays small */
+            [[noreturn]] void invalid(const uint32_t s, const field_path& p) const;
+
+            /** Returns sym if it's part of the symbol table, throws otherwise */
+            uint32_t symbol(const int32_t sym) const;
+
+            /** Compiles field f of the given type into fields[index], child is its serializer if it has one */
+            void compile(const uint32_t index, const std::string& type, const uint32_t child,
+                const ps2::ProtoFlattenedSerializerField_t& f);
+
+            /** Appends the element field of array parent, returns its index */
+            uint32_t element(const uint32_t parent, const std::string& type, const uint32_t child,
+                const ps2::ProtoFlattenedSerializerField_t& f);
+    };
+}
+
+#endif /* _ALICE_SERIALIZER_HPP_ */
@@ -0,0 +1,152 @@
+/**
+ * @file string_table.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <snappy.h>
+
+#include "proto/source2/demo.pb.h"
+
+#include "util/bitstream.hpp"
+#include "config.hpp"
+#include "string_table.hpp"
+
+namespace alice {
+    namespace {
+        /** Number of previous keys a new key can be based on */
+        constexpr uint32_t key_history = 32;
+    }
+
+    constexpr int32_t string_table::compressed_values;
+
+    string_table::string_table(const wire_create_string_table& msg)
+        : tableName(msg.name.str()), fixedSize(msg.user_data_fixed_size), fixedBits(msg.user_data_size_bits),
+          flags(msg.flags), varintBits(msg.using_varint_bitcounts),
+          maxEntries(msg.max_entries > 0 ? msg.max_entries : 0)
+    {
+        std::vector<uint32_t> changed;
+
+        if (!msg.data_compressed) {
+            read(msg.string_data.data, msg.string_data.size, msg.num_entries, changed);
+            return;
+        }
+
+        std::string data;
+        if (!snappy::Uncompress(msg.string_data.data, msg.string_data.size, &data))
+            ALICE_THROW(StringTableData, tableName << " (table) " << msg.string_data.size << " (compressed size)");
+
+        read(data.data(), data.size(), msg.num_entries, changed);
+    }
+
+    void string_table::update(const wire_update_string_table& msg, std::vector<uint32_t>& changed) {
+        read(msg.string_data.data, msg.string_data.size, msg.num_changed_entries, changed);
+    }
+
+    void string_table::reset(const ps2::CDemoStringTables_table_t& table) {
+        entries.clear();
+        entries.reserve(table.items_size());
+
+        for (const auto& item : table.items())
+            entries.push_back(entry{item.str(), item.data()});
+    }
+
+    void string_table::read(const char* data, std::size_t size, int32_t count, std::vector<uint32_t>& changed) {
+        changed.clear();
+        if (!size)
+            return;
+
+        bitstream s(data, size);
+        std::string keys[key_history];
+        uint32_t keyCount = 0;
+
+        std::vector<char> buffer(ALICE_STRING_TABLE_KEY_SIZE);
+        uint32_t index = static_cast<uint32_t>(-1);
+
+        for (int32_t i = 0; i < count; ++i) {
+            // Either the next entry or an explicit index
+            if (s.read(1)) {
+                ++index;
+            } else {
+                index = s.readVarUInt32() + 1;
+            }
+
+            if (index >= maxEntries)
+                ALICE_THROW(StringTableData, tableName << " (table) " << index << " (index)");
+
+            if (entries.size() <= index)
+                entries.resize(index + 1);
+
+            entry& e = entries[index];
+
+            if (s.read(1)) {
+                std::string key;
+
+                // Prefix of a previous key, counted from the oldest one still kept
+                if (s.read(1)) {
+                    const uint32_t pos = s.read(5);
+                    const uint32_t length = s.read(5);
+
+                    if (pos < keyCount) {
+                        const uint32_t oldest = keyCount > key_history ? keyCount - key_history : 0;
+                        key.assign(keys[(oldest + pos) % key_history], 0, length);
+                    }
+                }
+
+                s.readString(buffer.data(), buffer.size());
+                key += buffer.data();
+                e.key = key;
+
+                keys[keyCount % key_history] = std::move(key);
+                ++keyCount;
+            }
+
+            if (s.read(1)) {
+                bool compressed = false;
+                uint32_t bits;
+
+                if (fixedSize) {
+                    bits = fixedBits;
+                } else {
+                    if (flags & compressed_values)
+                        compressed = s.read(1);
+
+                    bits = (varintBits ? s.readUBitVar() : s.read(17)) * 8;
+                }
+
+                if (bits > s.left())
+                    ALICE_THROW(StringTableData, tableName << " (table) " << bits << " (value bits)");
+
+                std::string value((bits + 7) / 8, '\0');
+                s.readBits(&value[0], bits);
+
+                if (compressed) {
+                    e.value.clear();
+                    if (!snappy::Uncompress(value.data(), value.size(), &e.value))
+                        ALICE_THROW(StringTableData, tableName << " (table) " << index << " (compressed value)");
+                } else {
+                    e.value = std::move(value);
+                }
+            }
+
+            changed.push_back(index);
+        }
+    }
+}
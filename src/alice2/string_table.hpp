@@ -0,0 +1,106 @@
+/**
+ * @file string_table.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_STRING_TABLE_HPP_
+#define _ALICE_STRING_TABLE_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "util/exception.hpp"
+#include "wire.hpp"
+
+namespace alice {
+    namespace ps2 {
+        class CDemoStringTables_table_t;
+    }
+
+    /// Thrown when the entries of a string table can't be read or decompressed
+    ALICE_CREATE_EXCEPTION(StringTableData, "Invalid string table data");
+
+    /**
+     * Entries of a Source 2 string table
+     *
+     * The table is created from a CSVCMsg_CreateStringTable and changed by CSVCMsg_UpdateStringTable. Both send
+     * a list of changed entries, each one optionally with a new key and value. Keys can reuse the beginning
+     * of one of the last 32 keys of the same message.
+     */
+    class string_table {
+        public:
+            /** Values of tables with this flag can be snappy compressed individually */
+            static constexpr int32_t compressed_values = 1;
+
+            /** Single entry */
+            struct entry {
+                /** Key */
+                std::string key;
+                /** Value, binary data */
+                std::string value;
+            };
+
+            /** Creates the table and reads the entries sent with it */
+            string_table(const wire_create_string_table& msg);
+
+            /** Returns the name of the table */
+            const std::string& name() const {
+                return tableName;
+            }
+
+            /** Returns the number of entries */
+            uint32_t size() const {
+                return entries.size();
+            }
+
+            /** Returns entry i */
+            const entry& get(const uint32_t i) const {
+                return entries[i];
+            }
+
+            /** Applies an update, the indices of all entries which were sent are stored in changed */
+            void update(const wire_update_string_table& msg, std::vector<uint32_t>& changed);
+
+            /** Replaces all entries with the ones stored in a full packet, the table keeps its layout */
+            void reset(const ps2::CDemoStringTables_table_t& table);
+        private:
+            /** Name of the table */
+            std::string tableName;
+            /** Whether all values have the same size */
+            bool fixedSize;
+            /** Number of bits per value if they have the same size */
+            uint32_t fixedBits;
+            /** Flags of the table */
+            int32_t flags;
+            /** Whether the size of values is sent as a ubitvar instead of 17 bits */
+            bool varintBits;
+            /** Highest number of entries */
+            uint32_t maxEntries;
+            /** All entries by index */
+            std::vector<entry> entries;
+
+            /** Reads count changed entries from data */
+            void read(const char* data, std::size_t size, int32_t count, std::vector<uint32_t>& changed);
+    };
+}
+
+#endif /* _ALICE_STRING_TABLE_HPP_ */
@@ -1,7 +1,7 @@
 /**
  * @file bitstream.cpp
  * @author Robin Dietrich <me (at) invokr (dot) org>
- * @version 1.3
+ * @version 1.4
  *
  * @par License
  *    Alice Replay Parser
@@ -21,53 +21,131 @@
  */
 
 #include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(ALICE_NO_BMI2)
+#include <immintrin.h>
+/// Whether the pext based varint decoder is compiled in, it's only used if the CPU supports it
+#define ALICE_HAVE_BMI2
+#endif /* __GNUC__ && __x86_64__ */
+
 #include "bitstream.hpp"
 
 namespace alice {
-    namespace detail {
-        constexpr uint64_t masks[64] = {
-                0x0,             0x1,              0x3,              0x7,
-                0xf,             0x1f,             0x3f,             0x7f,
-                0xff,            0x1ff,            0x3ff,            0x7ff,
-                0xfff,           0x1fff,           0x3fff,           0x7fff,
-                0xffff,          0x1ffff,          0x3ffff,          0x7ffff,
-                0xfffff,         0x1fffff,         0x3fffff,         0x7fffff,
-                0xffffff,        0x1ffffff,        0x3ffffff,        0x7ffffff,
-                0xfffffff,       0x1fffffff,       0x3fffffff,       0x7fffffff,
-                0xffffffff,      0x1ffffffff,      0x3ffffffff,      0x7ffffffff,
-                0xfffffffff,     0x1fffffffff,     0x3fffffffff,     0x7fffffffff,
-                0xffffffffff,    0x1ffffffffff,    0x3ffffffffff,    0x7ffffffffff,
-                0xfffffffffff,   0x1fffffffffff,   0x3fffffffffff,   0x7fffffffffff,
-                0xffffffffffff,  0x1ffffffffffff,  0x3ffffffffffff,  0x7ffffffffffff,
-                0xfffffffffffff, 0x1fffffffffffff, 0x3fffffffffffff, 0x7fffffffffffff
-            };
+    namespace {
+        /** Continuation bits of the first 7 bytes */
+        constexpr uint64_t varintStops = 0x0080808080808080ull;
+        /** Payload bits of the first 7 bytes */
+        constexpr uint64_t varintBits = 0x007f7f7f7f7f7f7full;
+
+        /** Returns the number of bytes of the varint at the start of w, 0 if it's longer than 7 bytes */
+        inline uint32_t varint_length(const uint64_t w) {
+            const uint64_t stops = ~w & varintStops;
+            return stops ? (__builtin_ctzll(stops) >> 3) + 1 : 0;
+        }
+
+        /** Collects the 7 bit groups of the first len bytes of w, portable version */
+        inline uint64_t varint_gather(uint64_t w, const uint32_t len) {
+            w &= (static_cast<uint64_t>(1) << (len << 3)) - 1;
+
+            return (w & 0x7f)
+                | ((w >> 1) & (0x7full << 7))
+                | ((w >> 2) & (0x7full << 14))
+                | ((w >> 3) & (0x7full << 21))
+                | ((w >> 4) & (0x7full << 28))
+                | ((w >> 5) & (0x7full << 35))
+                | ((w >> 6) & (0x7full << 42));
+        }
+
+    #ifdef ALICE_HAVE_BMI2
+        /** Collects the 7 bit groups of the first len bytes of w with a single pext */
+        __attribute__((target("bmi2")))
+        uint64_t varint_gather_bmi2(const uint64_t w, const uint32_t len) {
+            return _pext_u64(w, varintBits & ((static_cast<uint64_t>(1) << (len << 3)) - 1));
+        }
+
+        /** Whether the CPU supports pext, checked once */
+        bool has_bmi2() {
+            static const bool supported = __builtin_cpu_supports("bmi2");
+            return supported;
+        }
+    #endif /* ALICE_HAVE_BMI2 */
+
+        /** Decodes the varint of len bytes at the start of w */
+        inline uint64_t varint_decode(const uint64_t w, const uint32_t len) {
+        #ifdef ALICE_HAVE_BMI2
+            if (has_bmi2())
+                return varint_gather_bmi2(w, len);
+        #endif /* ALICE_HAVE_BMI2 */
+
+            return varint_gather(w, len);
+        }
+
+        /** Returns a word with the high bit set in every zero byte of the first 7 bytes of w */
+        inline uint64_t zero_bytes(const uint64_t w) {
+            return (w - 0x0001010101010101ull) & ~w & varintStops;
+        }
     }
 
-    uint32_t bitstream::read(const bitstream::size_type n) {
-        // make sure the data read fits the return type
-        if (n > size-pos)
-            ALICE_THROW( bitstreamDataSize, pos << " (position) " << size << " (size) " << n << " (reading)");
+    template <typename Policy>
+    void basic_bitstream<Policy>::overflow(const size_type n) const {
+        ALICE_THROW( bitstreamDataSize, pos << " (position) " << size << " (size) " << n << " (reading)");
+    }
 
-        if (n > 32)
-            ALICE_THROW( bitstreamDataSize, size);
+    template <typename Policy>
+    uint32_t basic_bitstream<Policy>::readVarUInt32() {
+        // Byte aligned with enough data left for the unchecked decoder
+        if ((pos & 7) == 0 && left() >= (VARINT32_MAX << 3)) {
+            uint32_t value;
+            const uint8_t* start = data + (pos >> 3);
+            const uint8_t* end = readVarUInt32_fast(const_cast<uint8_t*>(start), value);
 
-        static constexpr uint32_t bitSize = sizeof(uint32_t) << 3; // size of chunk in bits
-        const uint32_t start   = pos / bitSize;           // current active chunk
-        const uint32_t end     = (pos + n - 1) / bitSize; // next chunk if data needs to be wrapped
-        const uint32_t shift   = (pos % bitSize);         // shift amount
-        uint32_t ret;                                     // return value
+            if (end) {
+                skip((end - start) << 3);
+                return value;
+            }
+        }
 
-        if (start == end) {
-            ret = (data[start] >> shift) & detail::masks[n];
-        } else { // wrap around
-            ret = ((data[start] >> shift) | (data[end] << (bitSize - shift))) & detail::masks[n];
+        // Anywhere else, decode the next 5 bytes at once
+        const uint64_t w = peek(VARINT32_MAX << 3);
+        const uint32_t len = varint_length(w);
+
+        if (len && len <= VARINT32_MAX && (len << 3) <= left()) {
+            skip(len << 3);
+            return static_cast<uint32_t>(varint_decode(w, len));
         }
 
-        pos += n;
-        return ret;
+        // Longer than 5 bytes or running into the end of the stream
+        return readVarUInt32_bytes();
     }
 
-    uint32_t bitstream::readVarUInt32() {
+    template <typename Policy>
+    uint64_t basic_bitstream<Policy>::readVarUInt64() {
+        if ((pos & 7) == 0 && left() >= (VARINT64_MAX << 3)) {
+            uint64_t value;
+            const uint8_t* start = data + (pos >> 3);
+            const uint8_t* end = readVarUInt64_fast(const_cast<uint8_t*>(start), value);
+
+            if (end) {
+                skip((end - start) << 3);
+                return value;
+            }
+        }
+
+        // Up to 7 bytes fit into a single peek
+        const uint64_t w = peek(peek_max);
+        const uint32_t len = varint_length(w);
+
+        if (len && (len << 3) <= left()) {
+            skip(len << 3);
+            return varint_decode(w, len);
+        }
+
+        return readVarUInt64_bytes();
+    }
+
+    template <typename Policy>
+    uint32_t basic_bitstream<Policy>::readVarUInt32_bytes() {
         uint32_t readCount = 0;
         uint32_t value = 0;
 
@@ -84,7 +162,8 @@ namespace alice {
         return value;
     }
 
-    uint64_t bitstream::readVarUInt64() {
+    template <typename Policy>
+    uint64_t basic_bitstream<Policy>::readVarUInt64_bytes() {
         uint32_t readCount = 0;
         uint64_t value = 0;
 
@@ -101,8 +180,51 @@ namespace alice {
         return value;
     }
 
-    void bitstream::readString(char *buffer, const bitstream::size_type n) {
-        for (std::size_t i = 0; i < n; ++i) {
+    template <typename Policy>
+    void basic_bitstream<Policy>::readString(char *buffer, const size_type n) {
+        std::size_t i = 0;
+
+        if ((pos & 7) == 0) {
+            // Search the terminator in place
+            const size_type avail = left() >> 3;
+            const size_type count = n < avail ? n : avail;
+            const char* start = reinterpret_cast<const char*>(data + (pos >> 3));
+            const char* term = static_cast<const char*>(memchr(start, '\0', count));
+
+            if (term) {
+                const size_type len = (term - start) + 1;
+                memcpy(buffer, start, len);
+                skip(len << 3);
+                return;
+            }
+
+            if (n <= avail) {
+                memcpy(buffer, start, n);
+                skip(n << 3);
+                buffer[n - 1] = '\0';
+                return;
+            }
+        } else {
+            // 7 bytes at a time as long as they are there
+            while (i + 7 <= n && left() >= 56) {
+                const uint64_t w = peek(56);
+                const uint64_t zeros = zero_bytes(w);
+
+                if (zeros) {
+                    const size_type len = (__builtin_ctzll(zeros) >> 3) + 1;
+                    memcpy(buffer + i, &w, len);
+                    skip(len << 3);
+                    return;
+                }
+
+                memcpy(buffer + i, &w, 7);
+                skip(56);
+                i += 7;
+            }
+        }
+
+        // Close to the end of the stream or the buffer
+        for (; i < n; ++i) {
             buffer[i] = static_cast<char>(read(8));
 
             if (buffer[i] == '\0')
@@ -112,10 +234,28 @@ namespace alice {
         buffer[n - 1] = '\0';
     }
 
-    void bitstream::readBits(char *buffer, const bitstream::size_type n) {
+    template <typename Policy>
+    void basic_bitstream<Policy>::readBits(char *buffer, const size_type n) {
         size_type remaining = n;
         size_type i = 0;
 
+        if (n <= left()) {
+            if ((pos & 7) == 0) {
+                // Copy all whole bytes at once
+                i = n >> 3;
+                memcpy(buffer, data + (pos >> 3), i);
+                skip(i << 3);
+                remaining -= i << 3;
+            } else {
+                while (remaining >= 56) {
+                    const uint64_t w = read64(56);
+                    memcpy(buffer + i, &w, 7);
+                    i += 7;
+                    remaining -= 56;
+                }
+            }
+        }
+
         while (remaining >= 8) {
             buffer[i++] = read(8);
             remaining -= 8;
@@ -124,4 +264,7 @@ namespace alice {
         if (remaining > 0)
             buffer[i++] = read(remaining);
     }
+
+    template class basic_bitstream<bitstream_checked>;
+    template class basic_bitstream<bitstream_unchecked>;
 }
\ No newline at end of file
@@ -1,7 +1,7 @@
 /**
  * @file bitstream.hpp
  * @author Robin Dietrich <me (at) invokr (dot) org>
- * @version 1.3
+ * @version 1.4
  *
  * @par License
  *    Alice Replay Parser
@@ -33,9 +33,14 @@
 #define VARINT64_MAX 10
 
 #include <string>
+#include <utility>
 #include <vector>
+#include <cstdint>
+#include <cstring>
 
 #include "exception.hpp"
+#include "expect.hpp"
+#include "varint.hpp"
 
 namespace alice {
     /// Thrown when the stream overflows
@@ -43,49 +48,113 @@ namespace alice {
     /// Thrown when data submited is to large
     ALICE_CREATE_EXCEPTION( bitstreamDataSize, "Data submitted is to large");
 
-    /** Read-Only bitstream implementation */
-    class bitstream {
+    /** Bounds policy which throws bitstreamDataSize when reading past the end of the stream */
+    struct bitstream_checked {
+        /** Returns whether n bits can be read when at most max are allowed at once and left are there */
+        static bool fits(const std::size_t n, const std::size_t max, const std::size_t left) {
+            return expect(n <= max && n <= left);
+        }
+    };
+
+    /**
+     * Bounds policy for data which has been validated beforehand
+     *
+     * Reads are not checked at all and compile down to the shifts on the cache. Reading past the end
+     * returns 0 bits and leaves the stream in an undefined position, the caller has to make sure the data
+     * covers everything that is read, e.g. by checking the size of a message once before parsing it.
+     */
+    struct bitstream_unchecked {
+        /** Always true */
+        static constexpr bool fits(const std::size_t, const std::size_t, const std::size_t) {
+            return true;
+        }
+    };
+
+    /**
+     * Read-Only bitstream implementation
+     *
+     * The stream either owns a copy of its data or reads from a buffer owned by someone else. Bits are
+     * served from a 64 bit buffer which is refilled with a single unaligned load whenever it runs low,
+     * without branching on how many bytes are taken. Reads never touch memory past the end of the data,
+     * the last bytes are assembled one by one. Data is expected to be little endian.
+     *
+     * Policy decides whether reads are checked against the end of the stream, see bitstream_checked and
+     * bitstream_unchecked.
+     */
+    template <typename Policy>
+    class basic_bitstream {
         public:
             /** Type used to keep track of the stream position */
             typedef std::size_t size_type;
 
+            /** Maximum number of bits returned by peek(), a refill guarantees at least this many */
+            static constexpr size_type peek_max = 56;
+
             /** Creates an empty bitstream */
-            bitstream() : data{}, pos{0}, size{0} { }
+            basic_bitstream() : owned{}, data{nullptr}, pos{0}, size{0}, next{0}, cache{0}, cached{0} { }
 
-            /** Creates a bitstream from a std::string */
-            bitstream(const std::string &str) : data{}, pos{0}, size{str.size() << 3} {
-                if (size > 0xffffffff)
-                    ALICE_THROW( bitstreamDataSize, size);
+            /** Creates a bitstream from a copy of a std::string */
+            basic_bitstream(const std::string &str)
+                : owned(str.begin(), str.end()), data{nullptr}, pos{0}, size{0}, next{0}, cache{0}, cached{0}
+            {
+                check(str.size());
+                data = reinterpret_cast<const uint8_t*>(owned.data());
+                size = str.size() << 3;
+                sync();
+            }
 
-                // Reserve the memory in beforehand so we can just memcpy everything
-                data.resize((str.size() + 3) / 4 + 1);
-                memcpy(&data[0], str.c_str(), str.size());
+            /** Creates a bitstream reading the n bytes at buffer in place, buffer has to outlive the stream */
+            basic_bitstream(const char* buffer, std::size_t n)
+                : owned{}, data{reinterpret_cast<const uint8_t*>(buffer)}, pos{0}, size{0}, next{0}, cache{0},
+                  cached{0}
+            {
+                check(n);
+                size = n << 3;
+                sync();
             }
 
-            /** Copy-Constructor */
-            bitstream(const bitstream& b) : data(b.data), pos(b.pos), size(b.size) {}
+            /** Copy-Constructor, copies owned data and shares external buffers */
+            basic_bitstream(const basic_bitstream& b)
+                : owned(b.owned), data(b.data), pos(b.pos), size(b.size), next(b.next), cache(b.cache),
+                  cached(b.cached)
+            {
+                if (!owned.empty())
+                    data = reinterpret_cast<const uint8_t*>(owned.data());
+            }
 
             /** Move-Constructor */
-            bitstream(bitstream&& b) : data(std::move(b.data)), pos(b.pos), size(b.size) {
-                b.data.clear();
+            basic_bitstream(basic_bitstream&& b)
+                : owned(std::move(b.owned)), data(b.data), pos(b.pos), size(b.size), next(b.next), cache(b.cache),
+                  cached(b.cached)
+            {
+                // Moving the vector keeps its memory, data stays valid
+                b.owned.clear();
+                b.data = nullptr;
                 b.pos = 0;
                 b.size = 0;
+                b.next = 0;
+                b.cache = 0;
+                b.cached = 0;
             }
 
             /** Destructor */
-            ~bitstream() = default;
+            ~basic_bitstream() = default;
 
             /** Assignment operator */
-            bitstream& operator= (bitstream t) {
+            basic_bitstream& operator= (basic_bitstream t) {
                 swap(t);
                 return *this;
             }
 
             /** Swap this bitstream with given one */
-            void swap(bitstream& b) {
+            void swap(basic_bitstream& b) {
+                std::swap(owned, b.owned);
                 std::swap(data, b.data);
                 std::swap(pos, b.pos);
                 std::swap(size, b.size);
+                std::swap(next, b.next);
+                std::swap(cache, b.cache);
+                std::swap(cached, b.cached);
             }
 
             /** Checkes whether there is still data left to be read. */
@@ -111,15 +180,55 @@ namespace alice {
             /** Sets bitstream position */
             inline void setPosition(size_t s) {
                 pos = s;
+                sync();
             }
 
             /**
              * Returns result of reading n bits into an uint32_t.
              *
-             * This function can read a maximum of 32 bits at once. If the amount of data requested
-             * exceeds the remaining size of the current chunk it wraps around to the next one.
+             * This function can read a maximum of 32 bits at once, reading past the end of the stream
+             * throws if the stream is checked.
              */
-            uint32_t read(const size_type n);
+            uint32_t read(const size_type n) {
+                if (!Policy::fits(n, 32, size - pos))
+                    overflow(n);
+
+                return static_cast<uint32_t>(take(n));
+            }
+
+            /** Returns result of reading up to 64 bits, see read() */
+            uint64_t read64(const size_type n) {
+                if (!Policy::fits(n, 64, size - pos))
+                    overflow(n);
+
+                if (n <= peek_max)
+                    return take(n);
+
+                // More than a refill guarantees
+                const uint64_t low = take(32);
+                return low | (take(n - 32) << 32);
+            }
+
+            /**
+             * Returns the next n bits without consuming them, n can be up to peek_max.
+             *
+             * Bits past the end of the stream are returned as 0, so table driven decoders can always look at
+             * as many bits as their longest code has. Use consume() once the actual length is known.
+             */
+            uint64_t peek(const size_type n) {
+                if (cached < n)
+                    refill();
+
+                return cache & mask(n);
+            }
+
+            /** Consumes n bits, usually after looking at them with peek(), see read() */
+            void consume(const size_type n) {
+                if (!Policy::fits(n, n, size - pos))
+                    overflow(n);
+
+                skip(n);
+            }
 
             /**
              * Seek n bits forward.
@@ -127,10 +236,7 @@ namespace alice {
              * If the resulting position would overflow, it is set to the maximum one possible.
              */
             void seekForward(const size_type n) {
-                pos += n;
-
-                if (pos > size)
-                    pos = size;
+                skip(n < size - pos ? n : size - pos);
             }
 
             /**
@@ -144,13 +250,16 @@ namespace alice {
                 } else {
                     pos -= n;
                 }
+
+                sync();
             }
 
             /**
              * Reads a variable sized uint32_t from the stream.
              *
              * A variable int is read in chunks of 8. The first 7 bits are added to return value
-             * while the last bit is the indicator whether to continue reading.
+             * while the last bit is the indicator whether to continue reading. Byte aligned varints are
+             * decoded straight from memory, unaligned ones from a single 64 bit read.
              */
             uint32_t readVarUInt32();
 
@@ -174,6 +283,70 @@ namespace alice {
                 return (value >> 1) ^ -static_cast<int64_t>(value & 1);
             }
 
+            /**
+             * Reads a variable sized uint32_t with a 2 bit length header.
+             *
+             * The lower 4 bits are stored directly after the header, the header then decides whether 0, 4, 8
+             * or 28 further bits follow.
+             */
+            uint32_t readUBitVar() {
+                const uint32_t ret = read(6);
+
+                switch (ret & 0x30) {
+                    case 0x10:
+                        return (ret & 15) | (read(4) << 4);
+                    case 0x20:
+                        return (ret & 15) | (read(8) << 4);
+                    case 0x30:
+                        return (ret & 15) | (read(28) << 4);
+                    default:
+                        return ret;
+                }
+            }
+
+            /**
+             * Reads a variable sized uint32_t as used by field paths.
+             *
+             * Each set prefix bit selects the next larger width out of 2, 4, 10, 17 and 31 bits.
+             */
+            uint32_t readUBitVarFP() {
+                if (read(1)) return read(2);
+                if (read(1)) return read(4);
+                if (read(1)) return read(10);
+                if (read(1)) return read(17);
+                return read(31);
+            }
+
+            /**
+             * Reads a world coordinate.
+             *
+             * Two bits tell whether an integer and a fractional part follow, a sign bit precedes them if either
+             * does. The integer part is stored minus 1 in 14 bits, the fraction in 5 bits as 1/32 steps.
+             */
+            float readCoord() {
+                const uint32_t integer = read(1);
+                const uint32_t fraction = read(1);
+
+                if (!integer && !fraction)
+                    return 0.0f;
+
+                const uint32_t sign = read(1);
+                float ret = 0.0f;
+
+                if (integer)
+                    ret += read(14) + 1;
+
+                if (fraction)
+                    ret += read(5) * (1.0f / 32.0f);
+
+                return sign ? -ret : ret;
+            }
+
+            /** Reads an angle in degrees stored as n bits steps of a full circle */
+            float readAngle(const size_type n) {
+                return read(n) * 360.0f / static_cast<float>(static_cast<uint64_t>(1) << n);
+            }
+
             /**
              * Reads a null-terminated string into the buffer, stops once it reaches \0 or n chars.
              *
@@ -187,17 +360,122 @@ namespace alice {
              * Reads the exact number of bits into the buffer.
              *
              * The function reads in chunks of 8 bit until n is smaller than that
-             * and appends the left over bits
+             * and appends the left over bits. Whole bytes are copied at once if the stream is byte
+             * aligned, 7 at a time otherwise.
              */
             void readBits(char *buffer, const size_type n);
         private:
-            /** Data to read from */
-            std::vector<uint32_t> data;
-            /** Current position in the vector in bits */
+            /** Copy of the data if the stream owns it */
+            std::vector<char> owned;
+            /** Data to read from, either owned or an external buffer */
+            const uint8_t* data;
+            /** Current position in the data in bits */
             size_type pos;
             /** Overall size of the data in bits */
             size_type size;
+            /** Next byte to load into the cache */
+            size_type next;
+            /** Bits starting at pos, the lowest cached ones are valid */
+            uint64_t cache;
+            /** Number of valid bits in cache */
+            size_type cached;
+
+            /** Reads a varint one byte at a time, handles overlong varints and the end of the stream */
+            uint32_t readVarUInt32_bytes();
+
+            /** Reads a varint one byte at a time, see readVarUInt32_bytes() */
+            uint64_t readVarUInt64_bytes();
+
+            /** Throws when reading n bits fails, kept out of line so reads stay small enough to be inlined */
+            [[noreturn]] void overflow(const size_type n) const;
+
+            /** Returns the 8 bytes starting at byte as a little endian word, bytes past the end are 0 */
+            uint64_t load(const size_type byte) const {
+                const size_type bytes = size >> 3;
+                uint64_t word;
+
+                if (byte + sizeof(word) <= bytes) {
+                    memcpy(&word, data + byte, sizeof(word));
+                    return word;
+                }
+
+                // Close to the end, only read what is there
+                word = 0;
+                for (size_type i = byte; i < bytes; ++i)
+                    word |= static_cast<uint64_t>(data[i]) << ((i - byte) << 3);
+
+                return word;
+            }
+
+            /** Returns a mask for the lowest n bits, n has to be smaller than 64 */
+            static uint64_t mask(const size_type n) {
+                return (static_cast<uint64_t>(1) << n) - 1;
+            }
+
+            /**
+             * Tops up the cache to at least peek_max bits.
+             *
+             * Loads the 8 bytes at next and keeps as many whole bytes as fit. Bits above the valid ones are
+             * loaded again on the next refill with the same value, so they can be or'ed in repeatedly.
+             */
+            void refill() {
+                cache |= load(next) << cached;
+                next += (63 - cached) >> 3;
+                cached |= 56;
+            }
+
+            /** Returns the next n bits and moves past them, n can be up to peek_max */
+            uint64_t take(const size_type n) {
+                if (cached < n)
+                    refill();
+
+                const uint64_t ret = cache & mask(n);
+                cache >>= n;
+                cached -= n;
+                pos += n;
+                return ret;
+            }
+
+            /** Moves n bits forward, pos + n may not exceed size */
+            void skip(const size_type n) {
+                if (n <= cached) {
+                    cache >>= n;
+                    cached -= n;
+                    pos += n;
+                } else {
+                    pos += n;
+                    sync();
+                }
+            }
+
+            /** Refills the cache at pos after it has been moved */
+            void sync() {
+                next = pos >> 3;
+                cache = 0;
+                cached = 0;
+                refill();
+
+                cache >>= pos & 7;
+                cached -= pos & 7;
+            }
+
+            /** Throws if n bytes don't fit into the stream */
+            static void check(std::size_t n) {
+                if (n > (0xffffffff >> 3))
+                    ALICE_THROW( bitstreamDataSize, n << 3);
+            }
     };
+
+    template <typename Policy>
+    constexpr typename basic_bitstream<Policy>::size_type basic_bitstream<Policy>::peek_max;
+
+    /** Bitstream checking each read, used for anything which hasn't been validated */
+    typedef basic_bitstream<bitstream_checked> bitstream;
+    /** Bitstream for data which has been validated as a whole, see bitstream_unchecked */
+    typedef basic_bitstream<bitstream_unchecked> unchecked_bitstream;
+
+    extern template class basic_bitstream<bitstream_checked>;
+    extern template class basic_bitstream<bitstream_unchecked>;
 }
 
 #endif /* _UTIL_BITSTREAM_HPP_ */
\ No newline at end of file
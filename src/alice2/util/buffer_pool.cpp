@@ -0,0 +1,131 @@
+/**
+ * @file buffer_pool.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <utility>
+
+#include "../config.hpp"
+#include "buffer_pool.hpp"
+
+namespace alice {
+    buffer_pool::buffer::buffer(buffer&& b) : ptr(b.ptr), capacity(b.capacity), pool(std::move(b.pool)) {
+        b.ptr = nullptr;
+        b.capacity = 0;
+    }
+
+    buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& b) {
+        std::swap(ptr, b.ptr);
+        std::swap(capacity, b.capacity);
+        std::swap(pool, b.pool);
+        return *this;
+    }
+
+    buffer_pool::buffer::~buffer() {
+        release();
+    }
+
+    void buffer_pool::buffer::reserve(std::size_t n) {
+        if (n <= capacity)
+            return;
+
+        if (!pool)
+            pool = buffer_pool::local();
+
+        release();
+
+        auto mem = pool->take(n);
+        capacity = mem.first;
+        ptr = mem.second;
+    }
+
+    void buffer_pool::buffer::release() {
+        if (ptr)
+            pool->put(capacity, ptr);
+
+        ptr = nullptr;
+        capacity = 0;
+    }
+
+    buffer_pool::buffer_pool() : info{0, 0, 0, 0, 0} {}
+
+    buffer_pool::~buffer_pool() {
+        for (auto &mem : available)
+            delete[] mem.second;
+    }
+
+    buffer_pool::buffer buffer_pool::acquire(std::size_t n) {
+        buffer ret;
+        ret.pool = shared_from_this();
+        ret.reserve(n);
+        return ret;
+    }
+
+    buffer_pool::stats buffer_pool::statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return info;
+    }
+
+    std::shared_ptr<buffer_pool> buffer_pool::local() {
+        // Buffers keep their pool alive, so they can outlive the thread that created them
+        static thread_local std::shared_ptr<buffer_pool> pool = std::make_shared<buffer_pool>();
+        return pool;
+    }
+
+    std::pair<std::size_t, char*> buffer_pool::take(std::size_t n) {
+        std::lock_guard<std::mutex> lock(mutex);
+        info.high_water = std::max(info.high_water, n);
+
+        // Smallest buffer that fits
+        auto it = std::lower_bound(available.begin(), available.end(), std::make_pair(n, static_cast<char*>(nullptr)));
+
+        if (it != available.end()) {
+            auto ret = *it;
+            available.erase(it);
+            ++info.reuses;
+            return ret;
+        }
+
+        // Round up to the next power of two so a slowly growing size doesn't allocate every time
+        std::size_t size = ALICE_BUFFER_POOL_MIN_SIZE;
+        while (size < n)
+            size <<= 1;
+
+        info.allocated += size;
+        info.peak = std::max(info.peak, info.allocated);
+        ++info.allocations;
+
+        return std::make_pair(size, new char[size]);
+    }
+
+    void buffer_pool::put(std::size_t size, char* ptr) {
+        std::lock_guard<std::mutex> lock(mutex);
+        available.insert(std::upper_bound(available.begin(), available.end(), std::make_pair(size, ptr)), std::make_pair(size, ptr));
+
+        // Keep the largest buffers, they are the most expensive to get back
+        if (available.size() > ALICE_BUFFER_POOL_KEEP) {
+            info.allocated -= available.front().first;
+            delete[] available.front().second;
+            available.erase(available.begin());
+        }
+    }
+}
@@ -0,0 +1,123 @@
+/**
+ * @file buffer_pool.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_UTIL_BUFFER_POOL_HPP_
+#define _ALICE_UTIL_BUFFER_POOL_HPP_
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+
+#include "noncopyable.hpp"
+
+namespace alice {
+    /**
+     * Pool of growable byte buffers.
+     *
+     * Buffers are borrowed with acquire() and handed back to the pool when they are destroyed, so
+     * consecutive replays reuse the same allocations. Buffers may be returned from any thread.
+     */
+    class buffer_pool : public std::enable_shared_from_this<buffer_pool>, private noncopyable {
+    public:
+        /** Allocation statistics of a pool */
+        struct stats {
+            /** Largest size ever requested */
+            std::size_t high_water;
+            /** Bytes currently allocated, including buffers kept for reuse */
+            std::size_t allocated;
+            /** Maximum of allocated over the lifetime of the pool */
+            std::size_t peak;
+            /** Number of allocations made */
+            std::size_t allocations;
+            /** Number of requests served from the pool */
+            std::size_t reuses;
+        };
+
+        /** A buffer borrowed from a pool */
+        class buffer : private noncopyable {
+        public:
+            /** Creates an empty buffer not attached to any pool */
+            buffer() : ptr(nullptr), capacity(0), pool(nullptr) {}
+            /** Move constructor */
+            buffer(buffer&& b);
+            /** Move assignment operator */
+            buffer& operator=(buffer&& b);
+            /** Hands the memory back to the pool */
+            ~buffer();
+
+            /** Returns the underlying memory */
+            char* data() {
+                return ptr;
+            }
+
+            /** Returns the number of usable bytes */
+            std::size_t size() const {
+                return capacity;
+            }
+
+            /** Makes sure at least n bytes are usable, the contents are not preserved when growing */
+            void reserve(std::size_t n);
+        private:
+            friend class buffer_pool;
+
+            /** Memory */
+            char* ptr;
+            /** Size of the memory */
+            std::size_t capacity;
+            /** Pool this buffer belongs to */
+            std::shared_ptr<buffer_pool> pool;
+
+            /** Returns the memory to the pool */
+            void release();
+        };
+
+        /** Creates an empty pool */
+        buffer_pool();
+        /** Frees all buffers kept for reuse */
+        ~buffer_pool();
+
+        /** Borrows a buffer with at least n usable bytes */
+        buffer acquire(std::size_t n);
+
+        /** Returns the allocation statistics */
+        stats statistics();
+
+        /** Returns the pool of the calling thread */
+        static std::shared_ptr<buffer_pool> local();
+    private:
+        /** Buffers ready for reuse, sorted by size */
+        std::vector<std::pair<std::size_t, char*>> available;
+        /** Statistics */
+        stats info;
+        /** Guards all members */
+        std::mutex mutex;
+
+        /** Takes memory of at least n bytes from the pool or allocates it */
+        std::pair<std::size_t, char*> take(std::size_t n);
+        /** Puts memory back into the pool */
+        void put(std::size_t size, char* ptr);
+    };
+}
+
+#endif /* _ALICE_UTIL_BUFFER_POOL_HPP_ */
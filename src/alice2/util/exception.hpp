@@ -53,6 +53,7 @@ do {                                     \
 // Conditional block when we want to disable exceptions
 #ifdef ALICE_NO_EXCEPTIONS
 #undef ALICE_THROW
+#include <cstdlib>
 #include <iostream>
 #define ALICE_THROW(__exception, __data)                                \
     do {                                                                \
@@ -76,11 +77,16 @@ namespace alice {
         exception(exception&&) = default;
 
         /** Default destructor */
-        ~exception() = default;
+        virtual ~exception() = default;
 
         /** Default copy assignment operator */
         exception& operator=(const exception&) = default;
 
+        /** Returns the exception message, overridden by exceptions created with ALICE_CREATE_EXCEPTION */
+        virtual const char* what() const throw() {
+            return "alice::exception";
+        }
+
         /** Add data to the exception */
         template <typename T>
         exception& operator<<(T&& data) {
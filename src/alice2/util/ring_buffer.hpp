@@ -0,0 +1,133 @@
+/**
+ * @file ring_buffer.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef _ALICE_UTIL_RING_BUFFER_HPP_
+#define _ALICE_UTIL_RING_BUFFER_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+
+#include "noncopyable.hpp"
+
+namespace alice {
+    /** Fixed size byte queue between a single producer and a single consumer thread */
+    class ring_buffer : private noncopyable {
+    public:
+        /** Creates a ring buffer holding up to size bytes */
+        explicit ring_buffer(std::size_t size) : buffer(size), head(0), count(0), closed(false) {}
+
+        /**
+         * Writes all n bytes, blocks while the buffer is full.
+         *
+         * Returns false if the buffer has been closed before everything could be written.
+         */
+        bool write(const char* data, std::size_t n) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (n > 0) {
+                notFull.wait(lock, [this]() { return closed || count < buffer.size(); });
+
+                if (closed)
+                    return false;
+
+                // Copy up to the end of the buffer, the rest wraps around on the next iteration
+                const std::size_t tail = (head + count) % buffer.size();
+                const std::size_t chunk = std::min(n, std::min(buffer.size() - count, buffer.size() - tail));
+                memcpy(&buffer[tail], data, chunk);
+
+                data += chunk;
+                n -= chunk;
+                count += chunk;
+                notEmpty.notify_one();
+            }
+
+            return true;
+        }
+
+        /**
+         * Reads up to n bytes, blocks until data is available.
+         *
+         * Returns 0 once the buffer has been closed and all data was read.
+         */
+        std::size_t read(char* data, std::size_t n) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [this]() { return closed || count > 0; });
+
+            std::size_t ret = 0;
+            while (n > 0 && count > 0) {
+                const std::size_t chunk = std::min(n, std::min(count, buffer.size() - head));
+                memcpy(data, &buffer[head], chunk);
+
+                head = (head + chunk) % buffer.size();
+                count -= chunk;
+                data += chunk;
+                n -= chunk;
+                ret += chunk;
+            }
+
+            notFull.notify_one();
+            return ret;
+        }
+
+        /** Marks the end of the data, wakes up both sides */
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            notEmpty.notify_all();
+            notFull.notify_all();
+        }
+
+        /** Whether the buffer has been closed, there might still be data left to read */
+        bool is_closed() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return closed;
+        }
+
+        /** Whether the buffer has been closed and all data was read */
+        bool done() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return closed && count == 0;
+        }
+    private:
+        /** Underlying storage */
+        std::vector<char> buffer;
+        /** Read position */
+        std::size_t head;
+        /** Number of bytes stored */
+        std::size_t count;
+        /** Whether the buffer has been closed */
+        bool closed;
+
+        /** Guards all members */
+        std::mutex mutex;
+        /** Signaled when data has been written */
+        std::condition_variable notEmpty;
+        /** Signaled when data has been read */
+        std::condition_variable notFull;
+    };
+}
+
+#endif /* _ALICE_UTIL_RING_BUFFER_HPP_ */
@@ -0,0 +1,212 @@
+/**
+ * @file wire.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include "wire.hpp"
+
+namespace alice {
+    namespace {
+        /** Reads a scalar field, fields with an unexpected wire type are skipped like protobuf does */
+        bool field(wire_reader& r, uint32_t type, uint64_t& value) {
+            if (type != WIRE_VARINT)
+                return r.skip(type);
+
+            return r.varint(value);
+        }
+
+        /** Reads an int32 field, negative values are sign extended to 10 bytes on the wire */
+        bool field(wire_reader& r, uint32_t type, int32_t& value) {
+            uint64_t v = static_cast<uint32_t>(value);
+            if (!field(r, type, v))
+                return false;
+
+            value = static_cast<int32_t>(v);
+            return true;
+        }
+
+        /** Reads an uint32 field */
+        bool field(wire_reader& r, uint32_t type, uint32_t& value) {
+            uint64_t v = value;
+            if (!field(r, type, v))
+                return false;
+
+            value = static_cast<uint32_t>(v);
+            return true;
+        }
+
+        /** Reads a bool field */
+        bool field(wire_reader& r, uint32_t type, bool& value) {
+            uint64_t v = value;
+            if (!field(r, type, v))
+                return false;
+
+            value = v != 0;
+            return true;
+        }
+
+        /** Reads a bytes or string field */
+        bool field(wire_reader& r, uint32_t type, wire_view& value) {
+            if (type != WIRE_BYTES)
+                return r.skip(type);
+
+            return r.bytes(value);
+        }
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_demo_packet& msg) {
+        msg = wire_demo_packet();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            bool ok;
+
+            switch (id) {
+                case 1: ok = field(r, type, msg.sequence_in); break;
+                case 2: ok = field(r, type, msg.sequence_out_ack); break;
+                case 3: ok = field(r, type, msg.data); break;
+                default: ok = r.skip(type); break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_full_packet& msg) {
+        msg = wire_full_packet();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            bool ok;
+
+            switch (id) {
+                case 1: ok = field(r, type, msg.string_table); break;
+                case 2: ok = field(r, type, msg.packet); break;
+                default: ok = r.skip(type); break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_packet_entities& msg) {
+        msg = wire_packet_entities();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            bool ok;
+
+            switch (id) {
+                case 1: ok = field(r, type, msg.max_entries); break;
+                case 2: ok = field(r, type, msg.updated_entries); break;
+                case 3: ok = field(r, type, msg.is_delta); break;
+                case 4: ok = field(r, type, msg.update_baseline); break;
+                case 5: ok = field(r, type, msg.baseline); break;
+                case 6: ok = field(r, type, msg.delta_from); break;
+                case 7: ok = field(r, type, msg.entity_data); break;
+                case 8: ok = field(r, type, msg.pending_full_frame); break;
+                case 9: ok = field(r, type, msg.active_spawngroup_handle); break;
+                default: ok = r.skip(type); break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_create_string_table& msg) {
+        msg = wire_create_string_table();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            bool ok;
+
+            switch (id) {
+                case 1: ok = field(r, type, msg.name); break;
+                case 2: ok = field(r, type, msg.max_entries); break;
+                case 3: ok = field(r, type, msg.num_entries); break;
+                case 4: ok = field(r, type, msg.user_data_fixed_size); break;
+                case 5: ok = field(r, type, msg.user_data_size); break;
+                case 6: ok = field(r, type, msg.user_data_size_bits); break;
+                case 7: ok = field(r, type, msg.flags); break;
+                case 8: ok = field(r, type, msg.string_data); break;
+                case 9: ok = field(r, type, msg.uncompressed_size); break;
+                case 10: ok = field(r, type, msg.data_compressed); break;
+                case 11: ok = field(r, type, msg.using_varint_bitcounts); break;
+                default: ok = r.skip(type); break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_update_string_table& msg) {
+        msg = wire_update_string_table();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            bool ok;
+
+            switch (id) {
+                case 1: ok = field(r, type, msg.table_id); break;
+                case 2: ok = field(r, type, msg.num_changed_entries); break;
+                case 3: ok = field(r, type, msg.string_data); break;
+                default: ok = r.skip(type); break;
+            }
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+
+    bool wire_decode(const char* data, std::size_t size, wire_send_tables& msg) {
+        msg = wire_send_tables();
+        wire_reader r(data, size);
+
+        uint32_t id, type;
+        while (r.next(id, type)) {
+            const bool ok = id == 1 ? field(r, type, msg.data) : r.skip(type);
+
+            if (!ok)
+                return false;
+        }
+
+        return !r.error();
+    }
+}
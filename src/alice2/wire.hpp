@@ -0,0 +1,275 @@
+/**
+ * @file wire.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_WIRE_HPP_
+#define _ALICE_WIRE_HPP_
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "util/varint.hpp"
+
+namespace alice {
+    /** Bytes inside a buffer owned by someone else, only valid as long as that buffer is */
+    struct wire_view {
+        const char* data;
+        std::size_t size;
+
+        /** Returns a copy of the bytes */
+        std::string str() const {
+            return std::string(data, size);
+        }
+    };
+
+    /** Protobuf wire types, groups are not supported */
+    enum wire_type {
+        WIRE_VARINT  = 0,
+        WIRE_FIXED64 = 1,
+        WIRE_BYTES   = 2,
+        WIRE_FIXED32 = 5
+    };
+
+    /**
+     * Reads the fields of a serialized protobuf message in place.
+     *
+     * Every read is checked against the end of the buffer. Once a read fails, error() is set and all further
+     * reads fail as well.
+     */
+    class wire_reader {
+    public:
+        /** Reads the message in data */
+        wire_reader(const char* data, std::size_t size)
+            : ptr(reinterpret_cast<const uint8_t*>(data)), end(reinterpret_cast<const uint8_t*>(data) + size),
+              failed(false) {}
+
+        /** Reads the key of the next field, returns false at the end of the message or on error */
+        bool next(uint32_t& field, uint32_t& type) {
+            if (failed || ptr == end)
+                return false;
+
+            uint32_t key;
+            if (!varint32(key))
+                return false;
+
+            field = key >> 3;
+            type  = key & 7;
+
+            if (field == 0)
+                return fail();
+
+            return true;
+        }
+
+        /** Reads a varint of up to 64 bits */
+        bool varint(uint64_t& value) {
+            if (failed)
+                return false;
+
+            // The fast version doesn't check the buffer size, only use it if the longest varint fits
+            if (end - ptr >= 10) {
+                const uint8_t* p = readVarUInt64_fast(const_cast<uint8_t*>(ptr), value);
+                if (!p)
+                    return fail();
+
+                ptr = p;
+                return true;
+            }
+
+            value = 0;
+            for (uint32_t shift = 0; shift < 64 && ptr != end; shift += 7) {
+                const uint8_t b = *(ptr++);
+                value |= static_cast<uint64_t>(b & 0x7F) << shift;
+
+                if (!(b & 0x80))
+                    return true;
+            }
+
+            return fail();
+        }
+
+        /** Reads a varint of up to 32 bits, used for keys and lengths */
+        bool varint32(uint32_t& value) {
+            if (failed)
+                return false;
+
+            if (end - ptr >= 5) {
+                const uint8_t* p = readVarUInt32_fast(const_cast<uint8_t*>(ptr), value);
+                if (!p)
+                    return fail();
+
+                ptr = p;
+                return true;
+            }
+
+            uint64_t v;
+            if (!varint(v) || v > 0xFFFFFFFF)
+                return fail();
+
+            value = static_cast<uint32_t>(v);
+            return true;
+        }
+
+        /** Reads a length delimited field without copying it */
+        bool bytes(wire_view& view) {
+            uint32_t size;
+            if (!varint32(size))
+                return false;
+
+            if (static_cast<std::size_t>(end - ptr) < size)
+                return fail();
+
+            view.data = reinterpret_cast<const char*>(ptr);
+            view.size = size;
+            ptr += size;
+            return true;
+        }
+
+        /** Skips the value of a field of the given wire type */
+        bool skip(uint32_t type) {
+            uint64_t v;
+            wire_view b;
+
+            switch (type) {
+                case WIRE_VARINT:
+                    return varint(v);
+                case WIRE_FIXED64:
+                    return advance(8);
+                case WIRE_BYTES:
+                    return bytes(b);
+                case WIRE_FIXED32:
+                    return advance(4);
+                default:
+                    return fail();
+            }
+        }
+
+        /** Whether a read failed */
+        bool error() const {
+            return failed;
+        }
+    private:
+        /** Current position */
+        const uint8_t* ptr;
+        /** End of the message */
+        const uint8_t* end;
+        /** Set once a read fails */
+        bool failed;
+
+        /** Skips n bytes */
+        bool advance(std::size_t n) {
+            if (failed || static_cast<std::size_t>(end - ptr) < n)
+                return fail();
+
+            ptr += n;
+            return true;
+        }
+
+        /** Marks the reader as failed */
+        bool fail() {
+            failed = true;
+            return false;
+        }
+    };
+
+    /** Fields of a CDemoPacket, data points into the decoded buffer */
+    struct wire_demo_packet {
+        int32_t sequence_in;
+        int32_t sequence_out_ack;
+        wire_view data;
+    };
+
+    /** Fields of a CDemoFullPacket, both messages point into the decoded buffer */
+    struct wire_full_packet {
+        /** Serialized CDemoStringTables */
+        wire_view string_table;
+        /** Serialized CDemoPacket */
+        wire_view packet;
+    };
+
+    /** Fields of a CSVCMsg_PacketEntities, entity_data points into the decoded buffer */
+    struct wire_packet_entities {
+        int32_t max_entries;
+        int32_t updated_entries;
+        bool is_delta;
+        bool update_baseline;
+        int32_t baseline;
+        int32_t delta_from;
+        wire_view entity_data;
+        bool pending_full_frame;
+        uint32_t active_spawngroup_handle;
+    };
+
+    /** Fields of a CSVCMsg_CreateStringTable, name and string_data point into the decoded buffer */
+    struct wire_create_string_table {
+        wire_view name;
+        int32_t max_entries;
+        int32_t num_entries;
+        bool user_data_fixed_size;
+        int32_t user_data_size;
+        int32_t user_data_size_bits;
+        int32_t flags;
+        wire_view string_data;
+        int32_t uncompressed_size;
+        bool data_compressed;
+        /** Field 11, sent by newer servers which store the size of values as a ubitvar */
+        bool using_varint_bitcounts;
+    };
+
+    /** Fields of a CDemoSendTables, data points into the decoded buffer */
+    struct wire_send_tables {
+        wire_view data;
+    };
+
+    /** Fields of a CSVCMsg_UpdateStringTable, string_data points into the decoded buffer */
+    struct wire_update_string_table {
+        int32_t table_id;
+        int32_t num_changed_entries;
+        wire_view string_data;
+    };
+
+    /**
+     * Decodes a CDemoPacket without copying its payload.
+     *
+     * Fields missing from data are set to their defaults, unknown fields are skipped. Returns false if data
+     * is not a valid message. Field numbers are the same for Source 1 and Source 2.
+     */
+    bool wire_decode(const char* data, std::size_t size, wire_demo_packet& msg);
+
+    /** Decodes a CDemoFullPacket without copying the messages it contains */
+    bool wire_decode(const char* data, std::size_t size, wire_full_packet& msg);
+
+    /** Decodes a CSVCMsg_PacketEntities without copying the entity data */
+    bool wire_decode(const char* data, std::size_t size, wire_packet_entities& msg);
+
+    /** Decodes a CSVCMsg_CreateStringTable without copying the table data */
+    bool wire_decode(const char* data, std::size_t size, wire_create_string_table& msg);
+
+    /** Decodes a CSVCMsg_UpdateStringTable without copying the table data */
+    bool wire_decode(const char* data, std::size_t size, wire_update_string_table& msg);
+
+    /** Decodes a CDemoSendTables without copying the serializers */
+    bool wire_decode(const char* data, std::size_t size, wire_send_tables& msg);
+}
+
+#endif /* _ALICE_WIRE_HPP_ */
@@ -0,0 +1,109 @@
+/**
+ * @file batch.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include <alice2/dem_batch.hpp>
+
+using namespace alice;
+
+namespace {
+    /** Packet statistics of a single replay */
+    struct replay_stats {
+        /** Number of packets */
+        uint64_t packets;
+        /** Number of bytes after decompression */
+        uint64_t bytes;
+        /** Tick of the last packet */
+        uint32_t ticks;
+    };
+
+    /** Prints usage information */
+    void show_help(const char* name) {
+        std::cerr << "Usage: " << name << " [-j workers] [replay ...]" << std::endl << std::endl
+                  << "Parses all replays in parallel and prints one line per replay in input order." << std::endl
+                  << "Replay paths are read from stdin if none are given." << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t workers = 0;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-h") == 0) {
+            show_help(argv[0]);
+            return 0;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (!line.empty())
+                paths.push_back(line);
+        }
+    }
+
+    dem_batch<replay_stats> batch(workers);
+    const auto start = std::chrono::steady_clock::now();
+
+    const std::size_t failed = batch.run(paths,
+        [](dem_file& f) {
+            replay_stats ret{0, 0, 0};
+
+            while (f.good()) {
+                dem_packet p = f.get();
+                ++ret.packets;
+                ret.bytes += p.size;
+                ret.ticks = p.tick;
+            }
+
+            return ret;
+        },
+        [](dem_batch<replay_stats>::result& r) {
+            if (r.ok) {
+                std::cout << r.path << "\t" << r.value.packets << "\t" << r.value.bytes << "\t" << r.value.ticks;
+            } else {
+                std::cout << r.path << "\terror\t" << r.error;
+            }
+
+            std::cout << std::endl;
+        }
+    );
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << paths.size() << " replays, " << failed << " failed, " << batch.workers() << " workers, "
+              << seconds << "s" << std::endl;
+
+    return failed ? 1 : 0;
+}
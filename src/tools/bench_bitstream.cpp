@@ -0,0 +1,191 @@
+/**
+ * @file bench_bitstream.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <alice2/util/bitstream.hpp>
+
+using namespace alice;
+
+namespace {
+    /** Bit widths read in a loop, roughly what entity decoding asks for */
+    const uint32_t widths[] = {1, 1, 2, 3, 5, 7, 8, 11, 17, 20, 32, 1, 6, 10, 4, 9};
+    /** Number of widths */
+    const size_t widthCount = sizeof(widths) / sizeof(widths[0]);
+
+    /**
+     * The chunked reader bitstream used before reads were done with 64 bit loads.
+     *
+     * Kept here to measure against, data is copied into 32 bit chunks and every read checks the size twice
+     * and branches on whether the bits span two chunks.
+     */
+    class chunk_reader {
+    public:
+        chunk_reader(const std::string& str) : data((str.size() + 3) / 4 + 1), pos(0), size(str.size() << 3) {
+            memcpy(&data[0], str.data(), str.size());
+        }
+
+        uint32_t read(const size_t n) {
+            if (n > size - pos)
+                abort();
+
+            if (n > 32)
+                abort();
+
+            static constexpr uint32_t bitSize = 32;
+            const uint32_t start = pos / bitSize;
+            const uint32_t end   = (pos + n - 1) / bitSize;
+            const uint32_t shift = pos % bitSize;
+            const uint64_t mask  = (static_cast<uint64_t>(1) << n) - 1;
+            uint32_t ret;
+
+            if (start == end) {
+                ret = (data[start] >> shift) & mask;
+            } else {
+                ret = ((data[start] >> shift) | (data[end] << (bitSize - shift))) & mask;
+            }
+
+            pos += n;
+            return ret;
+        }
+
+        size_t left() const {
+            return size - pos;
+        }
+    private:
+        std::vector<uint32_t> data;
+        size_t pos;
+        size_t size;
+    };
+
+    /** Reads everything from s with read(), returns a checksum so the loop isn't optimized away */
+    template <typename Stream>
+    uint64_t run_read(Stream& s) {
+        uint64_t sum = 0;
+
+        for (size_t i = 0; s.left() >= 32; i = (i + 1) % widthCount)
+            sum += s.read(widths[i]);
+
+        return sum;
+    }
+
+    /** Same as run_read with read64() */
+    uint64_t run_read64(bitstream& s) {
+        uint64_t sum = 0;
+
+        for (size_t i = 0; s.left() >= 32; i = (i + 1) % widthCount)
+            sum += s.read64(widths[i]);
+
+        return sum;
+    }
+
+    /** Looks at the longest width first and consumes the actual one, like a table driven decoder */
+    uint64_t run_peek(bitstream& s) {
+        uint64_t sum = 0;
+
+        for (size_t i = 0; s.left() >= 32; i = (i + 1) % widthCount) {
+            const uint64_t bits = s.peek(32);
+            sum += bits & ((static_cast<uint64_t>(1) << widths[i]) - 1);
+            s.consume(widths[i]);
+        }
+
+        return sum;
+    }
+
+    /** Runs f on a fresh stream rounds times and prints the time per read */
+    template <typename Stream, typename F>
+    uint64_t measure(const char* name, const std::string& data, int rounds, F f) {
+        uint64_t sum = 0;
+        double best = 0;
+
+        for (int r = 0; r < rounds; ++r) {
+            Stream s(data);
+            const auto start = std::chrono::steady_clock::now();
+            sum = f(s);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (r == 0 || seconds < best)
+                best = seconds;
+        }
+
+        // Average number of bits per read
+        double avg = 0;
+        for (auto w : widths)
+            avg += w;
+        avg /= widthCount;
+
+        const double reads = (data.size() * 8) / avg;
+        std::cout << name << "\t" << (best * 1e9 / reads) << " ns/read\t"
+                  << (data.size() / best / (1 << 20)) << " MiB/s" << std::endl;
+
+        return sum;
+    }
+
+    /** Prints usage information */
+    void show_help(const char* name) {
+        std::cerr << "Usage: " << name << " [-s megabytes] [-r rounds]" << std::endl << std::endl
+                  << "Measures reading random data with the different bitstream primitives." << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = 16;
+    int rounds = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            megabytes = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else {
+            show_help(argv[0]);
+            return 0;
+        }
+    }
+
+    std::string data(megabytes << 20, '\0');
+    std::mt19937 rng(42);
+    for (auto &c : data)
+        c = static_cast<char>(rng());
+
+    const uint64_t chunked = measure<chunk_reader>("chunked", data, rounds, [](chunk_reader& s) { return run_read(s); });
+    const uint64_t read    = measure<bitstream>("read", data, rounds, [](bitstream& s) { return run_read(s); });
+    const uint64_t read64  = measure<bitstream>("read64", data, rounds, run_read64);
+    const uint64_t peek    = measure<bitstream>("peek", data, rounds, run_peek);
+    const uint64_t raw     = measure<unchecked_bitstream>("unchecked", data, rounds,
+        [](unchecked_bitstream& s) { return run_read(s); });
+
+    if (chunked != read || read != read64 || read != peek || read != raw) {
+        std::cerr << "Checksums differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+/**
+ * @file bench_field_path.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <alice2/field_path.hpp>
+
+using namespace alice;
+
+namespace {
+    /** Writes bits in the order the bitstream reads them */
+    struct bit_writer {
+        std::string data;
+        size_t pos = 0;
+
+        void write(uint64_t value, size_t n) {
+            for (size_t i = 0; i < n; ++i, ++pos) {
+                if (pos % 8 == 0)
+                    data.push_back('\0');
+
+                data[pos / 8] |= static_cast<char>(((value >> i) & 1) << (pos % 8));
+            }
+        }
+
+        /** Writes a small value the way readUBitVarFP() expects it */
+        void small(uint32_t value) {
+            write(1, 1);
+            write(value, 2);
+        }
+
+        /** Moves to the next byte */
+        void align() {
+            pos = data.size() * 8;
+        }
+    };
+
+    /** Number of levels an op adds, -1 if it needs at least two levels */
+    int depth_change(const field_op op) {
+        switch (op) {
+            case field_op::push_one_left_delta_one_right_zero:
+            case field_op::push_one_left_delta_one_right_non_zero:
+            case field_op::push_one_left_delta_n_right_zero:
+            case field_op::push_one_left_delta_n_right_non_zero:
+            case field_op::push_one_left_delta_n_right_non_zero_pack6_bits:
+            case field_op::push_one_left_delta_n_right_non_zero_pack8_bits:
+            case field_op::push_n_and_non_topological:
+                return 1;
+            case field_op::pop_all_but_one_plus_one:
+            case field_op::pop_all_but_one_plus_n:
+            case field_op::pop_all_but_one_plus_n_pack3_bits:
+            case field_op::pop_all_but_one_plus_n_pack6_bits:
+            case field_op::non_topo_penultimate_plus_one:
+                return -1;
+            default:
+                return 0;
+        }
+    }
+
+    /**
+     * Creates count lists of random field paths, each starting at a byte like in an entity update.
+     *
+     * Ops are picked according to their huffman weights, leaving out the ones which are (almost) never used.
+     */
+    std::string generate(size_t count) {
+        const field_op common[] = {
+            field_op::plus_one, field_op::plus_two, field_op::plus_three, field_op::plus_four, field_op::plus_n,
+            field_op::push_one_left_delta_one_right_zero, field_op::push_one_left_delta_one_right_non_zero,
+            field_op::push_one_left_delta_n_right_zero, field_op::push_one_left_delta_n_right_non_zero,
+            field_op::push_one_left_delta_n_right_non_zero_pack6_bits,
+            field_op::push_one_left_delta_n_right_non_zero_pack8_bits, field_op::push_n_and_non_topological,
+            field_op::pop_all_but_one_plus_one, field_op::pop_all_but_one_plus_n,
+            field_op::pop_all_but_one_plus_n_pack3_bits, field_op::pop_all_but_one_plus_n_pack6_bits,
+            field_op::non_topo_complex, field_op::non_topo_penultimate_plus_one,
+            field_op::non_topo_complex_pack4_bits
+        };
+        const double weights[] = {
+            36271, 10334, 1375, 646, 4128, 521, 2942, 560, 471, 10530, 251, 310, 1837, 149, 300, 634, 76, 271, 99
+        };
+
+        std::mt19937 rng(42);
+        std::discrete_distribution<size_t> pick(std::begin(weights), std::end(weights));
+        std::uniform_int_distribution<uint32_t> length(1, 40);
+
+        bit_writer w;
+        for (size_t l = 0; l < count; ++l) {
+            uint32_t last = 0;
+
+            for (uint32_t n = length(rng); n > 0; --n) {
+                field_op op;
+                do {
+                    op = common[pick(rng)];
+                } while ((depth_change(op) > 0 && last + 1 >= field_path::max_depth) || (depth_change(op) < 0 && last == 0));
+
+                const auto c = field_path_decoder::get().encoding(op);
+                w.write(c.bits, c.length);
+
+                switch (op) {
+                    case field_op::plus_n:
+                    case field_op::push_one_left_delta_one_right_non_zero:
+                    case field_op::push_one_left_delta_n_right_zero:
+                    case field_op::pop_all_but_one_plus_n:
+                        w.small(rng());
+                        break;
+                    case field_op::push_one_left_delta_n_right_non_zero:
+                        w.small(rng());
+                        w.small(rng());
+                        break;
+                    case field_op::push_one_left_delta_n_right_non_zero_pack6_bits:
+                        w.write(rng(), 6);
+                        break;
+                    case field_op::push_one_left_delta_n_right_non_zero_pack8_bits:
+                        w.write(rng(), 8);
+                        break;
+                    case field_op::push_n_and_non_topological:
+                        w.write(0, last + 1);
+                        w.write(1, 6);
+                        w.small(rng());
+                        break;
+                    case field_op::pop_all_but_one_plus_n_pack3_bits:
+                        w.write(rng(), 3);
+                        break;
+                    case field_op::pop_all_but_one_plus_n_pack6_bits:
+                        w.write(rng(), 6);
+                        break;
+                    case field_op::non_topo_complex:
+                    case field_op::non_topo_complex_pack4_bits:
+                        w.write(0, last + 1);
+                        break;
+                    default:
+                        break;
+                }
+
+                if (depth_change(op) > 0)
+                    ++last;
+                else if (depth_change(op) < 0 && op != field_op::non_topo_penultimate_plus_one)
+                    last = 0;
+            }
+
+            const auto c = field_path_decoder::get().encoding(field_op::finish);
+            w.write(c.bits, c.length);
+            w.align();
+        }
+
+        return w.data;
+    }
+
+    /** Sums up the levels so the decoding isn't optimized away */
+    uint64_t checksum(const std::vector<field_path>& paths) {
+        uint64_t sum = 0;
+        for (auto& p : paths) {
+            for (uint32_t i = 0; i <= p.last; ++i)
+                sum = sum * 31 + p.data[i];
+        }
+
+        return sum;
+    }
+
+    /** Decodes all lists walking the huffman tree one bit at a time */
+    uint64_t run_bitwise(bitstream& s, std::vector<field_path>& paths, size_t& ops) {
+        const field_path_decoder& d = field_path_decoder::get();
+        uint64_t sum = 0;
+
+        while (s.left() > 0) {
+            paths.clear();
+            field_path path;
+
+            for (;;) {
+                const field_op op = d.next_bitwise(s);
+                ++ops;
+
+                if (op == field_op::finish)
+                    break;
+
+                field_path_decoder::apply(op, s, path);
+                paths.push_back(path);
+            }
+
+            sum += checksum(paths);
+            s.seekForward((8 - (s.position() & 7)) & 7);
+        }
+
+        return sum;
+    }
+
+    /** Decodes all lists with the lookup table */
+    template <typename Stream>
+    uint64_t run_table(Stream& s, std::vector<field_path>& paths, size_t& ops) {
+        const field_path_decoder& d = field_path_decoder::get();
+        uint64_t sum = 0;
+
+        while (s.left() > 0) {
+            d.read(s, paths);
+            ops += paths.size() + 1;
+
+            sum += checksum(paths);
+            s.seekForward((8 - (s.position() & 7)) & 7);
+        }
+
+        return sum;
+    }
+
+    /** Runs f on a fresh stream rounds times and prints the time per op */
+    template <typename Stream, typename F>
+    uint64_t measure(const char* name, const std::string& data, int rounds, F f) {
+        std::vector<field_path> paths;
+        uint64_t sum = 0;
+        size_t ops = 0;
+        double best = 0;
+
+        for (int r = 0; r < rounds; ++r) {
+            Stream s(data.data(), data.size());
+            ops = 0;
+
+            const auto start = std::chrono::steady_clock::now();
+            sum = f(s, paths, ops);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            if (r == 0 || seconds < best)
+                best = seconds;
+        }
+
+        std::cout << name << "\t" << (best * 1e9 / ops) << " ns/op\t"
+                  << (data.size() / best / (1 << 20)) << " MiB/s" << std::endl;
+
+        return sum;
+    }
+
+    /** Prints usage information */
+    void show_help(const char* name) {
+        std::cerr << "Usage: " << name << " [-n lists] [-r rounds] [-f file]" << std::endl << std::endl
+                  << "Measures decoding field path lists with the lookup table against walking the huffman tree." << std::endl
+                  << "Lists are generated from the op weights unless a file with recorded lists is given, each" << std::endl
+                  << "of them has to start at a byte boundary like in the entity data they have been taken from." << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t lists = 200000;
+    int rounds = 5;
+    const char* file = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            lists = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            file = argv[++i];
+        } else {
+            show_help(argv[0]);
+            return 0;
+        }
+    }
+
+    std::string data;
+    if (file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << "Unable to open " << file << std::endl;
+            return 1;
+        }
+
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else {
+        data = generate(lists);
+    }
+
+    const uint64_t bitwise   = measure<bitstream>("bitwise", data, rounds, run_bitwise);
+    const uint64_t table     = measure<bitstream>("table", data, rounds, run_table<bitstream>);
+    const uint64_t unchecked = measure<unchecked_bitstream>("unchecked", data, rounds, run_table<unchecked_bitstream>);
+
+    if (bitwise != table || table != unchecked) {
+        std::cerr << "Checksums differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
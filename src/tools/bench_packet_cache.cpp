@@ -0,0 +1,239 @@
+/**
+ * @file bench_packet_cache.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <alice2/dem_file.hpp>
+#include <alice2/packets.hpp>
+
+using namespace alice;
+
+namespace {
+    /** Number of allocations made while counting */
+    uint64_t allocations = 0;
+    /** Whether allocations are counted */
+    bool counting = false;
+
+    /** Allocates size bytes and counts the allocation if requested */
+    void* allocate(std::size_t size) {
+        if (counting)
+            ++allocations;
+
+        void* ret = std::malloc(size ? size : 1);
+        if (!ret)
+            std::abort();
+
+        return ret;
+    }
+}
+
+void* operator new(std::size_t size) {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+namespace {
+    /** Serialized message and the function parsing it from the cache */
+    struct message {
+        /** Payload */
+        std::string data;
+        /** Parses data and returns its size, 0 if it couldn't be parsed */
+        uint64_t (*parse)(packet_cache& cache, const std::string& data);
+    };
+
+    /** Parses data as Obj */
+    template <typename Obj, unsigned Type, unsigned Subtype>
+    uint64_t parse(packet_cache& cache, const std::string& data) {
+        Obj* msg = cache.get<Obj>(Type, Subtype, data.data(), data.size());
+        return msg ? msg->ByteSizeLong() : 0;
+    }
+
+    /** Creates count messages of a few types with sizes similar to a replay */
+    std::vector<message> generate(std::size_t count) {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<std::size_t> small(1, 64);
+        std::uniform_int_distribution<std::size_t> large(256, 16384);
+
+        std::vector<message> ret;
+        for (std::size_t i = 0; i < count; ++i) {
+            switch (i % 3) {
+                case 0: {
+                    ps2::CDemoPacket msg;
+                    msg.set_sequence_in(i);
+                    msg.set_data(std::string(large(rng), 'p'));
+                    ret.push_back(message{msg.SerializeAsString(),
+                        parse<ps2::CDemoPacket, PACKET_DEM, ps2::DEM_Packet>});
+                } break;
+                case 1: {
+                    ps2::CSVCMsg_PacketEntities msg;
+                    msg.set_max_entries(2048);
+                    msg.set_updated_entries(small(rng));
+                    msg.set_entity_data(std::string(large(rng), 'e'));
+                    ret.push_back(message{msg.SerializeAsString(),
+                        parse<ps2::CSVCMsg_PacketEntities, PACKET_NET, ps2::svc_PacketEntities>});
+                } break;
+                default: {
+                    ps2::CUserMessageSayText2 msg;
+                    msg.set_messagename(std::string(small(rng), 'm'));
+                    msg.set_param1(std::string(small(rng), 'n'));
+                    ret.push_back(message{msg.SerializeAsString(),
+                        parse<ps2::CUserMessageSayText2, PACKET_USR, ps2::UM_SayText2>});
+                } break;
+            }
+        }
+
+        return ret;
+    }
+
+    /** Parses all messages once, returns the sum of their sizes */
+    uint64_t run_cache(packet_cache& cache, const std::vector<message>& messages, uint64_t& failed) {
+        uint64_t sum = 0;
+        for (auto& m : messages) {
+            const uint64_t size = m.parse(cache, m.data);
+            sum += size;
+            failed += size == 0;
+        }
+
+        return sum;
+    }
+
+    /** Reads f from the start, returns the sum of the packet sizes */
+    uint64_t run_replay(dem_file& f) {
+        uint64_t sum = 0;
+        f.seek(0);
+        while (f.good())
+            sum += f.get().size;
+
+        return sum;
+    }
+
+    /** Prints usage information */
+    void show_help(const char* name) {
+        std::cerr << "Usage: " << name << " [-n messages] [-r rounds] [-f replay]" << std::endl << std::endl
+                  << "Parses messages into a packet_cache after warming it up and fails if that allocates." << std::endl
+                  << "Messages are generated unless a Source 2 replay is given, which is read with" << std::endl
+                  << "dem_file::reuse_messages and subscriptions to a few frequent messages." << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::size_t count = 30000;
+    int rounds = 5;
+    const char* file = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            file = argv[++i];
+        } else {
+            show_help(argv[0]);
+            return 0;
+        }
+    }
+
+    std::vector<message> messages;
+    packet_cache cache(packet_registry_s2());
+    std::unique_ptr<dem_file> replay;
+    uint64_t sum = 0;
+    uint64_t failed = 0;
+
+    if (file) {
+        replay.reset(new dem_file(file));
+        if (replay->version() != engine::two) {
+            std::cerr << "Only Source 2 replays are supported" << std::endl;
+            return 1;
+        }
+
+        replay->reuse_messages(true);
+        replay->subscribe<ps2::CSVCMsg_PacketEntities>(PACKET_NET, ps2::svc_PacketEntities,
+            [&sum](const ps2::CSVCMsg_PacketEntities& msg, uint32_t) { sum += msg.entity_data().size(); });
+        replay->subscribe<ps2::CSVCMsg_UpdateStringTable>(PACKET_NET, ps2::svc_UpdateStringTable,
+            [&sum](const ps2::CSVCMsg_UpdateStringTable& msg, uint32_t) { sum += msg.string_data().size(); });
+        replay->subscribe<ps2::CNETMsg_Tick>(PACKET_NET, ps2::net_Tick,
+            [&sum](const ps2::CNETMsg_Tick& msg, uint32_t) { sum += msg.tick(); });
+
+        // Builds the index as well
+        run_replay(*replay);
+    } else {
+        messages = generate(count);
+        run_cache(cache, messages, failed);
+    }
+
+    // Everything from here on has to reuse what the warm-up allocated
+    double best = 0;
+    counting = true;
+
+    for (int r = 0; r < rounds; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        sum += replay ? run_replay(*replay) : run_cache(cache, messages, failed);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (r == 0 || seconds < best)
+            best = seconds;
+    }
+
+    counting = false;
+
+    if (replay) {
+        std::cout << "replay\t" << (best * 1e3) << " ms/round\t" << sum << " (checksum)" << std::endl;
+    } else {
+        std::cout << "cache\t" << (best * 1e9 / messages.size()) << " ns/message\t" << sum << " (checksum)"
+                  << std::endl;
+    }
+
+    if (failed) {
+        std::cerr << failed << " messages couldn't be parsed" << std::endl;
+        return 1;
+    }
+
+    if (allocations) {
+        std::cerr << allocations << " allocations after the warm-up" << std::endl;
+        return 1;
+    }
+
+    std::cout << "No allocations after the warm-up" << std::endl;
+    return 0;
+}
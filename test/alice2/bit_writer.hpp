@@ -0,0 +1,125 @@
+/**
+ * @file bit_writer.hpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#ifndef _ALICE_TEST_BIT_WRITER_HPP_
+#define _ALICE_TEST_BIT_WRITER_HPP_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem.hpp"
+#include "../../../src/alice2/field_path.hpp"
+
+/** Writes bits in the order the bitstream reads them, used to create test data */
+struct bit_writer {
+    std::string data;
+    size_t pos = 0;
+
+    void write(uint64_t value, size_t n) {
+        for (size_t i = 0; i < n; ++i, ++pos) {
+            if (pos % 8 == 0)
+                data.push_back('\0');
+
+            data[pos / 8] |= static_cast<char>(((value >> i) & 1) << (pos % 8));
+        }
+    }
+
+    void varint(uint64_t value) {
+        do {
+            write((value & 0x7F) | (value > 0x7F ? 0x80 : 0), 8);
+            value >>= 7;
+        } while (value);
+    }
+
+    void zigzag(int64_t value) {
+        varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void ubitvar(uint32_t value) {
+        if (value < 16) {
+            write(value, 6);
+        } else if (value < 256) {
+            write((value & 15) | 0x10, 6);
+            write(value >> 4, 4);
+        } else if (value < 4096) {
+            write((value & 15) | 0x20, 6);
+            write(value >> 4, 8);
+        } else {
+            write((value & 15) | 0x30, 6);
+            write(value >> 4, 28);
+        }
+    }
+
+    /** ubitvar variant used by field path ops */
+    void ubitvar_fp(uint32_t value) {
+        if (value < 4) {
+            write(1, 1);
+            write(value, 2);
+        } else {
+            write(0, 1);
+            write(1, 1);
+            write(value, 4);
+        }
+    }
+
+    void bytes(const std::string& str) {
+        for (char c : str)
+            write(static_cast<uint8_t>(c), 8);
+    }
+
+    /** Null terminated string */
+    void string(const std::string& str) {
+        bytes(str);
+        write(0, 8);
+    }
+
+    void op(alice::field_op o) {
+        const auto c = alice::field_path_decoder::get().encoding(o);
+        write(c.bits, c.length);
+    }
+
+    /** Appends an embedded message the way it's stored in a CDemoPacket */
+    void message(uint32_t type, const std::string& payload) {
+        ubitvar(type);
+        varint(payload.size());
+        bytes(payload);
+    }
+};
+
+/** Appends a single packet to the replay in str */
+inline void append_packet(std::string& str, uint32_t type, uint32_t tick, const std::string& payload) {
+    std::vector<char> buf(payload.size() + 32);
+
+    alice::dem_packet p;
+    p.tick = tick;
+    p.type = type;
+    p.size = payload.size();
+    p.data = const_cast<char*>(payload.data());
+
+    str.append(buf.data(), alice::dem_packet::to_buffer(p, buf.data(), buf.size()));
+}
+
+#endif /* _ALICE_TEST_BIT_WRITER_HPP_ */
@@ -0,0 +1,101 @@
+/**
+ * @file dem_batch.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_batch.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Writes a replay whose last packet is at the given tick */
+    std::string write_replay(uint32_t ticks) {
+        std::string replay("PBDEMS2\0\0\0\0\0", 12);
+        char buf[1024];
+
+        for (uint32_t i = 1; i <= ticks; ++i) {
+            dem_packet p{i, ps2::DEM_ConsoleCmd, 4, const_cast<char*>("tick")};
+            replay.append(buf, dem_packet::to_buffer(p, buf, sizeof(buf)));
+        }
+
+        const std::string path = "alice_test_batch_" + std::to_string(ticks) + ".dem";
+        std::ofstream out(path, std::ofstream::out | std::ofstream::binary);
+        out.write(replay.data(), replay.size());
+        return path;
+    }
+}
+
+TEST_CASE( "dem_batch", "[dem_batch.hpp]" ) {
+    std::vector<std::string> paths;
+    for (uint32_t i = 1; i <= 40; ++i)
+        paths.push_back(write_replay(i * 3));
+
+    // Missing replay in the middle
+    paths.insert(paths.begin() + 7, "alice_test_batch_missing.dem");
+
+    dem_batch<uint32_t> batch(3);
+    REQUIRE(batch.workers() == 3);
+
+    std::vector<dem_batch<uint32_t>::result> results;
+    const std::size_t failed = batch.run(paths,
+        [](dem_file& f) {
+            uint32_t ticks = 0;
+            while (f.good())
+                ticks = f.get().tick;
+
+            return ticks;
+        },
+        [&](dem_batch<uint32_t>::result& r) { results.push_back(r); }
+    );
+
+    REQUIRE(failed == 1);
+    REQUIRE(results.size() == paths.size());
+
+    // Results arrive in input order
+    for (std::size_t i = 0; i < paths.size(); ++i)
+        REQUIRE(results[i].path == paths[i]);
+
+    REQUIRE_FALSE(results[7].ok);
+    REQUIRE_FALSE(results[7].error.empty());
+
+    REQUIRE(results[0].ok);
+    REQUIRE(results[0].value == 3);
+    REQUIRE(results.back().ok);
+    REQUIRE(results.back().value == 120);
+
+    // Errors in the callback stop the batch
+    REQUIRE_THROWS_AS(batch.run(paths,
+        [](dem_file&) { return 0u; },
+        [](dem_batch<uint32_t>::result&) { throw std::runtime_error("stop"); }
+    ), std::runtime_error);
+
+    for (auto &path : paths)
+        std::remove(path.c_str());
+}
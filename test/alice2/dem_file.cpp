@@ -0,0 +1,676 @@
+/**
+ * @file dem_file.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_file.hpp"
+
+#include "bit_writer.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Creates a small source 2 replay with a packet per tick and a full packet every 5 ticks */
+    std::string make_replay(uint32_t ticks) {
+        std::string ret("PBDEMS2\0\0\0\0\0", 12);
+        append_packet(ret, ps2::DEM_FileHeader, 1, "header");
+
+        for (uint32_t i = 1; i <= ticks; ++i) {
+            if (i % 5 == 0)
+                append_packet(ret, ps2::DEM_FullPacket, i, "full");
+
+            append_packet(ret, ps2::DEM_ConsoleCmd, i, "tick");
+        }
+
+        return ret;
+    }
+
+    /** Writes a replay to disk and returns its path */
+    const char* write_replay(const std::string& replay) {
+        static const char* path = "alice_test_replay.dem";
+        std::ofstream out(path, std::ofstream::out | std::ofstream::binary);
+        out.write(replay.data(), replay.size());
+        return path;
+    }
+
+    /** Reads all packets and returns the number of packets read */
+    uint32_t count_packets(dem_file& f) {
+        uint32_t ret = 0;
+        while (f.good()) {
+            f.get();
+            ++ret;
+        }
+
+        return ret;
+    }
+}
+
+TEST_CASE( "dem_file", "[dem_file.hpp]" ) {
+    const char* path = write_replay(make_replay(10));
+
+    // Both loading modes need to produce the same packets
+    dem_file copied(path, dem_load::copy);
+    dem_file mapped(path, dem_load::map);
+
+    REQUIRE(count_packets(copied) == 13);
+    REQUIRE(count_packets(mapped) == 13);
+
+    // Moving a file transfers ownership of the mapping
+    dem_file moved(path, dem_load::map);
+    dem_file target(std::move(moved));
+    REQUIRE(count_packets(target) == 13);
+
+    // Invalid files throw for both modes
+    const char* invalid = write_replay("NOTADEMFILE!");
+    REQUIRE_THROWS_AS(dem_file(invalid, dem_load::copy), DemInvalid);
+    REQUIRE_THROWS_AS(dem_file(invalid, dem_load::map), DemInvalid);
+    REQUIRE_THROWS_AS(dem_file("does_not_exist.dem", dem_load::map), DemFileIO);
+
+    std::remove(path);
+}
+
+TEST_CASE( "dem_file_registry", "[dem_file.hpp]" ) {
+    std::string replay = make_replay(10);
+
+    // Files of the same engine share one list
+    dem_file a(&replay[0], replay.size());
+    dem_file b(&replay[0], replay.size());
+    REQUIRE(a.registry() == packet_registry_s2());
+    REQUIRE(b.registry() == packet_registry_s2());
+
+    // Custom lists are filled and used instead
+    packet_list custom;
+    dem_file c(&replay[0], replay.size(), &custom);
+    REQUIRE(c.registry() == &custom);
+    REQUIRE(count_packets(c) == 13);
+
+    // Many files opened at the same time
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> counts(8, 0);
+
+    for (size_t i = 0; i < counts.size(); ++i) {
+        threads.emplace_back([&replay, &counts, i]() {
+            dem_file f(&replay[0], replay.size());
+            counts[i] = count_packets(f);
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    for (auto n : counts)
+        REQUIRE(n == 13);
+}
+
+TEST_CASE( "dem_file_seek", "[dem_file.hpp]" ) {
+    const char* path = write_replay(make_replay(20));
+    dem_file f(path, dem_load::map);
+
+    // Keyframes at tick 5, 10, 15 and 20
+    REQUIRE(f.index().frames().size() == 4);
+
+    // Seek between two keyframes, the next packet is the preceding full packet
+    REQUIRE(f.seek(12));
+    dem_packet p = f.get();
+    REQUIRE(p.type == ps2::DEM_FullPacket);
+    REQUIRE(p.tick == 10);
+
+    // Seek exactly onto a keyframe
+    REQUIRE(f.seek(15));
+    REQUIRE(f.get().tick == 15);
+
+    // Before the first keyframe we start from the beginning
+    REQUIRE_FALSE(f.seek(3));
+    REQUIRE(f.get().type == ps2::DEM_FileHeader);
+
+    std::remove(path);
+}
+
+TEST_CASE( "dem_file_stored_index", "[dem_file.hpp]" ) {
+    const std::string replay = make_replay(20);
+    const char* path = write_replay(replay);
+    const std::string stored = std::string(path) + ".aidx";
+    std::remove(stored.c_str());
+
+    // Write the index of a scanned file
+    {
+        dem_file f(path);
+        REQUIRE(f.index().packets().size() == 25);
+        f.write_index();
+    }
+
+    // Loading it again yields the same index
+    {
+        dem_file f(path, dem_load::map);
+        const dem_index& idx = f.index();
+        REQUIRE(idx.packets().size() == 25);
+        REQUIRE(idx.frames().size() == 4);
+        REQUIRE(idx.frames()[1].tick == 10);
+
+        REQUIRE(f.seek(12));
+        REQUIRE(f.get().tick == 10);
+    }
+
+    // A stored index only matches the replay it was created from
+    const std::string other = make_replay(30);
+    dem_index idx;
+    REQUIRE(idx.load(stored.c_str(), replay.data(), replay.size()));
+    REQUIRE_FALSE(idx.load(stored.c_str(), other.data(), other.size()));
+
+    // Indices pointing outside of the replay are rejected
+    std::string contents;
+    {
+        std::ifstream in(stored.c_str(), std::ifstream::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    auto tampered = [&](std::size_t pos, const void* value, std::size_t n) {
+        std::string copy = contents;
+        memcpy(&copy[pos], value, n);
+
+        std::ofstream out(stored.c_str(), std::ofstream::binary | std::ofstream::trunc);
+        out.write(copy.data(), copy.size());
+        out.close();
+
+        dem_index i;
+        return i.load(stored.c_str(), replay.data(), replay.size());
+    };
+
+    const uint32_t packets = 0xFFFFFFFF;
+    const uint64_t offset = replay.size();
+    REQUIRE_FALSE(tampered(32, &packets, sizeof(packets)));
+    REQUIRE_FALSE(tampered(40, &offset, sizeof(offset)));
+
+    std::remove(stored.c_str());
+    std::remove(path);
+}
+
+TEST_CASE( "dem_file_stream", "[dem_file.hpp]" ) {
+    const std::string replay = make_replay(20);
+
+    // Feed the replay through a pipe in chunks small enough to split packets
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+
+    bool written = true;
+    std::thread writer([&]() {
+        for (std::size_t i = 0; i < replay.size(); i += 7) {
+            std::size_t n = std::min<std::size_t>(7, replay.size() - i);
+            written &= (write(fds[1], replay.data() + i, n) == static_cast<ssize_t>(n));
+        }
+
+        close(fds[1]);
+    });
+
+    dem_file f(new dem_source_fd(fds[0]));
+    uint32_t ticks = 0;
+    while (f.good()) {
+        dem_packet p = f.get();
+        if (p.type == ps2::DEM_ConsoleCmd) {
+            REQUIRE(p.size == 4);
+            REQUIRE(memcmp(p.data, "tick", 4) == 0);
+            ++ticks;
+        }
+    }
+
+    writer.join();
+    close(fds[0]);
+
+    REQUIRE(written);
+    REQUIRE(ticks == 20);
+    REQUIRE_THROWS_AS(f.seek(10), DemNotSeekable);
+}
+
+TEST_CASE( "dem_file_follow", "[dem_file.hpp]" ) {
+    std::string replay = make_replay(5);
+    append_packet(replay, ps2::DEM_Stop, 6, "");
+
+    // Start with a replay that ends in the middle of a packet
+    const std::size_t split = replay.size() - 10;
+    const char* path = write_replay(replay.substr(0, split));
+
+    dem_file f(new dem_source_fd(path, true));
+    uint32_t packets = 0;
+    while (f.poll()) {
+        f.get();
+        ++packets;
+    }
+
+    // Still recording, no more complete packets
+    REQUIRE(f.good());
+    REQUIRE_FALSE(f.poll());
+
+    // Finish the replay
+    std::ofstream(path, std::ofstream::out | std::ofstream::binary | std::ofstream::app)
+        .write(replay.data() + split, replay.size() - split);
+
+    dem_packet p;
+    while (f.good())
+        p = f.get(), ++packets;
+
+    REQUIRE(p.type == ps2::DEM_Stop);
+    REQUIRE(packets == 8);
+
+    std::remove(path);
+}
+
+TEST_CASE( "dem_file_pipeline", "[dem_file.hpp]" ) {
+    std::string replay = make_replay(50);
+
+    // Append a few compressed packets
+    for (uint32_t i = 51; i <= 60; ++i) {
+        const std::string payload(1000 + i, 'a' + (i % 26));
+
+        dem_packet p;
+        p.tick = i;
+        p.type = ps2::DEM_ConsoleCmd;
+        p.size = payload.size();
+        p.data = const_cast<char*>(payload.data());
+        dem_packet::compress(p);
+
+        char buf[4096];
+        replay.append(buf, dem_packet::to_buffer(p, buf, sizeof(buf)));
+        delete[] p.data;
+    }
+
+    dem_file ref(&replay[0], replay.size());
+    dem_file f(&replay[0], replay.size());
+    f.pipeline(4);
+
+    uint32_t count = 0;
+    while (ref.good()) {
+        REQUIRE(f.good());
+
+        dem_packet a = ref.get();
+        dem_packet b = f.get();
+
+        REQUIRE(a.tick == b.tick);
+        REQUIRE(a.type == b.type);
+        REQUIRE(a.size == b.size);
+        REQUIRE(memcmp(a.data, b.data, a.size) == 0);
+        ++count;
+    }
+
+    REQUIRE_FALSE(f.good());
+    REQUIRE(count == 71);
+
+    // Seeking restarts the pipeline
+    const char* path = write_replay(replay);
+    dem_file s(path);
+    s.pipeline(2);
+    s.get();
+
+    REQUIRE(s.seek(12));
+    REQUIRE(s.get().tick == 10);
+    REQUIRE(s.get().type == ps2::DEM_ConsoleCmd);
+
+    REQUIRE(s.seek(55));
+    REQUIRE(s.get().tick == 50);
+
+    // Turning it off continues at the same position
+    s.pipeline(0);
+    REQUIRE(s.get().tick == 50);
+
+    std::remove(path);
+}
+
+TEST_CASE( "dem_file_large_packet", "[dem_file.hpp]" ) {
+    std::string replay = make_replay(1);
+
+    // Inflates to more than the old fixed snappy buffer
+    const std::string payload(300000, 'x');
+
+    dem_packet p;
+    p.tick = 2;
+    p.type = ps2::DEM_StringTables;
+    p.size = payload.size();
+    p.data = const_cast<char*>(payload.data());
+    dem_packet::compress(p);
+
+    std::string buf(p.size + 32, '\0');
+    replay.append(&buf[0], dem_packet::to_buffer(p, &buf[0], buf.size()));
+    delete[] p.data;
+
+    dem_file f(&replay[0], replay.size());
+    f.get();
+    f.get();
+
+    dem_packet large = f.get();
+    REQUIRE(large.type == ps2::DEM_StringTables);
+    REQUIRE(large.data != nullptr);
+    REQUIRE(large.size == payload.size());
+    REQUIRE(std::string(large.data, large.size) == payload);
+    REQUIRE(buffer_pool::local()->statistics().high_water >= payload.size());
+}
+
+TEST_CASE( "dem_file_segments", "[dem_file.hpp]" ) {
+    std::string replay = make_replay(100);
+    dem_file f(&replay[0], replay.size());
+
+    // Full packets every 5 ticks leave plenty of split points
+    std::vector<dem_segment> parts = f.segments(4);
+    REQUIRE(parts.size() == 4);
+    REQUIRE(parts.front().begin == sizeof(dem_header));
+    REQUIRE(parts.front().tick == 0);
+    REQUIRE(parts.back().end == replay.size());
+
+    // Reading all segments in order yields the same packets as reading the file
+    std::vector<uint32_t> ticks;
+    for (std::size_t i = 0; i < parts.size(); ++i) {
+        if (i > 0)
+            REQUIRE(parts[i].begin == parts[i-1].end);
+
+        dem_file s = f.segment(parts[i]);
+        dem_packet first = s.get();
+        ticks.push_back(first.tick);
+
+        if (i > 0) {
+            REQUIRE(first.type == ps2::DEM_FullPacket);
+            REQUIRE(first.tick == parts[i].tick);
+        }
+
+        while (s.good())
+            ticks.push_back(s.get().tick);
+    }
+
+    std::vector<uint32_t> expected;
+    while (f.good())
+        expected.push_back(f.get().tick);
+
+    REQUIRE(ticks == expected);
+
+    // Can't split a replay without full packets
+    std::string small = make_replay(4);
+    dem_file g(&small[0], small.size());
+    REQUIRE(g.segments(8).size() == 1);
+}
+
+TEST_CASE( "dem_file_subscribe", "[dem_file.hpp]" ) {
+    ps2::CSVCMsg_ServerInfo info;
+    info.set_max_classes(1234);
+
+    ps2::CSVCMsg_SetPause pause;
+    pause.set_paused(true);
+
+    ps2::CUserMessageSayText2 say;
+    say.set_messagename("hello");
+
+    bit_writer w;
+    w.message(ps2::svc_ServerInfo, info.SerializeAsString());
+    w.message(ps2::svc_SetPause, pause.SerializeAsString());
+    w.message(ps2::UM_SayText2, say.SerializeAsString());
+    w.message(ps2::UM_SayText2, say.SerializeAsString());
+
+    ps2::CDemoPacket packet;
+    packet.set_data(w.data);
+    const std::string payload = packet.SerializeAsString();
+
+    std::string replay = make_replay(1);
+    append_packet(replay, ps2::DEM_Packet, 7, payload);
+
+    for (int reuse = 0; reuse < 2; ++reuse) {
+        dem_file f(&replay[0], replay.size());
+        f.reuse_messages(reuse);
+
+        uint32_t classes = 0;
+        uint32_t tick = 0;
+        std::vector<std::string> said;
+
+        f.subscribe<ps2::CSVCMsg_ServerInfo>(PACKET_NET, ps2::svc_ServerInfo,
+            [&](const ps2::CSVCMsg_ServerInfo& m, uint32_t t) { classes = m.max_classes(); tick = t; });
+        f.subscribe<ps2::CUserMessageSayText2>(PACKET_USR, ps2::UM_SayText2,
+            [&](const ps2::CUserMessageSayText2& m, uint32_t) { said.push_back(m.messagename()); });
+        f.subscribe<ps2::CUserMessageSayText2>(PACKET_USR, ps2::UM_SayText2,
+            [&](const ps2::CUserMessageSayText2& m, uint32_t) { said.push_back(m.messagename() + "!"); });
+
+        while (f.good())
+            f.get();
+
+        REQUIRE(classes == 1234);
+        REQUIRE(tick == 7);
+        REQUIRE(said == (std::vector<std::string>{"hello", "hello!", "hello", "hello!"}));
+    }
+}
+
+namespace {
+    /** Creates a source 1 replay with a single packet containing the messages in w */
+    std::string make_replay_s1(const bit_writer& w) {
+        ps1::CDemoPacket packet;
+        packet.set_data(w.data);
+
+        std::string ret("PBUFDEM\0\0\0\0\0", 12);
+        append_packet(ret, ps1::DEM_FileHeader, 1, "header");
+        append_packet(ret, ps1::DEM_Packet, 2, packet.SerializeAsString());
+        return ret;
+    }
+}
+
+TEST_CASE( "dem_file_subscribe_s1", "[dem_file.hpp]" ) {
+    ps1::CNETMsg_SignonState signon;
+    signon.set_signon_state(6);
+
+    bit_writer w;
+    w.message(ps1::net_SignonState, signon.SerializeAsString());
+    std::string replay = make_replay_s1(w);
+
+    // CUserMsg_GameTitle shares its id with CNETMsg_SignonState, subscriptions to both are kept apart
+    dem_file f(&replay[0], replay.size());
+    uint32_t state = 0;
+    uint32_t titles = 0;
+
+    f.subscribe<ps1::CNETMsg_SignonState>(PACKET_NET, ps1::net_SignonState,
+        [&](const ps1::CNETMsg_SignonState& m, uint32_t) { state = m.signon_state(); });
+    f.subscribe<ps1::CUserMsg_GameTitle>(PACKET_USR, ps1::UM_GameTitle,
+        [&](const ps1::CUserMsg_GameTitle&, uint32_t) { ++titles; });
+
+    while (f.good())
+        f.get();
+
+    // Embedded messages are always net messages in source 1
+    REQUIRE(state == 6);
+    REQUIRE(titles == 0);
+}
+
+namespace {
+    /** Typed handler for dem_file::get */
+    struct typed_handler {
+        uint32_t classes = 0;
+        uint32_t tick = 0;
+        std::vector<std::string> said;
+
+        void on(const ps2::CSVCMsg_ServerInfo& m, uint32_t t) {
+            classes = m.max_classes();
+            tick = t;
+        }
+
+        void on(const ps2::CUserMessageSayText2& m, uint32_t) {
+            said.push_back(m.messagename());
+        }
+    };
+}
+
+TEST_CASE( "dem_file_dispatch", "[dem_file.hpp]" ) {
+    ps2::CSVCMsg_ServerInfo info;
+    info.set_max_classes(99);
+
+    ps2::CUserMessageSayText2 say;
+    say.set_messagename("typed");
+
+    bit_writer w;
+    w.message(ps2::svc_SetPause, "");
+    w.message(ps2::svc_ServerInfo, info.SerializeAsString());
+    w.message(ps2::UM_SayText2, say.SerializeAsString());
+
+    ps2::CDemoPacket packet;
+    packet.set_data(w.data);
+
+    std::string replay = make_replay(1);
+    append_packet(replay, ps2::DEM_Packet, 3, packet.SerializeAsString());
+
+    dem_file f(&replay[0], replay.size());
+    typed_handler h;
+
+    while (f.good())
+        f.get(h);
+
+    REQUIRE(h.classes == 99);
+    REQUIRE(h.tick == 3);
+    REQUIRE(h.said == std::vector<std::string>{"typed"});
+}
+
+namespace {
+    /** Source 1 handler, CUserMsg_GameTitle shares its id with CNETMsg_SignonState */
+    struct s1_handler {
+        uint32_t ticks = 0;
+        uint32_t titles = 0;
+
+        void on(const ps1::CNETMsg_Tick&, uint32_t) {
+            ++ticks;
+        }
+
+        void on(const ps1::CUserMsg_GameTitle&, uint32_t) {
+            ++titles;
+        }
+    };
+}
+
+TEST_CASE( "dem_file_dispatch_s1", "[dem_file.hpp]" ) {
+    ps1::CNETMsg_SignonState signon;
+    signon.set_signon_state(6);
+
+    ps1::CNETMsg_Tick tick;
+    tick.set_tick(2);
+
+    bit_writer w;
+    w.message(ps1::net_SignonState, signon.SerializeAsString());
+    w.message(ps1::net_Tick, tick.SerializeAsString());
+    std::string replay = make_replay_s1(w);
+
+    dem_file f(&replay[0], replay.size());
+    s1_handler h;
+
+    while (f.good())
+        f.get(h);
+
+    // Embedded messages are always net messages in source 1
+    REQUIRE(h.ticks == 1);
+    REQUIRE(h.titles == 0);
+}
+
+TEST_CASE( "dem_file_send_tables", "[dem_file.hpp]" ) {
+    ps2::CSVCMsg_FlattenedSerializer msg;
+    msg.add_symbols("CDOTA_Item");
+    msg.add_symbols("int32");
+    msg.add_symbols("m_iCharges");
+
+    auto s = msg.add_serializers();
+    s->set_serializer_name_sym(0);
+    s->set_serializer_version(0);
+
+    auto field = s->add_fields();
+    field->set_var_type_sym(1);
+    field->set_var_name_sym(2);
+
+    // The serializers are prefixed with their size
+    const std::string serialized = msg.SerializeAsString();
+    ps2::CDemoSendTables tables;
+    tables.set_data(std::string(1, static_cast<char>(serialized.size())) + serialized);
+
+    // A field named by a symbol that doesn't exist
+    s->mutable_fields(0)->set_var_name_sym(7);
+    const std::string malformed = msg.SerializeAsString();
+    ps2::CDemoSendTables missing;
+    missing.set_data(std::string(1, static_cast<char>(malformed.size())) + malformed);
+
+    std::string replay = make_replay(10);
+    append_packet(replay, ps2::DEM_SendTables, 1, tables.SerializeAsString());
+    append_packet(replay, ps2::DEM_SendTables, 1, "\x0a\x05\x7f");
+    append_packet(replay, ps2::DEM_SendTables, 1, missing.SerializeAsString());
+
+    dem_file f(&replay[0], replay.size());
+    REQUIRE(f.serializers() == nullptr);
+
+    while (f.good())
+        f.get();
+
+    // The broken packets keep the serializers compiled before
+    REQUIRE(f.serializers() != nullptr);
+    REQUIRE(f.serializers()->find("CDOTA_Item") == 0);
+    REQUIRE(f.serializers()->field(0).kind == field_kind::signed_32);
+    REQUIRE(f.serializers()->field_name(0) == "m_iCharges");
+    REQUIRE(f.errors().count(packet_status::parse_error) == 2);
+
+    // Segments share them, errors are counted by every file on its own
+    dem_file segment = f.segment(f.segments(1).front());
+    REQUIRE(segment.serializers() == f.serializers());
+    REQUIRE(segment.registry() == f.registry());
+    REQUIRE(segment.errors().count(packet_status::parse_error) == 0);
+}
+
+TEST_CASE( "dem_file_class_info", "[dem_file.hpp]" ) {
+    ps2::CDemoClassInfo info;
+    for (int32_t id : {2, 0}) {
+        auto c = info.add_classes();
+        c->set_class_id(id);
+        c->set_network_name(id ? "CDOTA_Unit_Hero_Axe" : "CDOTAGamerulesProxy");
+        c->set_table_name("DT_" + c->network_name());
+    }
+
+    // Ids past the highest number of classes would make the names take up gigabytes
+    ps2::CDemoClassInfo huge;
+    auto c = huge.add_classes();
+    c->set_class_id(0x7FFFFFFF);
+    c->set_network_name("CDOTA_Unit_Hero_Sven");
+
+    std::string replay = make_replay(10);
+    append_packet(replay, ps2::DEM_ClassInfo, 1, info.SerializeAsString());
+    append_packet(replay, ps2::DEM_ClassInfo, 1, huge.SerializeAsString());
+
+    packet_list custom;
+    dem_file f(&replay[0], replay.size(), &custom);
+    REQUIRE(f.classes() == nullptr);
+
+    while (f.good())
+        f.get();
+
+    // Names are indexed by class id
+    REQUIRE(f.classes() != nullptr);
+    REQUIRE(f.classes()->size() == 3);
+    REQUIRE(f.classes()->at(0) == "CDOTAGamerulesProxy");
+    REQUIRE(f.classes()->at(1).empty());
+    REQUIRE(f.classes()->at(2) == "CDOTA_Unit_Hero_Axe");
+    REQUIRE(f.errors().count(packet_status::parse_error) == 1);
+
+    dem_file segment = f.segment(f.segments(1).front());
+    REQUIRE(segment.classes() == f.classes());
+}
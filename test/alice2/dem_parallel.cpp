@@ -0,0 +1,78 @@
+/**
+ * @file dem_parallel.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_parallel.hpp"
+
+using namespace alice;
+
+TEST_CASE( "dem_parallel", "[dem_parallel.hpp]" ) {
+    std::string replay("PBDEMS2\0\0\0\0\0", 12);
+    char buf[1024];
+
+    for (uint32_t i = 1; i <= 500; ++i) {
+        dem_packet p;
+        p.tick = i;
+        p.type = (i % 10 == 0) ? ps2::DEM_FullPacket : ps2::DEM_ConsoleCmd;
+        p.size = 4;
+        p.data = const_cast<char*>("tick");
+
+        replay.append(buf, dem_packet::to_buffer(p, buf, sizeof(buf)));
+    }
+
+    dem_file f(&replay[0], replay.size());
+    dem_parallel<std::vector<uint32_t>> parallel(4);
+
+    auto results = parallel.run(f, [](dem_file& s, const dem_segment&) {
+        std::vector<uint32_t> ticks;
+        while (s.good())
+            ticks.push_back(s.get().tick);
+
+        return ticks;
+    });
+
+    REQUIRE(results.size() == 16);
+
+    // Stitched back together in tick order
+    std::vector<uint32_t> ticks;
+    for (auto &r : results)
+        ticks.insert(ticks.end(), r.begin(), r.end());
+
+    REQUIRE(ticks.size() == 500);
+    for (uint32_t i = 0; i < 500; ++i)
+        REQUIRE(ticks[i] == i + 1);
+
+    // Errors are passed on
+    REQUIRE_THROWS_AS(parallel.run(f, [](dem_file&, const dem_segment& s) -> std::vector<uint32_t> {
+        if (s.tick > 250)
+            throw std::runtime_error("segment");
+
+        return {};
+    }), std::runtime_error);
+}
@@ -0,0 +1,132 @@
+/**
+ * @file dem_source.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef ALICE_HAVE_BZIP2
+    #include <bzlib.h>
+#endif /* ALICE_HAVE_BZIP2 */
+
+#ifdef ALICE_HAVE_ZLIB
+    #include <zlib.h>
+#endif /* ALICE_HAVE_ZLIB */
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_source.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Reads everything from source */
+    std::string drain(dem_source* source) {
+        std::string ret;
+        char buf[4096];
+
+        while (!source->eof())
+            ret.append(buf, source->read(buf, sizeof(buf)));
+
+        return ret;
+    }
+
+    /** Some compressible test data */
+    std::string make_data() {
+        std::string ret;
+        for (int i = 0; i < 100000; ++i)
+            ret += std::to_string(i % 97);
+
+        return ret;
+    }
+
+    /** Source that never has any data but isn't done either, like a replay that stopped being written */
+    struct idle_source : public dem_source {
+        virtual std::size_t read(char*, std::size_t) {
+            return 0;
+        }
+
+        virtual bool eof() const {
+            return false;
+        }
+    };
+}
+
+TEST_CASE( "dem_source_fd", "[dem_source.hpp]" ) {
+    const std::string data = make_data();
+    const char* path = "alice_test_source.dem";
+    std::ofstream(path, std::ofstream::out | std::ofstream::binary).write(data.data(), data.size());
+
+    std::unique_ptr<dem_source> plain(dem_source::open(path));
+    REQUIRE(drain(plain.get()) == data);
+
+    // Same data handed over from a background thread
+    std::unique_ptr<dem_source> async(new dem_source_async(new dem_source_fd(path), 1024));
+    REQUIRE(drain(async.get()) == data);
+
+    std::remove(path);
+}
+
+TEST_CASE( "dem_source_async_idle", "[dem_source.hpp]" ) {
+    // Destroying the source stops the background thread while it's waiting for data
+    std::unique_ptr<dem_source> async(new dem_source_async(new idle_source, 1024));
+    REQUIRE_FALSE(async->eof());
+    async.reset();
+}
+
+#ifdef ALICE_HAVE_BZIP2
+TEST_CASE( "dem_source_bz2", "[dem_source.hpp]" ) {
+    const std::string data = make_data();
+
+    std::vector<char> compressed(data.size() + data.size() / 100 + 600);
+    unsigned int size = compressed.size();
+    REQUIRE(BZ2_bzBuffToBuffCompress(compressed.data(), &size, const_cast<char*>(data.data()),
+        data.size(), 9, 0, 0) == BZ_OK);
+
+    const char* path = "alice_test_source.dem.bz2";
+    std::ofstream(path, std::ofstream::out | std::ofstream::binary).write(compressed.data(), size);
+
+    std::unique_ptr<dem_source> source(dem_source::open(path));
+    REQUIRE(drain(source.get()) == data);
+
+    std::remove(path);
+}
+#endif /* ALICE_HAVE_BZIP2 */
+
+#ifdef ALICE_HAVE_ZLIB
+TEST_CASE( "dem_source_gz", "[dem_source.hpp]" ) {
+    const std::string data = make_data();
+
+    const char* path = "alice_test_source.dem.gz";
+    gzFile out = gzopen(path, "wb");
+    gzwrite(out, data.data(), data.size());
+    gzclose(out);
+
+    std::unique_ptr<dem_source> source(dem_source::open(path));
+    REQUIRE(drain(source.get()) == data);
+
+    std::remove(path);
+}
+#endif /* ALICE_HAVE_ZLIB */
@@ -0,0 +1,85 @@
+/**
+ * @file dem_summary.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_summary.hpp"
+
+using namespace alice;
+
+TEST_CASE( "dem_summary", "[dem_summary.hpp]" ) {
+    // Create the summary
+    ps2::CDemoFileInfo info;
+    info.set_playback_time(2400.5f);
+    info.set_playback_ticks(72015);
+    auto *game = info.mutable_game_info()->mutable_dota();
+    game->set_match_id(1337);
+    game->set_game_winner(2);
+
+    auto *player = game->add_player_info();
+    player->set_hero_name("npc_dota_hero_axe");
+    player->set_player_name("invokr");
+    player->set_steamid(76561197960287930ULL);
+
+    std::string payload;
+    info.SerializeToString(&payload);
+
+    // Body packet followed by the summary, header points to the summary
+    std::string replay("PBDEMS2\0\0\0\0\0", 12);
+    char buf[1024];
+
+    dem_packet p{10, ps2::DEM_ConsoleCmd, 4, const_cast<char*>("body")};
+    replay.append(buf, dem_packet::to_buffer(p, buf, sizeof(buf)));
+
+    int32_t offset = replay.size();
+    memcpy(&replay[8], &offset, sizeof(offset));
+
+    dem_packet s{72015, ps2::DEM_FileInfo, payload.size(), &payload[0]};
+    replay.append(buf, dem_packet::to_buffer(s, buf, sizeof(buf)));
+
+    // Reading from memory and from disk needs to yield the same result
+    const char* path = "alice_test_summary.dem";
+    std::ofstream(path, std::ofstream::out | std::ofstream::binary).write(replay.data(), replay.size());
+
+    for (auto &summary : {dem_summary::from_buffer(replay.data(), replay.size()), dem_summary::from_file(path)}) {
+        REQUIRE(summary.source_version == engine::two);
+        REQUIRE(summary.playback_time == 2400.5f);
+        REQUIRE(summary.playback_ticks == 72015);
+        REQUIRE(summary.match_id == 1337);
+        REQUIRE(summary.game_winner == 2);
+        REQUIRE(summary.players.size() == 1);
+        REQUIRE(summary.players[0].hero == "npc_dota_hero_axe");
+        REQUIRE(summary.players[0].steamid == 76561197960287930ULL);
+    }
+
+    // Replays without a summary offset throw
+    memset(&replay[8], 0, sizeof(offset));
+    REQUIRE_THROWS_AS(dem_summary::from_buffer(replay.data(), replay.size()), DemNoSummary);
+
+    std::remove(path);
+}
@@ -0,0 +1,699 @@
+/**
+ * @file entity_store.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/dem_file.hpp"
+#include "../../../src/alice2/dem_parallel.hpp"
+#include "../../../src/alice2/entity_store.hpp"
+
+#include "bit_writer.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Returns the index of str in the symbol table of msg, adds it if necessary */
+    int32_t sym(ps2::CSVCMsg_FlattenedSerializer& msg, const std::string& str) {
+        for (int32_t i = 0; i < msg.symbols_size(); ++i) {
+            if (msg.symbols(i) == str)
+                return i;
+        }
+
+        msg.add_symbols(str);
+        return msg.symbols_size() - 1;
+    }
+
+    /** Adds a field to s */
+    ps2::ProtoFlattenedSerializerField_t* add(ps2::CSVCMsg_FlattenedSerializer& msg, ps2::ProtoFlattenedSerializer_t* s,
+        const std::string& type, const std::string& name)
+    {
+        ps2::ProtoFlattenedSerializerField_t* f = s->add_fields();
+        f->set_var_type_sym(sym(msg, type));
+        f->set_var_name_sym(sym(msg, name));
+        return f;
+    }
+
+    /** A hero with a nested component, arrays, vectors and angles */
+    ps2::CSVCMsg_FlattenedSerializer make_serializers() {
+        ps2::CSVCMsg_FlattenedSerializer msg;
+
+        auto hero = msg.add_serializers();
+        hero->set_serializer_name_sym(sym(msg, "CDOTA_Unit_Hero"));
+        add(msg, hero, "int32", "m_iHealth");
+        add(msg, hero, "bool", "m_bAlive");
+
+        auto body = add(msg, hero, "CBodyComponent*", "m_CBodyComponent");
+        body->set_field_serializer_name_sym(sym(msg, "CBodyComponent"));
+
+        add(msg, hero, "float32", "m_flSimulationTime");
+        add(msg, hero, "CHandle< CBaseEntity >[4]", "m_hAbilities");
+        add(msg, hero, "CUtlVector< int32 >", "m_vecCharges");
+        add(msg, hero, "char[32]", "m_iszName");
+        add(msg, hero, "uint64", "m_nXP");
+
+        auto component = msg.add_serializers();
+        component->set_serializer_name_sym(sym(msg, "CBodyComponent"));
+        add(msg, component, "uint16", "m_cellX");
+
+        auto origin = add(msg, component, "Vector", "m_vecOrigin");
+        origin->set_bit_count(10);
+        origin->set_low_value(0.0f);
+        origin->set_high_value(1023.0f);
+
+        add(msg, component, "QAngle", "m_angRotation")->set_bit_count(8);
+        return msg;
+    }
+
+    /** Writes entity updates */
+    struct entity_writer : bit_writer {
+        /** Encodes the field paths of an update with one op per path, depth can only change from or to 1 */
+        void paths(std::initializer_list<std::vector<int32_t>> list) {
+            std::vector<int32_t> current{-1};
+
+            for (const auto& p : list) {
+                if (p.size() == 1) {
+                    // Back to the first level, which is moved to the new index
+                    op(field_op::pop_n_and_non_topographical);
+                    ubitvar_fp(current.size() - 1);
+                    write(1, 1);
+                    zigzag(p[0] - current[0]);
+                } else if (p.size() == current.size()) {
+                    // Same depth, each level is moved
+                    op(field_op::non_topo_complex);
+                    for (size_t i = 0; i < p.size(); ++i) {
+                        write(p[i] != current[i], 1);
+                        if (p[i] != current[i])
+                            zigzag(p[i] - current[i]);
+                    }
+                } else {
+                    // From the first level, which moves by one more than sent
+                    REQUIRE(current.size() == 1);
+                    op(field_op::push_n_and_non_topological);
+                    write(1, 1);
+                    zigzag(p[0] - current[0] - 1);
+                    ubitvar(p.size() - 1);
+
+                    for (size_t i = 1; i < p.size(); ++i)
+                        ubitvar_fp(p[i]);
+                }
+
+                current = p;
+            }
+
+            op(field_op::finish);
+        }
+
+        /** Starts the entity delta after the previous one */
+        void entity(uint32_t delta, uint32_t cmd) {
+            ubitvar(delta);
+            write(cmd, 2);
+        }
+
+        /** Starts the creation of an entity */
+        void create(uint32_t delta, uint32_t cls, uint32_t bits, uint32_t serial) {
+            entity(delta, 2);
+            write(cls, bits);
+            write(serial, 17);
+            varint(0);
+        }
+    };
+
+    /** Returns a message with the given data and number of updated entities */
+    wire_packet_entities entities(const bit_writer& w, int32_t entries) {
+        wire_packet_entities ret = wire_packet_entities();
+        ret.updated_entries = entries;
+        ret.entity_data = wire_view{w.data.data(), static_cast<uint32_t>(w.data.size())};
+        return ret;
+    }
+
+    /** Writes the properties every test hero is created with */
+    void write_hero(entity_writer& w, int32_t health, const std::string& name) {
+        w.paths({{0}, {1}, {2}, {2, 1}, {2, 2}, {3}, {4, 3}, {6}});
+        w.zigzag(health);
+        w.write(1, 1);
+        w.write(1, 1);
+        w.write(0, 10);
+        w.write(1023, 10);
+        w.write(511, 10);
+        w.write(64, 8);
+        w.write(128, 8);
+        w.write(0, 8);
+        w.varint(60);
+        w.varint(77);
+        w.string(name);
+    }
+}
+
+TEST_CASE( "entity_store_layout", "[entity_store.hpp]" ) {
+    const auto ser = std::make_shared<const flattened_serializer>(make_serializers());
+    const entity_class c(ser, ser->find("CDOTA_Unit_Hero"));
+
+    // Values, 3 origin and 3 angle components, 4 handles and the array length
+    REQUIRE(c.columns() == 18);
+    REQUIRE(c.size() == 0);
+    REQUIRE(c.capacity() == 0);
+
+    const uint32_t health = c.find("m_iHealth");
+    REQUIRE(health != entity_class::npos);
+    REQUIRE(c.get(health).type == column_type::int32);
+    REQUIRE(ser->field_name(c.get(health).field) == "m_iHealth");
+
+    // Components follow each other
+    const uint32_t origin = c.find("m_CBodyComponent.m_vecOrigin");
+    REQUIRE(c.get(origin).type == column_type::float32);
+    REQUIRE(c.get(origin + 2).component == 2);
+    REQUIRE(c.get(origin + 2).field == c.get(origin).field);
+    REQUIRE(c.find("m_CBodyComponent.m_angRotation") == origin + 3);
+
+    REQUIRE(c.get(c.find("m_CBodyComponent")).type == column_type::boolean);
+    REQUIRE(c.get(c.find("m_hAbilities.0003")).type == column_type::uint32);
+    REQUIRE(c.get(c.find("m_vecCharges")).type == column_type::uint32);
+    REQUIRE(c.get(c.find("m_iszName")).type == column_type::string);
+    REQUIRE(c.get(c.find("m_nXP")).type == column_type::uint64);
+
+    // Field paths lead to the same columns
+    field_path p;
+    p.data[0] = 2;
+    p.push(1);
+    REQUIRE(c.find(p) == origin);
+
+    p.pop(1);
+    p.data[0] = 4;
+    p.push(3);
+    REQUIRE(c.find(p) == c.find("m_hAbilities.0003"));
+
+    // Arrays have no column of their own, dynamic arrays start out empty
+    p.pop(1);
+    REQUIRE(c.find(p) == entity_class::npos);
+    REQUIRE(c.find("m_hAbilities.0004") == entity_class::npos);
+    REQUIRE(c.find("m_vecCharges.0000") == entity_class::npos);
+    REQUIRE(c.find("m_iMana") == entity_class::npos);
+    REQUIRE(c.data<int32_t>(entity_class::npos) == nullptr);
+}
+
+TEST_CASE( "entity_store", "[entity_store.hpp]" ) {
+    const auto ser = std::make_shared<const flattened_serializer>(make_serializers());
+    const auto classes = std::make_shared<const std::vector<std::string>>(
+        std::vector<std::string>{"CWorld", "CDOTA_Unit_Hero", "CDOTA_Unit_Courier"});
+    entity_store store(ser, classes);
+
+    // Three classes without server info are sent with 2 bits
+    entity_writer w;
+    w.create(3, 1, 2, 1234);
+    write_hero(w, 600, "npc_dota_hero_axe");
+    w.create(0, 1, 2, 99);
+    write_hero(w, 550, "npc_dota_hero_lina");
+
+    store.on(entities(w, 2), 10);
+    REQUIRE(store.tick() == 10);
+    REQUIRE(store.size() == 2);
+    REQUIRE(store.find("CWorld") == nullptr);
+
+    const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+    REQUIRE(heroes != nullptr);
+    REQUIRE(heroes == store.find(1));
+    REQUIRE(heroes->size() == 2);
+    REQUIRE(heroes->capacity() == ALICE_ENTITY_CLASS_SLOTS);
+
+    const entity_store::entity& axe = store.get(3);
+    REQUIRE(axe.cls == 1);
+    REQUIRE(axe.serial == 1234);
+    REQUIRE(heroes->entity(axe.slot) == 3);
+
+    const entity_store::entity& lina = store.get(4);
+    REQUIRE(lina.cls == 1);
+    REQUIRE(lina.slot != axe.slot);
+    REQUIRE(store.get(5).cls == entity_store::npos);
+
+    // Each property is a single array over all slots
+    const int32_t* health = heroes->data<int32_t>(heroes->find("m_iHealth"));
+    REQUIRE(health[axe.slot] == 600);
+    REQUIRE(health[lina.slot] == 550);
+
+    const float* origin = heroes->data<float>(heroes->find("m_CBodyComponent.m_vecOrigin"));
+    REQUIRE(origin[axe.slot] == 0.0f);
+    REQUIRE(heroes->data<float>(heroes->find("m_CBodyComponent.m_vecOrigin") + 1)[axe.slot] == Approx(1023.0f));
+    REQUIRE(heroes->data<float>(heroes->find("m_CBodyComponent.m_vecOrigin") + 2)[axe.slot] == Approx(511.0f));
+
+    const uint32_t angles = heroes->find("m_CBodyComponent.m_angRotation");
+    REQUIRE(heroes->data<float>(angles)[lina.slot] == 90.0f);
+    REQUIRE(heroes->data<float>(angles + 1)[lina.slot] == 180.0f);
+    REQUIRE(heroes->data<float>(angles + 2)[lina.slot] == 0.0f);
+
+    REQUIRE(heroes->data<uint8_t>(heroes->find("m_bAlive"))[axe.slot] == 1);
+    REQUIRE(heroes->data<uint8_t>(heroes->find("m_CBodyComponent"))[axe.slot] == 1);
+    REQUIRE(heroes->data<float>(heroes->find("m_flSimulationTime"))[axe.slot] == 2.0f);
+    REQUIRE(heroes->data<uint32_t>(heroes->find("m_hAbilities.0003"))[axe.slot] == 77);
+    REQUIRE(heroes->data<uint32_t>(heroes->find("m_hAbilities.0002"))[axe.slot] == 0);
+    REQUIRE(heroes->data<std::string>(heroes->find("m_iszName"))[axe.slot] == "npc_dota_hero_axe");
+    REQUIRE(heroes->data<std::string>(heroes->find("m_iszName"))[lina.slot] == "npc_dota_hero_lina");
+
+    // Update the first one, delete the second one and let a third one leave the PVS
+    entity_writer u;
+    u.entity(3, 0);
+    u.paths({{0}, {7}});
+    u.zigzag(-5);
+    u.varint(1ull << 40);
+    u.entity(0, 3);
+    u.entity(0, 1);
+
+    store.on(entities(u, 3), 11);
+    REQUIRE(store.size() == 1);
+    REQUIRE(health[axe.slot] == -5);
+    REQUIRE(heroes->data<uint64_t>(heroes->find("m_nXP"))[axe.slot] == 1ull << 40);
+    REQUIRE(heroes->entity(lina.slot) == entity_class::npos);
+    REQUIRE(store.get(4).cls == entity_store::npos);
+
+    // Slots are reused and cleared
+    entity_writer c;
+    c.create(5, 1, 2, 7);
+    c.paths({{1}});
+    c.write(0, 1);
+
+    store.on(entities(c, 1), 12);
+    REQUIRE(store.size() == 2);
+    REQUIRE(store.get(5).slot == lina.slot);
+    REQUIRE(health[lina.slot] == 0);
+    REQUIRE(heroes->data<std::string>(heroes->find("m_iszName"))[lina.slot].empty());
+
+    // Server info widens the class ids
+    ps2::CSVCMsg_ServerInfo info;
+    info.set_max_classes(42);
+    store.on(info, 13);
+
+    entity_writer wide;
+    wide.create(6, 1, 6, 8);
+    wide.paths({{0}});
+    wide.zigzag(1);
+
+    store.on(entities(wide, 1), 14);
+    REQUIRE(store.size() == 3);
+    REQUIRE(store.get(6).serial == 8);
+}
+
+TEST_CASE( "entity_store_growth", "[entity_store.hpp]" ) {
+    const auto ser = std::make_shared<const flattened_serializer>(make_serializers());
+    const auto classes = std::make_shared<const std::vector<std::string>>(
+        std::vector<std::string>{"CWorld", "CDOTA_Unit_Hero"});
+    entity_store store(ser, classes);
+
+    // More heroes than slots
+    entity_writer w;
+    for (uint32_t i = 0; i < ALICE_ENTITY_CLASS_SLOTS + 1; ++i) {
+        w.create(0, 1, 2, i);
+        w.paths({{0}});
+        w.zigzag(i);
+    }
+
+    store.on(entities(w, ALICE_ENTITY_CLASS_SLOTS + 1), 1);
+    const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+    REQUIRE(heroes->size() == ALICE_ENTITY_CLASS_SLOTS + 1);
+    REQUIRE(heroes->capacity() == ALICE_ENTITY_CLASS_SLOTS * 2);
+
+    const int32_t* health = heroes->data<int32_t>(heroes->find("m_iHealth"));
+    for (uint32_t i = 0; i < ALICE_ENTITY_CLASS_SLOTS + 1; ++i)
+        REQUIRE(health[store.get(i).slot] == static_cast<int32_t>(i));
+
+    // Dynamic arrays grow when their elements are first sent
+    const uint32_t columns = heroes->columns();
+
+    entity_writer a;
+    a.entity(0, 0);
+    a.paths({{5}, {5, 0}, {5, 2}});
+    a.varint(3);
+    a.zigzag(10);
+    a.zigzag(-30);
+
+    store.on(entities(a, 1), 2);
+    REQUIRE(heroes->columns() == columns + 3);
+
+    const uint32_t slot = store.get(0).slot;
+    REQUIRE(heroes->data<uint32_t>(heroes->find("m_vecCharges"))[slot] == 3);
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_vecCharges.0000"))[slot] == 10);
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_vecCharges.0001"))[slot] == 0);
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_vecCharges.0002"))[slot] == -30);
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_vecCharges.0002"))[store.get(1).slot] == 0);
+}
+
+namespace {
+    /** Returns the data of a string table entry with the given key and value */
+    bit_writer baseline_entry(const std::string& key, const bit_writer& value) {
+        bit_writer w;
+        w.write(1, 1);
+        w.write(!key.empty(), 1);
+
+        if (!key.empty()) {
+            w.write(0, 1);
+            w.string(key);
+        }
+
+        w.write(1, 1);
+        w.write(value.data.size(), 17);
+        w.bytes(value.data);
+
+        return w;
+    }
+
+    /** Returns the baseline of a hero with the given health */
+    entity_writer hero_baseline(int32_t health) {
+        entity_writer w;
+        w.paths({{0}, {5}, {5, 0}, {6}});
+        w.zigzag(health);
+        w.varint(1);
+        w.zigzag(4);
+        w.string("baseline");
+        return w;
+    }
+}
+
+TEST_CASE( "entity_store_baseline", "[entity_store.hpp]" ) {
+    const auto ser = std::make_shared<const flattened_serializer>(make_serializers());
+    const auto classes = std::make_shared<const std::vector<std::string>>(
+        std::vector<std::string>{"CWorld", "CDOTA_Unit_Hero"});
+    entity_store store(ser, classes);
+
+    // The baselines are the second table
+    const std::string other("userinfo");
+    const std::string name("instancebaseline");
+    const bit_writer entry = baseline_entry("1", hero_baseline(900));
+
+    wire_create_string_table table = wire_create_string_table();
+    table.max_entries = 64;
+    table.name = wire_view{other.data(), other.size()};
+    store.on(table, 1);
+
+    table.name = wire_view{name.data(), name.size()};
+    table.num_entries = 1;
+    table.string_data = wire_view{entry.data.data(), entry.data.size()};
+    store.on(table, 1);
+
+    // New entities start from the baseline, their own properties are applied on top
+    entity_writer w;
+    w.create(0, 1, 2, 0);
+    w.paths({{1}});
+    w.write(1, 1);
+    w.create(0, 1, 2, 0);
+    w.paths({{0}});
+    w.zigzag(5);
+
+    store.on(entities(w, 2), 2);
+    const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+    const int32_t* health = heroes->data<int32_t>(heroes->find("m_iHealth"));
+    const std::string* names = heroes->data<std::string>(heroes->find("m_iszName"));
+
+    const uint32_t first = store.get(0).slot;
+    const uint32_t second = store.get(1).slot;
+    REQUIRE(health[first] == 900);
+    REQUIRE(health[second] == 5);
+    REQUIRE(heroes->data<uint8_t>(heroes->find("m_bAlive"))[first] == 1);
+    REQUIRE(heroes->data<uint8_t>(heroes->find("m_bAlive"))[second] == 0);
+    REQUIRE(names[first] == "baseline");
+    REQUIRE(names[second] == "baseline");
+
+    // Arrays grown by the baseline
+    REQUIRE(heroes->data<uint32_t>(heroes->find("m_vecCharges"))[second] == 1);
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_vecCharges.0000"))[second] == 4);
+
+    // Changes of other tables are ignored
+    const bit_writer changed = baseline_entry("", hero_baseline(1000));
+    wire_update_string_table update = wire_update_string_table();
+    update.table_id = 0;
+    update.num_changed_entries = 1;
+    update.string_data = wire_view{changed.data.data(), changed.data.size()};
+    store.on(update, 3);
+
+    entity_writer c;
+    c.create(2, 1, 2, 0);
+    c.paths({});
+    store.on(entities(c, 1), 3);
+    REQUIRE(health[store.get(2).slot] == 900);
+
+    // Changed baselines only apply to entities created afterwards
+    update.table_id = 1;
+    store.on(update, 4);
+
+    entity_writer n;
+    n.create(3, 1, 2, 0);
+    n.paths({});
+    store.on(entities(n, 1), 4);
+
+    health = heroes->data<int32_t>(heroes->find("m_iHealth"));
+    REQUIRE(health[store.get(3).slot] == 1000);
+    REQUIRE(health[store.get(2).slot] == 900);
+    REQUIRE(health[first] == 900);
+    REQUIRE(heroes->data<std::string>(heroes->find("m_iszName"))[store.get(3).slot] == "baseline");
+}
+
+TEST_CASE( "entity_store_errors", "[entity_store.hpp]" ) {
+    const auto ser = std::make_shared<const flattened_serializer>(make_serializers());
+    const auto classes = std::make_shared<const std::vector<std::string>>(
+        std::vector<std::string>{"", "CDOTA_Unit_Hero", "CDOTA_Unit_Courier"});
+    entity_store store(ser, classes);
+
+    // Classes without name or serializer
+    entity_writer unnamed;
+    unnamed.create(0, 0, 2, 0);
+    REQUIRE_THROWS_AS(store.on(entities(unnamed, 1), 1), EntityUnknownClass);
+
+    entity_writer courier;
+    courier.create(0, 2, 2, 0);
+    REQUIRE_THROWS_AS(store.on(entities(courier, 1), 1), EntityUnknownClass);
+
+    // Updates of entities which don't exist
+    entity_writer missing;
+    missing.entity(0, 0);
+    REQUIRE_THROWS_AS(store.on(entities(missing, 1), 1), EntityMissing);
+
+    entity_writer index;
+    index.ubitvar(ALICE_ENTITY_MAX);
+    REQUIRE_THROWS_AS(store.on(entities(index, 1), 1), EntityIndex);
+    REQUIRE_THROWS_AS(store.get(ALICE_ENTITY_MAX), EntityIndex);
+
+    // Paths past the end of fixed arrays or below values
+    entity_writer fixed;
+    fixed.create(0, 1, 2, 0);
+    fixed.paths({{4, 4}});
+    REQUIRE_THROWS_AS(store.on(entities(fixed, 1), 1), EntityFieldPath);
+
+    entity_writer value;
+    value.create(0, 1, 2, 0);
+    value.paths({{0, 1}});
+    REQUIRE_THROWS_AS(store.on(entities(value, 1), 1), EntityFieldPath);
+
+    entity_writer field;
+    field.create(0, 1, 2, 0);
+    field.paths({{8}});
+    REQUIRE_THROWS_AS(store.on(entities(field, 1), 1), EntityFieldPath);
+
+    const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+    REQUIRE_THROWS_AS(heroes->data<float>(heroes->find("m_iHealth")), EntityColumnType);
+    REQUIRE_THROWS_AS(heroes->data<std::string>(heroes->find("m_nXP")), EntityColumnType);
+}
+
+TEST_CASE( "entity_store_file", "[entity_store.hpp]" ) {
+    // The serializers are prefixed with their size
+    const std::string serialized = make_serializers().SerializeAsString();
+    bit_writer size;
+    size.varint(serialized.size());
+
+    ps2::CDemoSendTables tables;
+    tables.set_data(size.data + serialized);
+
+    ps2::CDemoClassInfo info;
+    for (const std::string name : {"CWorld", "CDOTA_Unit_Hero"}) {
+        auto c = info.add_classes();
+        c->set_class_id(info.classes_size() - 1);
+        c->set_network_name(name);
+    }
+
+    entity_writer w;
+    w.create(0, 1, 2, 5);
+    write_hero(w, 700, "npc_dota_hero_sven");
+
+    ps2::CSVCMsg_PacketEntities msg;
+    msg.set_updated_entries(1);
+    msg.set_entity_data(w.data);
+
+    // Entities are ignored until the serializers and classes are known
+    entity_writer m;
+    for (int i = 0; i < 2; ++i) {
+        const std::string payload = msg.SerializeAsString();
+        m.ubitvar(ps2::svc_PacketEntities);
+        m.varint(payload.size());
+
+        for (char c : payload)
+            m.write(static_cast<uint8_t>(c), 8);
+    }
+
+    ps2::CDemoPacket packet;
+    packet.set_data(m.data);
+
+    std::string replay("PBDEMS2\0\0\0\0\0", 12);
+    append_packet(replay, ps2::DEM_FileHeader, 1, "header");
+    append_packet(replay, ps2::DEM_Packet, 2, packet.SerializeAsString());
+    append_packet(replay, ps2::DEM_SendTables, 3, tables.SerializeAsString());
+    append_packet(replay, ps2::DEM_ClassInfo, 3, info.SerializeAsString());
+    append_packet(replay, ps2::DEM_Packet, 4, packet.SerializeAsString());
+    append_packet(replay, ps2::DEM_SendTables, 5, tables.SerializeAsString());
+    append_packet(replay, ps2::DEM_Packet, 6, packet.SerializeAsString());
+
+    dem_file f(&replay[0], replay.size());
+    entity_store store(f);
+
+    f.get(store);
+    f.get(store);
+    REQUIRE(store.size() == 0);
+
+    for (int i = 0; i < 3; ++i)
+        f.get(store);
+
+    REQUIRE(store.tick() == 4);
+    const std::shared_ptr<const flattened_serializer> first = f.serializers();
+
+    // The store keeps the serializers it was bound to when the file compiles new ones
+    while (f.good())
+        f.get(store);
+
+    REQUIRE(f.serializers() != first);
+    REQUIRE(store.tick() == 6);
+    REQUIRE(store.size() == 1);
+
+    const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+    REQUIRE(heroes->data<int32_t>(heroes->find("m_iHealth"))[store.get(0).slot] == 700);
+}
+
+namespace {
+    /** State of a segment once it has been read */
+    struct segment_state {
+        uint32_t tick;
+        std::size_t tables;
+        uint32_t size;
+        int32_t health;
+    };
+}
+
+TEST_CASE( "entity_store_parallel", "[entity_store.hpp]" ) {
+    const std::string serialized = make_serializers().SerializeAsString();
+    bit_writer size;
+    size.varint(serialized.size());
+
+    ps2::CDemoSendTables tables;
+    tables.set_data(size.data + serialized);
+
+    ps2::CDemoClassInfo info;
+    for (const std::string name : {"CWorld", "CDOTA_Unit_Hero"}) {
+        auto c = info.add_classes();
+        c->set_class_id(info.classes_size() - 1);
+        c->set_network_name(name);
+    }
+
+    // The baselines are created during signon
+    const bit_writer entry = baseline_entry("1", hero_baseline(900));
+    ps2::CSVCMsg_CreateStringTable create;
+    create.set_name("instancebaseline");
+    create.set_max_entries(64);
+    create.set_num_entries(1);
+    create.set_string_data(entry.data);
+
+    bit_writer signon;
+    signon.message(ps2::svc_CreateStringTable, create.SerializeAsString());
+
+    ps2::CDemoPacket packet;
+    packet.set_data(signon.data);
+
+    std::string replay("PBDEMS2\0\0\0\0\0", 12);
+    append_packet(replay, ps2::DEM_FileHeader, 1, "header");
+    append_packet(replay, ps2::DEM_SignonPacket, 1, packet.SerializeAsString());
+    append_packet(replay, ps2::DEM_SendTables, 1, tables.SerializeAsString());
+    append_packet(replay, ps2::DEM_ClassInfo, 1, info.SerializeAsString());
+    append_packet(replay, ps2::DEM_SyncTick, 1, "");
+
+    // Full packets change the baseline and create entity 0 from it, the packet after them creates entity 1
+    for (uint32_t i = 1; i <= 16; ++i) {
+        ps2::CDemoFullPacket full;
+        auto table = full.mutable_string_table()->add_tables();
+        table->set_table_name("instancebaseline");
+
+        auto item = table->add_items();
+        item->set_str("1");
+        item->set_data(hero_baseline(900 + i).data);
+
+        entity_writer first;
+        first.create(0, 1, 2, 0);
+        first.paths({});
+
+        ps2::CSVCMsg_PacketEntities msg;
+        msg.set_updated_entries(1);
+        msg.set_entity_data(first.data);
+
+        bit_writer embedded;
+        embedded.message(ps2::svc_PacketEntities, msg.SerializeAsString());
+        full.mutable_packet()->set_data(embedded.data);
+        append_packet(replay, ps2::DEM_FullPacket, i * 10, full.SerializeAsString());
+
+        entity_writer second;
+        second.create(1, 1, 2, 0);
+        second.paths({});
+
+        msg.set_entity_data(second.data);
+        bit_writer next;
+        next.message(ps2::svc_PacketEntities, msg.SerializeAsString());
+        packet.set_data(next.data);
+        append_packet(replay, ps2::DEM_Packet, i * 10 + 1, packet.SerializeAsString());
+    }
+
+    dem_file f(&replay[0], replay.size());
+    dem_parallel<segment_state> parallel(2);
+
+    const std::vector<segment_state> states = parallel.run(f, [](dem_file& s, const dem_segment& seg) {
+        entity_store store(s);
+        while (s.good())
+            s.get(store);
+
+        const entity_class* heroes = store.find("CDOTA_Unit_Hero");
+        return segment_state{
+            seg.tick, s.string_tables() ? s.string_tables()->size() : 0, store.size(),
+            heroes ? heroes->data<int32_t>(heroes->find("m_iHealth"))[store.get(1).slot] : 0
+        };
+    });
+
+    REQUIRE(states.size() > 1);
+
+    // The first segment reads the signon packets itself and ends before the first full packet, the others
+    // start from their full packet
+    REQUIRE(states[0].tick == 0);
+    REQUIRE(states[0].tables == 0);
+
+    for (std::size_t i = 1; i < states.size(); ++i) {
+        REQUIRE(states[i].tables == 1);
+        REQUIRE(states[i].size == 2);
+        REQUIRE(states[i].health == static_cast<int32_t>(900 + states[i].tick / 10));
+    }
+
+    REQUIRE(f.errors().count(packet_status::parse_error) == 0);
+}
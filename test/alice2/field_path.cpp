@@ -0,0 +1,191 @@
+/**
+ * @file field_path.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/field_path.hpp"
+
+#include "bit_writer.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Creates a path from its levels */
+    field_path path(std::initializer_list<int32_t> levels) {
+        field_path ret;
+        ret.last = levels.size() - 1;
+
+        uint32_t i = 0;
+        for (auto l : levels)
+            ret.data[i++] = l;
+
+        return ret;
+    }
+}
+
+TEST_CASE( "field_path_codes", "[field_path.hpp]" ) {
+    const field_path_decoder& d = field_path_decoder::get();
+    REQUIRE(&d == &field_path_decoder::get());
+
+    // The most common ops have the shortest codes
+    REQUIRE(d.encoding(field_op::plus_one).length == 1);
+    REQUIRE(d.encoding(field_op::plus_one).bits == 0);
+    REQUIRE(d.encoding(field_op::finish).length == 2);
+    REQUIRE(d.encoding(field_op::finish).bits == 1);
+
+    // A complete prefix code
+    double kraft = 0;
+    for (uint32_t i = 0; i < field_path_decoder::op_count; ++i) {
+        const auto a = d.encoding(static_cast<field_op>(i));
+        kraft += 1.0 / (1u << a.length);
+
+        for (uint32_t j = 0; j < field_path_decoder::op_count; ++j) {
+            const auto b = d.encoding(static_cast<field_op>(j));
+            if (i == j || b.length < a.length)
+                continue;
+
+            REQUIRE((b.bits & ((1u << a.length) - 1)) != a.bits);
+        }
+    }
+
+    REQUIRE(kraft == 1.0);
+}
+
+TEST_CASE( "field_path_next", "[field_path.hpp]" ) {
+    const field_path_decoder& d = field_path_decoder::get();
+
+    // Every op at every offset, including long codes ending in the last byte
+    std::mt19937 rng(7);
+    std::vector<field_op> ops;
+    for (int i = 0; i < 2000; ++i)
+        ops.push_back(static_cast<field_op>(rng() % field_path_decoder::op_count));
+
+    for (uint32_t i = 0; i < field_path_decoder::op_count; ++i)
+        ops.push_back(static_cast<field_op>(i));
+
+    bit_writer w;
+    for (auto o : ops)
+        w.op(o);
+
+    bitstream table(w.data.data(), w.data.size());
+    bitstream tree(w.data.data(), w.data.size());
+    unchecked_bitstream raw(w.data.data(), w.data.size());
+
+    for (auto o : ops) {
+        REQUIRE(d.next(table) == o);
+        REQUIRE(d.next_bitwise(tree) == o);
+        REQUIRE(d.next(raw) == o);
+        REQUIRE(table.position() == tree.position());
+    }
+
+    REQUIRE(table.position() == w.pos);
+}
+
+TEST_CASE( "field_path_read", "[field_path.hpp]" ) {
+    const field_path_decoder& d = field_path_decoder::get();
+
+    bit_writer w;
+    w.op(field_op::plus_one);
+    w.op(field_op::plus_one);
+    w.op(field_op::push_one_left_delta_one_right_zero);
+    w.op(field_op::push_one_left_delta_n_right_non_zero_pack6_bits);
+    w.write(1, 3);
+    w.write(2, 3);
+    w.op(field_op::non_topo_complex_pack4_bits);
+    w.write(0, 1);
+    w.write(1, 1);
+    w.write(9, 4);
+    w.write(1, 1);
+    w.write(5, 4);
+    w.op(field_op::pop_all_but_one_plus_one);
+    w.op(field_op::plus_n);
+    w.write(1, 1);
+    w.write(3, 2);
+    w.op(field_op::finish);
+    w.write(0x15, 5);
+
+    std::vector<field_path> paths{path({1, 2, 3})};
+    bitstream s(w.data.data(), w.data.size());
+    d.read(s, paths);
+
+    REQUIRE(paths.size() == 7);
+    REQUIRE(paths[0] == path({0}));
+    REQUIRE(paths[1] == path({1}));
+    REQUIRE(paths[2] == path({2, 0}));
+    REQUIRE(paths[3] == path({2, 3, 3}));
+    REQUIRE(paths[4] == path({2, 5, 1}));
+    REQUIRE(paths[5] == path({3}));
+    REQUIRE(paths[6] == path({11}));
+
+    // Levels below the last are cleared
+    REQUIRE(paths[5].data[1] == 0);
+    REQUIRE(paths[5].size() == 1);
+
+    // Whatever follows the list is left alone
+    REQUIRE(s.read(5) == 0x15);
+
+    // Both streams decode the same
+    std::vector<field_path> raw_paths;
+    unchecked_bitstream raw(w.data.data(), w.data.size());
+    d.read(raw, raw_paths);
+    REQUIRE(raw_paths == paths);
+}
+
+TEST_CASE( "field_path_errors", "[field_path.hpp]" ) {
+    const field_path_decoder& d = field_path_decoder::get();
+    std::vector<field_path> paths;
+
+    // Nested deeper than supported
+    bit_writer deep;
+    for (uint32_t i = 0; i < field_path::max_depth; ++i)
+        deep.op(field_op::push_one_left_delta_zero_right_zero);
+    deep.op(field_op::finish);
+
+    bitstream s1(deep.data.data(), deep.data.size());
+    REQUIRE_THROWS_AS(d.read(s1, paths), FieldPathDepth);
+
+    // Popping more levels than there are
+    bit_writer pop;
+    pop.op(field_op::pop_one_plus_one);
+    pop.op(field_op::finish);
+
+    bitstream s2(pop.data.data(), pop.data.size());
+    REQUIRE_THROWS_AS(d.read(s2, paths), FieldPathDepth);
+
+    // Missing finish
+    bit_writer open;
+    for (int i = 0; i < 8; ++i)
+        open.op(field_op::plus_two);
+
+    bitstream s3(open.data.data(), open.data.size());
+    REQUIRE_THROWS_AS(d.read(s3, paths), bitstreamDataSize);
+
+    unchecked_bitstream s4(open.data.data(), open.data.size());
+    REQUIRE_THROWS_AS(d.read(s4, paths), FieldPathTruncated);
+}
@@ -0,0 +1,144 @@
+/**
+ * @file packet_dispatch.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <string>
+#include <type_traits>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/packet_dispatch.hpp"
+
+using namespace alice;
+
+static_assert(std::is_same<
+    packet_type<engine::two, PACKET_NET, ps2::svc_ServerInfo>::type, ps2::CSVCMsg_ServerInfo
+>::value, "Source 2 net message mapping");
+
+static_assert(std::is_same<
+    packet_type<engine::one, PACKET_USR, ps1::UM_SayText2>::type, ps1::CUserMsg_SayText2
+>::value, "Source 1 user message mapping");
+
+static_assert(std::is_same<
+    packet_type<engine::two, PACKET_DEM, ps2::DEM_SignonPacket>::type, ps2::CDemoPacket
+>::value, "Signon packets are wrapped in a CDemoPacket");
+
+namespace {
+    /** Handles server info and anything that is a protobuf message with a tick */
+    struct handler {
+        uint32_t classes = 0;
+        uint32_t any = 0;
+
+        void on(const ps2::CSVCMsg_ServerInfo& m) {
+            classes = m.max_classes();
+        }
+
+        void on(const ps2::CSVCMsg_SetPause&, int tick) {
+            any += tick;
+        }
+    };
+
+    /** Takes entity updates as zero-copy views */
+    struct wire_handler {
+        wire_view entities = wire_view();
+
+        void on(const wire_packet_entities& m) {
+            entities = m.entity_data;
+        }
+    };
+}
+
+TEST_CASE( "packet_dispatch", "[packet_dispatch.hpp]" ) {
+    REQUIRE(packet_accepts<handler>(engine::two, PACKET_NET, ps2::svc_ServerInfo));
+    REQUIRE_FALSE(packet_accepts<handler>(engine::two, PACKET_NET, ps2::svc_SetPause));
+    REQUIRE(packet_accepts<handler, int>(engine::two, PACKET_NET, ps2::svc_SetPause));
+    REQUIRE_FALSE(packet_accepts<handler>(engine::two, PACKET_USR, ps2::UM_SayText2));
+    REQUIRE_FALSE(packet_accepts<handler>(engine::two, PACKET_NET, 9999));
+
+    ps2::CSVCMsg_ServerInfo info;
+    info.set_max_classes(42);
+    const std::string data = info.SerializeAsString();
+
+    handler h;
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_ServerInfo, data.data(), data.size(), nullptr, h)
+        == packet_status::ok);
+    REQUIRE(h.classes == 42);
+
+    // Allocated from the arena
+    google::protobuf::Arena arena;
+    h.classes = 0;
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_ServerInfo, data.data(), data.size(), &arena, h)
+        == packet_status::ok);
+    REQUIRE(h.classes == 42);
+
+    // Extra arguments are forwarded
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_SetPause, nullptr, 0, nullptr, h, 5)
+        == packet_status::ok);
+    REQUIRE(h.any == 5);
+
+    // No overload, nothing happens
+    REQUIRE(packet_dispatch(engine::two, PACKET_USR, ps2::UM_SayText2, nullptr, 0, nullptr, h)
+        == packet_status::ignored);
+
+    // Same status as packet_list for ids without type
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, 9999, nullptr, 0, nullptr, h) == packet_status::out_of_range);
+    REQUIRE(packet_dispatch(engine::one, PACKET_USR, 9999, nullptr, 0, nullptr, h) == packet_status::out_of_range);
+    REQUIRE(packet_dispatch(engine::unkown, PACKET_NET, ps2::svc_ServerInfo, nullptr, 0, nullptr, h)
+        == packet_status::out_of_range);
+
+    // Invalid payloads never reach the handler
+    h.classes = 0;
+    const char invalid[] = "\x0f\x01";
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_ServerInfo, invalid, 2, nullptr, h)
+        == packet_status::parse_error);
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_ServerInfo, invalid, 2, &arena, h)
+        == packet_status::parse_error);
+    REQUIRE(h.classes == 0);
+}
+
+TEST_CASE( "packet_dispatch_wire", "[packet_dispatch.hpp]" ) {
+    static_assert(std::is_same<wire_message<ps2::CSVCMsg_PacketEntities>::type, wire_packet_entities>::value,
+        "Packet entities have a zero-copy decoder");
+    static_assert(std::is_same<wire_message<ps2::CSVCMsg_ServerInfo>::type, wire_none>::value,
+        "Server info doesn't");
+
+    ps2::CSVCMsg_PacketEntities msg;
+    msg.set_entity_data(std::string(100, 'e'));
+    const std::string data = msg.SerializeAsString();
+
+    wire_handler h;
+    REQUIRE(packet_accepts<wire_handler>(engine::two, PACKET_NET, ps2::svc_PacketEntities));
+    REQUIRE(packet_accepts<wire_handler>(engine::one, PACKET_NET, ps1::svc_PacketEntities));
+    REQUIRE_FALSE(packet_accepts<wire_handler>(engine::two, PACKET_NET, ps2::svc_ServerInfo));
+
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_PacketEntities, data.data(), data.size(), nullptr, h)
+        == packet_status::ok);
+
+    // The handler sees the payload in place
+    REQUIRE(h.entities.size == 100);
+    REQUIRE(h.entities.data >= data.data());
+    REQUIRE(h.entities.data + h.entities.size <= data.data() + data.size());
+
+    REQUIRE(packet_dispatch(engine::two, PACKET_NET, ps2::svc_PacketEntities, "\x3a\x05", 2, nullptr, h)
+        == packet_status::parse_error);
+}
@@ -20,6 +20,10 @@
  *    limitations under the License.
  */
 
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <catch.hpp>
 #include "../../../src/alice2/packets.hpp"
 
@@ -33,7 +37,7 @@ struct p1 {
     // We only use packet_list for protobuf, so this is required
     // Whether this function returns the correct result or not is not important
     // in regards to testing packet_list
-    void ParseFromArray(const char*, size_t) {}
+    bool ParseFromArray(const char*, size_t) { return true; }
 };
 
 struct p2 {
@@ -41,7 +45,7 @@ struct p2 {
         return i - j;
     }
 
-    void ParseFromArray(const char*, size_t) {}
+    bool ParseFromArray(const char*, size_t) { return true; }
 };
 
 TEST_CASE( "packets", "[packets.cpp]" ) {
@@ -54,4 +58,167 @@ TEST_CASE( "packets", "[packets.cpp]" ) {
 
     REQUIRE(pt1->add(1, 2) == 3);
     REQUIRE(pt2->substract(5, 4) == 1);
-}
\ No newline at end of file
+}
+
+namespace {
+    /** Counts destructor calls */
+    struct p3 {
+        static int destroyed;
+
+        ~p3() {
+            ++destroyed;
+        }
+
+        bool ParseFromArray(const char*, size_t) { return true; }
+    };
+
+    int p3::destroyed = 0;
+}
+
+TEST_CASE( "packets_status", "[packets.cpp]" ) {
+    packet_list p;
+    p.add<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet);
+
+    packet_status status;
+    ps2::CDemoPacket msg;
+    msg.set_data("payload");
+    const std::string data = msg.SerializeAsString();
+
+    REQUIRE(p.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, data.data(), data.size(), status) != nullptr);
+    REQUIRE(status == packet_status::ok);
+
+    // Type and subtype outside of the list
+    REQUIRE(p.get<ps2::CDemoPacket>(5, 0, nullptr, 0, status) == nullptr);
+    REQUIRE(status == packet_status::out_of_range);
+    REQUIRE(p.get<ps2::CDemoPacket>(PACKET_DEM, 9999, nullptr, 0, status) == nullptr);
+    REQUIRE(status == packet_status::out_of_range);
+
+    // In range but never registered
+    REQUIRE(p.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Stop, nullptr, 0, status) == nullptr);
+    REQUIRE(status == packet_status::unknown);
+
+    // Field 1 with the invalid wire type 7
+    const char invalid[] = "\x0f\x01";
+    REQUIRE(p.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, invalid, 2, status) == nullptr);
+    REQUIRE(status == packet_status::parse_error);
+
+    // The same goes for cached instances once they exist
+    packet_cache cache(&p);
+    REQUIRE(cache.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, data.data(), data.size(), status) != nullptr);
+    REQUIRE(status == packet_status::ok);
+    REQUIRE(cache.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, invalid, 2, status) == nullptr);
+    REQUIRE(status == packet_status::parse_error);
+    REQUIRE(cache.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, data.data(), data.size())->data() == "payload");
+
+    // Failures are counted by the caller, only errors count
+    packet_errors errors;
+    for (auto s : {packet_status::ok, packet_status::ignored, packet_status::out_of_range,
+            packet_status::out_of_range, packet_status::parse_error})
+        REQUIRE(errors.report(s) == s);
+
+    REQUIRE(errors.count(packet_status::ok) == 0);
+    REQUIRE(errors.count(packet_status::ignored) == 0);
+    REQUIRE(errors.count(packet_status::out_of_range) == 2);
+    REQUIRE(errors.count(packet_status::unknown) == 0);
+    REQUIRE(errors.count(packet_status::parse_error) == 1);
+}
+
+TEST_CASE( "packets_registry", "[packets.cpp]" ) {
+    // Concurrent first use builds each list exactly once
+    std::vector<const packet_list*> seen(8);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < seen.size(); ++i) {
+        threads.emplace_back([&seen, i]() {
+            seen[i] = i % 2 ? packet_registry_s1() : packet_registry_s2();
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    for (size_t i = 0; i < seen.size(); ++i)
+        REQUIRE(seen[i] == (i % 2 ? packet_registry_s1() : packet_registry_s2()));
+
+    REQUIRE(packet_registry_s1() != packet_registry_s2());
+    REQUIRE(packet_registry_s1() != packet_list::instance());
+
+    // Both lists know their engine's packets
+    ps2::CDemoPacket msg;
+    msg.set_data("payload");
+    const std::string data = msg.SerializeAsString();
+
+    ps2::CDemoPacket* parsed = packet_registry_s2()->get<ps2::CDemoPacket>(
+        PACKET_DEM, ps2::DEM_Packet, data.data(), data.size()
+    );
+
+    REQUIRE(parsed != nullptr);
+    REQUIRE(parsed->data() == "payload");
+    delete parsed;
+
+    ps1::CSVCMsg_ServerInfo* parsed1 = packet_registry_s1()->get<ps1::CSVCMsg_ServerInfo>(
+        PACKET_NET, ps1::svc_ServerInfo, nullptr, 0
+    );
+
+    REQUIRE(parsed1 != nullptr);
+    delete parsed1;
+}
+
+TEST_CASE( "packets_arena", "[packets.cpp]" ) {
+    packet_list p;
+    p.add<p3>(0, 0);
+    p.add<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet);
+
+    {
+        google::protobuf::Arena arena;
+        REQUIRE(p.get<p3>(0, 0, nullptr, 0, &arena) != nullptr);
+        REQUIRE(p.get<p3>(0, 0, nullptr, 0, &arena) != nullptr);
+        REQUIRE(p3::destroyed == 0);
+
+        // Protobuf messages are parsed into the arena
+        ps2::CDemoPacket msg;
+        msg.set_data("payload");
+        std::string data = msg.SerializeAsString();
+
+        ps2::CDemoPacket* parsed = p.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, data.data(), data.size(), &arena);
+        REQUIRE(parsed->GetArena() == &arena);
+        REQUIRE(parsed->data() == "payload");
+    }
+
+    // Everything is freed with the arena
+    REQUIRE(p3::destroyed == 2);
+}
+
+TEST_CASE( "packet_cache", "[packets.cpp]" ) {
+    packet_list p;
+    p.add<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet);
+
+    // Serialize a few packets of different sizes
+    std::vector<std::string> data;
+    for (int i = 0; i < 10; ++i) {
+        ps2::CDemoPacket msg;
+        msg.set_data(std::string(100 + (i * 37) % 200, 'a' + i));
+        data.push_back(msg.SerializeAsString());
+    }
+
+    packet_cache cache(&p);
+    ps2::CDemoPacket* first = nullptr;
+
+    // Warm up with every size
+    for (auto &d : data)
+        first = cache.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, d.data(), d.size());
+
+    // Once warmed up the instance keeps its buffers, so its memory doesn't change anymore
+    bool reused = true;
+    const size_t space = first->SpaceUsedLong();
+
+    for (int i = 0; i < 1000; ++i) {
+        const std::string &d = data[i % data.size()];
+        ps2::CDemoPacket* msg = cache.get<ps2::CDemoPacket>(PACKET_DEM, ps2::DEM_Packet, d.data(), d.size());
+
+        // Always the same instance with the contents of the last packet
+        reused = reused && msg == first && msg->data()[0] == 'a' + (i % 10) && msg->SpaceUsedLong() == space;
+    }
+
+    REQUIRE(reused);
+}
@@ -0,0 +1,254 @@
+/**
+ * @file serializer.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+
+#include <string>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/serializer.hpp"
+#include "../../../src/alice2/packets.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Returns the index of str in the symbol table of msg, adds it if necessary */
+    int32_t sym(ps2::CSVCMsg_FlattenedSerializer& msg, const std::string& str) {
+        for (int32_t i = 0; i < msg.symbols_size(); ++i) {
+            if (msg.symbols(i) == str)
+                return i;
+        }
+
+        msg.add_symbols(str);
+        return msg.symbols_size() - 1;
+    }
+
+    /** Adds a serializer to msg */
+    ps2::ProtoFlattenedSerializer_t* add(ps2::CSVCMsg_FlattenedSerializer& msg, const std::string& name, int32_t version) {
+        ps2::ProtoFlattenedSerializer_t* s = msg.add_serializers();
+        s->set_serializer_name_sym(sym(msg, name));
+        s->set_serializer_version(version);
+        return s;
+    }
+
+    /** Adds a field to s */
+    ps2::ProtoFlattenedSerializerField_t* add(ps2::CSVCMsg_FlattenedSerializer& msg, ps2::ProtoFlattenedSerializer_t* s,
+        const std::string& type, const std::string& name)
+    {
+        ps2::ProtoFlattenedSerializerField_t* f = s->add_fields();
+        f->set_var_type_sym(sym(msg, type));
+        f->set_var_name_sym(sym(msg, name));
+        return f;
+    }
+
+    /** Creates a path from its levels */
+    field_path path(std::initializer_list<int32_t> levels) {
+        field_path ret;
+        ret.last = levels.size() - 1;
+
+        uint32_t i = 0;
+        for (auto l : levels)
+            ret.data[i++] = l;
+
+        return ret;
+    }
+
+    /** A hero referencing serializers sent after it */
+    ps2::CSVCMsg_FlattenedSerializer make_serializers() {
+        ps2::CSVCMsg_FlattenedSerializer msg;
+
+        auto hero = add(msg, "CDOTA_Unit_Hero", 0);
+        add(msg, hero, "int32", "m_iHealth");
+        add(msg, hero, "bool", "m_bAlive");
+
+        auto body = add(msg, hero, "CBodyComponent*", "m_CBodyComponent");
+        body->set_field_serializer_name_sym(sym(msg, "CBodyComponent"));
+        body->set_field_serializer_version(0);
+
+        add(msg, hero, "float32", "m_flSimulationTime");
+        add(msg, hero, "CHandle< CBaseEntity >[16]", "m_hAbilities");
+
+        auto items = add(msg, hero, "CUtlVector< CDOTA_Item >", "m_vecItems");
+        items->set_field_serializer_name_sym(sym(msg, "CDOTA_Item"));
+        items->set_field_serializer_version(0);
+
+        add(msg, hero, "char[32]", "m_iszName");
+        add(msg, hero, "Vector", "m_vecOrigin");
+        add(msg, hero, "uint64", "m_nXP");
+
+        auto component = add(msg, "CBodyComponent", 0);
+        add(msg, component, "uint16", "m_cellX");
+
+        auto x = add(msg, component, "float32", "m_vecX");
+        x->set_bit_count(10);
+        x->set_low_value(0.0f);
+        x->set_high_value(128.0f);
+
+        add(msg, component, "QAngle", "m_angRotation")->set_bit_count(7);
+
+        auto item = add(msg, "CDOTA_Item", 0);
+        add(msg, item, "int32", "m_iCharges");
+
+        auto newer = add(msg, "CDOTA_Item", 1);
+        add(msg, newer, "int32", "m_iCharges");
+        add(msg, newer, "int32", "m_iLevel");
+
+        return msg;
+    }
+}
+
+TEST_CASE( "serializer", "[serializer.hpp]" ) {
+    const flattened_serializer s(make_serializers());
+
+    REQUIRE(s.size() == 4);
+    REQUIRE(s.find("CDOTA_Item") == 3);
+    REQUIRE(s.find("CDOTA_Item", 0) == 2);
+    REQUIRE(s.find("CDOTA_Unit_Hero") == 0);
+    REQUIRE(s.find("CDOTA_Unit_Courier") == flattened_serializer::npos);
+
+    const uint32_t hero = s.find("CDOTA_Unit_Hero");
+    REQUIRE(s.name(s.get(hero)) == "CDOTA_Unit_Hero");
+    REQUIRE(s.get(hero).count == 9);
+
+    // Fields of a serializer follow each other
+    const uint32_t first = s.get(hero).first;
+    REQUIRE(s.field_name(first) == "m_iHealth");
+    REQUIRE(s.field_name(first + 8) == "m_nXP");
+    REQUIRE(s.field_type(first + 4) == "CHandle< CBaseEntity >[16]");
+
+    REQUIRE(s.field(first).kind == field_kind::signed_32);
+    REQUIRE(s.field(first + 1).kind == field_kind::boolean);
+    REQUIRE(s.field(first + 3).kind == field_kind::float_simtime);
+    REQUIRE(s.field(first + 6).kind == field_kind::string);
+    REQUIRE(s.field(first + 6).model == field_model::simple);
+    REQUIRE(s.field(first + 7).kind == field_kind::float_noscale);
+    REQUIRE(s.field(first + 7).components == 3);
+    REQUIRE(s.field(first + 8).kind == field_kind::unsigned_64);
+
+    // Pointers to nested serializers
+    const serializer_field& body = s.field(first + 2);
+    REQUIRE(body.kind == field_kind::pointer);
+    REQUIRE(body.model == field_model::table);
+    REQUIRE(body.child == s.find("CBodyComponent"));
+
+    // Fixed and dynamic arrays
+    const serializer_field& abilities = s.field(first + 4);
+    REQUIRE(abilities.model == field_model::fixed_array);
+    REQUIRE(abilities.kind == field_kind::none);
+    REQUIRE(abilities.size == 16);
+    REQUIRE(s.field(abilities.child).kind == field_kind::unsigned_32);
+    REQUIRE(s.field_name(abilities.child) == "m_hAbilities");
+
+    const serializer_field& items = s.field(first + 5);
+    REQUIRE(items.model == field_model::dynamic_array);
+    REQUIRE(items.kind == field_kind::array_length);
+    REQUIRE(s.field(items.child).model == field_model::table);
+    REQUIRE(s.field(items.child).kind == field_kind::none);
+    REQUIRE(s.field(items.child).child == 2);
+
+    // Quantization parameters are resolved up front
+    const uint32_t component = s.get(body.child).first;
+    const serializer_field& x = s.field(component + 1);
+    REQUIRE(x.kind == field_kind::float_quantized);
+    REQUIRE(s.quantization(x).bits == 10);
+    REQUIRE(s.quantization(x).high == 128.0f);
+    REQUIRE(s.field(component + 2).kind == field_kind::qangle);
+    REQUIRE(s.field(component + 2).bits == 7);
+    REQUIRE(s.field(component + 2).components == 3);
+}
+
+TEST_CASE( "serializer_resolve", "[serializer.hpp]" ) {
+    const flattened_serializer s(make_serializers());
+    const uint32_t hero = s.find("CDOTA_Unit_Hero");
+    const uint32_t first = s.get(hero).first;
+
+    REQUIRE(s.resolve(hero, path({0})) == first);
+    REQUIRE(s.resolve(hero, path({2})) == first + 2);
+    REQUIRE(s.resolve(hero, path({2, 1})) == s.get(s.find("CBodyComponent")).first + 1);
+    REQUIRE(s.resolve(hero, path({4, 15})) == s.field(first + 4).child);
+    REQUIRE(s.resolve(hero, path({5})) == first + 5);
+    REQUIRE(s.resolve(hero, path({5, 7})) == s.field(first + 5).child);
+    REQUIRE(s.resolve(hero, path({5, 7, 0})) == s.get(2).first);
+
+    REQUIRE_THROWS_AS(s.resolve(hero, path({9})), SerializerFieldPath);
+    REQUIRE_THROWS_AS(s.resolve(hero, path({-1})), SerializerFieldPath);
+    REQUIRE_THROWS_AS(s.resolve(hero, path({0, 1})), SerializerFieldPath);
+    REQUIRE_THROWS_AS(s.resolve(hero, path({4, 16})), SerializerFieldPath);
+    REQUIRE_THROWS_AS(s.resolve(hero, path({5, 0, 1})), SerializerFieldPath);
+}
+
+TEST_CASE( "serializer_invalid", "[serializer.hpp]" ) {
+    REQUIRE(flattened_serializer::valid(make_serializers()));
+
+    ps2::CSVCMsg_FlattenedSerializer symbol = make_serializers();
+    symbol.mutable_serializers(0)->mutable_fields(0)->set_var_name_sym(1000);
+    REQUIRE_THROWS_AS(flattened_serializer{symbol}, SerializerInvalid);
+    REQUIRE(!flattened_serializer::valid(symbol));
+
+    ps2::CSVCMsg_FlattenedSerializer missing = make_serializers();
+    missing.mutable_serializers(0)->mutable_fields(5)->set_field_serializer_version(7);
+    REQUIRE_THROWS_AS(flattened_serializer{missing}, SerializerInvalid);
+    REQUIRE(!flattened_serializer::valid(missing));
+}
+
+TEST_CASE( "serializer_quantized_float", "[serializer.hpp]" ) {
+    // Plain range
+    const quantized_float plain(10, 0.0f, 128.0f, 0);
+    REQUIRE(plain.flags == 0);
+    REQUIRE(plain.bits == 10);
+
+    // Zero is encoded exactly with a bit in front
+    const quantized_float zero(8, -1.0f, 1.0f, quantized_float::encode_zero);
+    REQUIRE(zero.flags == quantized_float::encode_zero);
+
+    // Integers widen the range to the next power of two and need more bits
+    const quantized_float integers(5, 0.0f, 100.0f, quantized_float::encode_integers);
+    REQUIRE(integers.bits == 8);
+    REQUIRE(integers.high == 127.5f);
+
+    // Raw floats
+    REQUIRE(quantized_float(0, 0.0f, 1.0f, 0).noscale());
+    REQUIRE(quantized_float(32, 0.0f, 1.0f, 0).noscale());
+
+    REQUIRE_THROWS_AS(quantized_float(8, -1.0f, 1.0f, quantized_float::round_down | quantized_float::round_up),
+        SerializerInvalid);
+    REQUIRE(!quantized_float::valid(-1.0f, 1.0f, quantized_float::round_down | quantized_float::round_up));
+    REQUIRE(quantized_float::valid(-1.0f, 1.0f, quantized_float::round_down | quantized_float::round_up
+        | quantized_float::encode_integers));
+
+    // 1023 (plain), the zero bit (zero), 255 (integers)
+    const std::string data("\xff\xff\x07", 3);
+    bitstream b(data.data(), data.size());
+
+    REQUIRE(plain.decode(b) == 128.0f);
+    REQUIRE(b.position() == 10);
+
+    b.setPosition(10);
+    REQUIRE(b.read(1) == 1);
+    b.setPosition(10);
+    REQUIRE(zero.decode(b) == 0.0f);
+    REQUIRE(b.position() == 11);
+
+    REQUIRE(integers.decode(b) == Approx(127.5f));
+}
@@ -0,0 +1,213 @@
+/**
+ * @file string_table.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <string>
+#include <vector>
+
+#include <catch.hpp>
+#include <snappy.h>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/string_table.hpp"
+
+#include "bit_writer.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Writes string table entries */
+    struct table_writer : bit_writer {
+        /** Starts an entry, index is explicit unless it's npos */
+        void entry(uint32_t index = 0xFFFFFFFF) {
+            if (index == 0xFFFFFFFF) {
+                write(1, 1);
+            } else {
+                write(0, 1);
+                write(index - 1, 8);
+            }
+        }
+
+        /** Writes a value with its size in 17 bits */
+        void value(const std::string& str) {
+            write(1, 1);
+            write(str.size(), 17);
+            bytes(str);
+        }
+    };
+
+    /** Returns a create message for the data in w */
+    wire_create_string_table create(const std::string& name, const bit_writer& w, int32_t entries) {
+        wire_create_string_table ret = wire_create_string_table();
+        ret.name = wire_view{name.data(), name.size()};
+        ret.max_entries = 64;
+        ret.num_entries = entries;
+        ret.string_data = wire_view{w.data.data(), w.data.size()};
+        return ret;
+    }
+}
+
+TEST_CASE( "string_table", "[string_table.hpp]" ) {
+    table_writer w;
+
+    // Next index, new key and value
+    w.entry();
+    w.write(1, 1);
+    w.write(0, 1);
+    w.string("12");
+    w.value("abc");
+
+    // Next index, key based on the first one, no value
+    w.entry();
+    w.write(1, 1);
+    w.write(1, 1);
+    w.write(0, 5);
+    w.write(1, 5);
+    w.string("5");
+    w.write(0, 1);
+
+    // Explicit index
+    w.entry(6);
+    w.write(1, 1);
+    w.write(0, 1);
+    w.string("7");
+    w.value(std::string("\0\1", 2));
+
+    const std::string name("instancebaseline");
+    string_table t(create(name, w, 3));
+
+    REQUIRE(t.name() == "instancebaseline");
+    REQUIRE(t.size() == 7);
+    REQUIRE(t.get(0).key == "12");
+    REQUIRE(t.get(0).value == "abc");
+    REQUIRE(t.get(1).key == "15");
+    REQUIRE(t.get(1).value.empty());
+    REQUIRE(t.get(3).key.empty());
+    REQUIRE(t.get(6).key == "7");
+    REQUIRE(t.get(6).value == std::string("\0\1", 2));
+
+    // Updates keep the keys of entries which don't send one
+    table_writer u;
+    u.entry(1);
+    u.write(0, 1);
+    u.value("new");
+    u.entry();
+    u.write(1, 1);
+    u.write(0, 1);
+    u.string("3");
+    u.write(0, 1);
+
+    wire_update_string_table update = wire_update_string_table();
+    update.num_changed_entries = 2;
+    update.string_data = wire_view{u.data.data(), u.data.size()};
+
+    std::vector<uint32_t> changed;
+    t.update(update, changed);
+
+    REQUIRE(changed == std::vector<uint32_t>({1, 2}));
+    REQUIRE(t.get(1).key == "15");
+    REQUIRE(t.get(1).value == "new");
+    REQUIRE(t.get(2).key == "3");
+    REQUIRE(t.size() == 7);
+}
+
+TEST_CASE( "string_table_values", "[string_table.hpp]" ) {
+    const std::string name("values");
+
+    // Values compressed individually
+    std::string compressed;
+    snappy::Compress("compressed value", 16, &compressed);
+
+    table_writer c;
+    c.entry();
+    c.write(0, 1);
+    c.write(1, 1);
+    c.write(1, 1);
+    c.write(compressed.size(), 17);
+    c.bytes(compressed);
+
+    wire_create_string_table msg = create(name, c, 1);
+    msg.flags = string_table::compressed_values;
+    REQUIRE(string_table(msg).get(0).value == "compressed value");
+
+    // Sizes as ubitvar
+    table_writer v;
+    v.entry();
+    v.write(0, 1);
+    v.write(1, 1);
+    v.write(2, 6);
+    v.bytes("hi");
+
+    msg = create(name, v, 1);
+    msg.using_varint_bitcounts = true;
+    REQUIRE(string_table(msg).get(0).value == "hi");
+
+    // Fixed number of bits
+    table_writer f;
+    f.entry();
+    f.write(0, 1);
+    f.write(1, 1);
+    f.write(0x5, 4);
+
+    msg = create(name, f, 1);
+    msg.user_data_fixed_size = true;
+    msg.user_data_size_bits = 4;
+    REQUIRE(string_table(msg).get(0).value == "\x05");
+
+    // The whole table compressed
+    std::string table;
+    snappy::Compress(v.data.data(), v.data.size(), &table);
+
+    msg = create(name, v, 1);
+    msg.using_varint_bitcounts = true;
+    msg.data_compressed = true;
+    msg.string_data = wire_view{table.data(), table.size()};
+    REQUIRE(string_table(msg).get(0).value == "hi");
+}
+
+TEST_CASE( "string_table_errors", "[string_table.hpp]" ) {
+    const std::string name("broken");
+
+    // Past the highest number of entries
+    table_writer index;
+    index.entry(64);
+    index.write(0, 2);
+    REQUIRE_THROWS_AS(string_table(create(name, index, 1)), StringTableData);
+
+    // Values longer than the data
+    table_writer size;
+    size.entry();
+    size.write(0, 1);
+    size.write(1, 1);
+    size.write(100, 17);
+    REQUIRE_THROWS_AS(string_table(create(name, size, 1)), StringTableData);
+
+    // Broken compression
+    table_writer data;
+    data.entry();
+    data.write(0, 2);
+
+    wire_create_string_table msg = create(name, data, 1);
+    msg.data_compressed = true;
+    msg.string_data = wire_view{"\xff\xff\xff", 3};
+    REQUIRE_THROWS_AS(string_table(msg), StringTableData);
+}
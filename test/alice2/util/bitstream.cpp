@@ -0,0 +1,370 @@
+/**
+ * @file bitstream.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <catch.hpp>
+#include "../../../src/alice2/util/bitstream.hpp"
+#include "../bit_writer.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Returns bit i of data */
+    uint32_t bit(const std::string& data, size_t i) {
+        return (static_cast<uint8_t>(data[i >> 3]) >> (i & 7)) & 1;
+    }
+
+    /** Reads n bits one by one */
+    uint32_t reference(const std::string& data, size_t pos, size_t n) {
+        uint32_t ret = 0;
+        for (size_t i = 0; i < n; ++i)
+            ret |= bit(data, pos + i) << i;
+
+        return ret;
+    }
+}
+
+TEST_CASE( "bitstream", "[util/bitstream.hpp]" ) {
+    std::string data;
+    for (int i = 0; i < 37; ++i)
+        data.push_back(static_cast<char>(i * 67 + 13));
+
+    // Every width at every offset, including reads ending in the last byte
+    for (size_t n = 1; n <= 32; ++n) {
+        for (size_t pos = 0; pos + n <= data.size() * 8; pos += 3) {
+            bitstream owned(data);
+            bitstream view(data.data(), data.size());
+            owned.setPosition(pos);
+            view.setPosition(pos);
+
+            const uint32_t expected = reference(data, pos, n);
+            REQUIRE(owned.read(n) == expected);
+            REQUIRE(view.read(n) == expected);
+        }
+    }
+
+    bitstream b(data.data(), data.size());
+    b.seekForward(data.size() * 8 - 4);
+    REQUIRE(b.read(4) == reference(data, data.size() * 8 - 4, 4));
+    REQUIRE_FALSE(b.good());
+    REQUIRE_THROWS_AS(b.read(1), bitstreamDataSize);
+
+    bitstream empty(nullptr, 0);
+    REQUIRE(empty.end() == 0);
+    REQUIRE(empty.read(0) == 0);
+    REQUIRE_THROWS_AS(empty.read(1), bitstreamDataSize);
+}
+
+TEST_CASE( "bitstream_read64", "[util/bitstream.hpp]" ) {
+    std::string data;
+    for (int i = 0; i < 29; ++i)
+        data.push_back(static_cast<char>(i * 151 + 7));
+
+    for (size_t n = 1; n <= 64; ++n) {
+        for (size_t pos = 0; pos + n <= data.size() * 8; pos += 5) {
+            bitstream b(data.data(), data.size());
+            b.setPosition(pos);
+
+            uint64_t expected = 0;
+            for (size_t i = 0; i < n; ++i)
+                expected |= static_cast<uint64_t>(bit(data, pos + i)) << i;
+
+            REQUIRE(b.read64(n) == expected);
+            REQUIRE(b.position() == pos + n);
+        }
+    }
+
+    bitstream b(data.data(), data.size());
+    REQUIRE_THROWS_AS(b.read64(65), bitstreamDataSize);
+    REQUIRE_THROWS_AS(b.read(33), bitstreamDataSize);
+}
+
+TEST_CASE( "bitstream_unchecked", "[util/bitstream.hpp]" ) {
+    std::string data;
+    for (int i = 0; i < 23; ++i)
+        data.push_back(static_cast<char>(i * 89 + 31));
+
+    // Same results as the checked stream as long as reads stay within the data
+    for (size_t n = 1; n <= 32; ++n) {
+        bitstream checked(data.data(), data.size());
+        unchecked_bitstream raw(data.data(), data.size());
+
+        while (checked.left() >= n) {
+            REQUIRE(raw.read(n) == checked.read(n));
+            REQUIRE(raw.position() == checked.position());
+        }
+    }
+
+    unchecked_bitstream a(data.data(), data.size());
+    bitstream b(data.data(), data.size());
+    a.seekForward(3);
+    b.seekForward(3);
+    REQUIRE(a.readVarUInt64() == b.readVarUInt64());
+    REQUIRE(a.read64(64) == b.read64(64));
+
+    // Nothing is thrown past the end, the missing bits are 0
+    unchecked_bitstream c(data.data(), data.size());
+    c.seekForward(data.size() * 8 - 4);
+    REQUIRE(c.read(8) == reference(data, data.size() * 8 - 4, 4));
+}
+
+TEST_CASE( "bitstream_peek", "[util/bitstream.hpp]" ) {
+    const std::string data("\xAB\xCD\xEF", 3);
+    bitstream b(data.data(), data.size());
+
+    // Peeking doesn't move the stream
+    REQUIRE(b.peek(12) == 0xDAB);
+    REQUIRE(b.peek(12) == 0xDAB);
+    REQUIRE(b.position() == 0);
+
+    b.consume(4);
+    REQUIRE(b.peek(8) == 0xDA);
+    REQUIRE(b.peek(bitstream::peek_max) == 0xEFCDA);
+
+    // Bits past the end are 0 when peeking but can't be consumed
+    b.consume(16);
+    REQUIRE(b.peek(16) == 0xE);
+    REQUIRE_THROWS_AS(b.consume(5), bitstreamDataSize);
+
+    b.consume(4);
+    REQUIRE_FALSE(b.good());
+    REQUIRE(b.peek(8) == 0);
+}
+
+TEST_CASE( "bitstream_view", "[util/bitstream.hpp]" ) {
+    std::string data("\x96\x01" "abc\0", 6);
+
+    // Owning streams keep the data they were created with, views read the buffer in place
+    bitstream owned(data);
+    data[2] = 'x';
+    bitstream view(data.data(), data.size());
+
+    REQUIRE(view.readVarUInt32() == 150);
+    REQUIRE(owned.readVarUInt32() == 150);
+
+    char str[8];
+    view.readString(str, sizeof(str));
+    REQUIRE(std::string(str) == "xbc");
+
+    owned.readString(str, sizeof(str));
+    REQUIRE(std::string(str) == "abc");
+
+    // Copies of a view share the buffer, copies of an owning stream get their own data
+    owned.setPosition(16);
+    bitstream owned2(owned);
+    bitstream view2(view);
+    REQUIRE(owned2.position() == 16);
+    REQUIRE(owned2.read(8) == 'a');
+
+    view2.setPosition(16);
+    REQUIRE(view2.read(8) == 'x');
+
+    // Moving keeps the data valid
+    bitstream moved(std::move(owned2));
+    REQUIRE(moved.read(8) == 'b');
+    REQUIRE(owned2.end() == 0);
+
+    std::vector<bitstream> streams;
+    for (int i = 0; i < 16; ++i)
+        streams.push_back(bitstream(std::string(1, static_cast<char>(i))));
+
+    for (int i = 0; i < 16; ++i)
+        REQUIRE(streams[i].read(8) == static_cast<uint32_t>(i));
+
+    bitstream a(std::string("a")), c(std::string("c"));
+    a.swap(c);
+    REQUIRE(a.read(8) == 'c');
+    REQUIRE(c.read(8) == 'a');
+}
+
+TEST_CASE( "bitstream_varint", "[util/bitstream.hpp]" ) {
+    const uint64_t values[] = {
+        0, 1, 127, 128, 300, 16383, 16384, 0xFFFFF, 0x0FFFFFFF, 0x10000000, 0xFFFFFFFF,
+        0x7FFFFFFFFull, 0x1FFFFFFFFFFFFull, 0x00FFFFFFFFFFFFFFull, 0x7FFFFFFFFFFFFFFFull, 0xFFFFFFFFFFFFFFFFull
+    };
+
+    // Every offset within a byte, with and without enough data behind the varints for the unchecked decoders
+    for (size_t offset = 0; offset < 8; ++offset) {
+        for (size_t padding : {0, 16}) {
+            bit_writer w;
+            w.write(0, offset);
+
+            for (auto v : values)
+                w.varint(v);
+
+            for (auto v : values) {
+                if (v <= 0xFFFFFFFF)
+                    w.varint(v);
+            }
+
+            w.write(0, padding * 8);
+
+            bitstream b(w.data.data(), w.data.size());
+            b.seekForward(offset);
+
+            for (auto v : values)
+                REQUIRE(b.readVarUInt64() == v);
+
+            for (auto v : values) {
+                if (v <= 0xFFFFFFFF)
+                    REQUIRE(b.readVarUInt32() == v);
+            }
+
+            REQUIRE(b.left() == padding * 8 + w.data.size() * 8 - w.pos);
+        }
+    }
+
+    // 32 bit varints stop after 5 bytes
+    const std::string overlong("\xff\xff\xff\xff\xff\x01", 6);
+    bitstream o(overlong.data(), overlong.size());
+    REQUIRE(o.readVarUInt32() == 0xFFFFFFFF);
+    REQUIRE(o.position() == 40);
+
+    // Varints running into the end of the stream throw
+    bitstream t("\x80\x80", 2);
+    REQUIRE_THROWS_AS(t.readVarUInt32(), bitstreamDataSize);
+
+    bit_writer u;
+    u.write(0, 3);
+    u.write(0x80, 8);
+    u.write(0x80, 8);
+
+    bitstream s(u.data.data(), u.data.size());
+    s.seekForward(3);
+    REQUIRE_THROWS_AS(s.readVarUInt64(), bitstreamDataSize);
+}
+
+TEST_CASE( "bitstream_ubitvar", "[util/bitstream.hpp]" ) {
+    bit_writer w;
+
+    // 6 bits with the header in the upper 2 and 0, 4, 8 or 28 more bits
+    w.write(0x0B, 6);
+    w.write(0x15, 6);
+    w.write(0x9, 4);
+    w.write(0x2A, 6);
+    w.write(0xC3, 8);
+    w.write(0x3F, 6);
+    w.write(0xFFFFFFF, 28);
+
+    // A set prefix bit selects 2, 4, 10 or 17 bits, 31 bits without any
+    w.write(1, 1);
+    w.write(3, 2);
+    w.write(0x2, 2);
+    w.write(0x9, 4);
+    w.write(0x4, 3);
+    w.write(0x3FF, 10);
+    w.write(0x8, 4);
+    w.write(0x10001, 17);
+    w.write(0, 4);
+    w.write(0x7FFFFFFF, 31);
+
+    bitstream s(w.data.data(), w.data.size());
+    REQUIRE(s.readUBitVar() == 0x0B);
+    REQUIRE(s.readUBitVar() == 0x95);
+    REQUIRE(s.readUBitVar() == 0xC3A);
+    REQUIRE(s.readUBitVar() == 0xFFFFFFFF);
+
+    REQUIRE(s.readUBitVarFP() == 3);
+    REQUIRE(s.readUBitVarFP() == 0x9);
+    REQUIRE(s.readUBitVarFP() == 0x3FF);
+    REQUIRE(s.readUBitVarFP() == 0x10001);
+    REQUIRE(s.readUBitVarFP() == 0x7FFFFFFF);
+    REQUIRE(s.position() == w.pos);
+}
+
+TEST_CASE( "bitstream_coord", "[util/bitstream.hpp]" ) {
+    bit_writer w;
+
+    // Neither part, integer only, fraction only and both with the sign set
+    w.write(0, 2);
+    w.write(1, 2);
+    w.write(0, 1);
+    w.write(99, 14);
+    w.write(2, 2);
+    w.write(1, 1);
+    w.write(8, 5);
+    w.write(3, 2);
+    w.write(1, 1);
+    w.write(0, 14);
+    w.write(16, 5);
+
+    // Quarter and three quarters of a circle
+    w.write(64, 8);
+    w.write(3, 2);
+
+    bitstream s(w.data.data(), w.data.size());
+    REQUIRE(s.readCoord() == 0.0f);
+    REQUIRE(s.readCoord() == 100.0f);
+    REQUIRE(s.readCoord() == -0.25f);
+    REQUIRE(s.readCoord() == -1.5f);
+    REQUIRE(s.readAngle(8) == 90.0f);
+    REQUIRE(s.readAngle(2) == 270.0f);
+    REQUIRE(s.position() == w.pos);
+}
+
+TEST_CASE( "bitstream_strings", "[util/bitstream.hpp]" ) {
+    const std::string text("short\0a somewhat longer string\0unterminated", 43);
+
+    for (size_t offset = 0; offset < 8; ++offset) {
+        bit_writer w;
+        w.write(0, offset);
+
+        for (auto c : text)
+            w.write(static_cast<uint8_t>(c), 8);
+
+        bitstream b(w.data.data(), w.data.size());
+        b.seekForward(offset);
+
+        char buffer[64];
+        b.readString(buffer, sizeof(buffer));
+        REQUIRE(std::string(buffer) == "short");
+        REQUIRE(b.position() == offset + 6 * 8);
+
+        b.readString(buffer, sizeof(buffer));
+        REQUIRE(std::string(buffer) == "a somewhat longer string");
+
+        // Cut off by the buffer size
+        const size_t before = b.position();
+        b.readString(buffer, 6);
+        REQUIRE(std::string(buffer) == "unter");
+        REQUIRE(b.position() == before + 6 * 8);
+
+        // Runs into the end of the stream
+        REQUIRE_THROWS_AS(b.readString(buffer, sizeof(buffer)), bitstreamDataSize);
+
+        // Bits are copied the same way at any offset
+        bitstream c(w.data.data(), w.data.size());
+        c.seekForward(offset);
+
+        std::vector<char> bits(text.size());
+        c.readBits(bits.data(), text.size() * 8 - 3);
+        REQUIRE(std::string(bits.data(), text.size() - 1) == text.substr(0, text.size() - 1));
+        REQUIRE(static_cast<uint8_t>(bits.back()) == (static_cast<uint8_t>(text.back()) & 0x1F));
+        REQUIRE(c.left() == w.data.size() * 8 - w.pos + 3);
+
+        REQUIRE_THROWS_AS(c.readBits(bits.data(), c.left() + 1), bitstreamDataSize);
+    }
+}
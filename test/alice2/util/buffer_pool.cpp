@@ -0,0 +1,72 @@
+/**
+ * @file buffer_pool.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <cstring>
+#include <thread>
+
+#include <catch.hpp>
+#include "../../../src/alice2/util/buffer_pool.hpp"
+
+using namespace alice;
+
+TEST_CASE( "buffer_pool", "[util/buffer_pool.hpp]" ) {
+    auto pool = std::make_shared<buffer_pool>();
+
+    {
+        buffer_pool::buffer b = pool->acquire(100);
+        REQUIRE(b.size() >= 100);
+        memset(b.data(), 0, b.size());
+
+        // Growing replaces the memory
+        b.reserve(10000);
+        REQUIRE(b.size() >= 10000);
+        REQUIRE(pool->statistics().allocations == 2);
+    }
+
+    // Both buffers went back to the pool and are reused
+    {
+        buffer_pool::buffer b1 = pool->acquire(5000);
+        buffer_pool::buffer b2 = pool->acquire(10);
+        REQUIRE(pool->statistics().allocations == 2);
+        REQUIRE(pool->statistics().reuses == 2);
+    }
+
+    buffer_pool::stats s = pool->statistics();
+    REQUIRE(s.high_water == 10000);
+    REQUIRE(s.allocated >= 10100);
+    REQUIRE(s.peak == s.allocated);
+
+    // Buffers can be returned from other threads and outlive the pool handle
+    buffer_pool::buffer b = pool->acquire(1);
+    pool.reset();
+    std::thread t([&]() { buffer_pool::buffer moved(std::move(b)); });
+    t.join();
+
+    // Every thread has its own pool
+    std::shared_ptr<buffer_pool> other;
+    std::thread t2([&]() { other = buffer_pool::local(); });
+    t2.join();
+
+    REQUIRE(buffer_pool::local() == buffer_pool::local());
+    REQUIRE(buffer_pool::local() != other);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file ring_buffer.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#include <string>
+#include <thread>
+
+#include <catch.hpp>
+#include "../../../src/alice2/util/ring_buffer.hpp"
+
+using namespace alice;
+
+TEST_CASE( "ring_buffer", "[util/ring_buffer.hpp]" ) {
+    // Small buffer so both sides have to wait for each other and writes wrap around
+    ring_buffer ring(7);
+
+    std::string input;
+    for (int i = 0; i < 1000; ++i)
+        input += std::to_string(i);
+
+    std::thread writer([&]() {
+        for (std::size_t i = 0; i < input.size(); i += 5)
+            ring.write(input.data() + i, std::min<std::size_t>(5, input.size() - i));
+
+        ring.close();
+    });
+
+    std::string output;
+    char buf[3];
+    while (std::size_t r = ring.read(buf, sizeof(buf)))
+        output.append(buf, r);
+
+    writer.join();
+
+    REQUIRE(output == input);
+    REQUIRE(ring.done());
+    REQUIRE(ring.is_closed());
+
+    // Writing to a closed buffer fails
+    REQUIRE_FALSE(ring.write("abc", 3));
+}
@@ -0,0 +1,187 @@
+/**
+ * @file wire.cpp
+ * @author Robin Dietrich <me (at) invokr (dot) org>
+ * @version 1.0
+ *
+ * @par License
+ *    Alice Replay Parser
+ *    Copyright 2014-2015 Robin Dietrich
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+
+#include <string>
+
+#include <catch.hpp>
+
+// Make sure we are testing the version under src/
+#include "../../../src/alice2/wire.hpp"
+#include "../../../src/alice2/packets.hpp"
+
+using namespace alice;
+
+namespace {
+    /** Whether view points into str */
+    bool inside(const wire_view& view, const std::string& str) {
+        return view.data >= str.data() && view.data + view.size <= str.data() + str.size();
+    }
+}
+
+TEST_CASE( "wire_demo_packet", "[wire.hpp]" ) {
+    ps2::CDemoPacket msg;
+    msg.set_sequence_in(-5);
+    msg.set_sequence_out_ack(300);
+    msg.set_data(std::string(1000, 'x'));
+    const std::string data = msg.SerializeAsString();
+
+    wire_demo_packet p;
+    REQUIRE(wire_decode(data.data(), data.size(), p));
+    REQUIRE(p.sequence_in == -5);
+    REQUIRE(p.sequence_out_ack == 300);
+    REQUIRE(p.data.str() == msg.data());
+    REQUIRE(inside(p.data, data));
+
+    // Missing fields are set to their defaults
+    REQUIRE(wire_decode(nullptr, 0, p));
+    REQUIRE(p.sequence_in == 0);
+    REQUIRE(p.data.size == 0);
+
+    // Truncated anywhere
+    for (size_t i = 1; i < 8; ++i)
+        REQUIRE_FALSE(wire_decode(data.data(), data.size() - i, p));
+
+    REQUIRE_FALSE(wire_decode(data.data(), 1, p));
+}
+
+TEST_CASE( "wire_full_packet", "[wire.hpp]" ) {
+    ps2::CDemoFullPacket msg;
+    msg.mutable_string_table()->add_tables()->set_table_name("instancebaseline");
+    msg.mutable_packet()->set_data(std::string(100, 'x'));
+    const std::string data = msg.SerializeAsString();
+
+    wire_full_packet p;
+    REQUIRE(wire_decode(data.data(), data.size(), p));
+    REQUIRE(p.string_table.str() == msg.string_table().SerializeAsString());
+    REQUIRE(p.packet.str() == msg.packet().SerializeAsString());
+    REQUIRE(inside(p.string_table, data));
+    REQUIRE(inside(p.packet, data));
+
+    REQUIRE_FALSE(wire_decode(data.data(), data.size() - 1, p));
+    REQUIRE_FALSE(wire_decode("full", 4, p));
+}
+
+TEST_CASE( "wire_packet_entities", "[wire.hpp]" ) {
+    ps2::CSVCMsg_PacketEntities msg;
+    msg.set_max_entries(2048);
+    msg.set_updated_entries(17);
+    msg.set_is_delta(true);
+    msg.set_baseline(1);
+    msg.set_delta_from(12345);
+    msg.set_entity_data("\x01\x02\x03\x00\x04", 5);
+    msg.set_pending_full_frame(true);
+    msg.set_active_spawngroup_handle(0xFFFFFFFF);
+    const std::string data = msg.SerializeAsString();
+
+    wire_packet_entities p;
+    REQUIRE(wire_decode(data.data(), data.size(), p));
+    REQUIRE(p.max_entries == 2048);
+    REQUIRE(p.updated_entries == 17);
+    REQUIRE(p.is_delta);
+    REQUIRE_FALSE(p.update_baseline);
+    REQUIRE(p.baseline == 1);
+    REQUIRE(p.delta_from == 12345);
+    REQUIRE(p.entity_data.str() == msg.entity_data());
+    REQUIRE(inside(p.entity_data, data));
+    REQUIRE(p.pending_full_frame);
+    REQUIRE(p.active_spawngroup_handle == 0xFFFFFFFF);
+}
+
+TEST_CASE( "wire_string_tables", "[wire.hpp]" ) {
+    ps2::CSVCMsg_CreateStringTable create;
+    create.set_name("instancebaseline");
+    create.set_max_entries(64);
+    create.set_num_entries(3);
+    create.set_user_data_fixed_size(false);
+    create.set_user_data_size(0);
+    create.set_user_data_size_bits(0);
+    create.set_flags(1);
+    create.set_string_data(std::string(300, 'y'));
+    create.set_uncompressed_size(600);
+    create.set_data_compressed(true);
+    const std::string cdata = create.SerializeAsString();
+
+    wire_create_string_table c;
+    REQUIRE(wire_decode(cdata.data(), cdata.size(), c));
+    REQUIRE(c.name.str() == "instancebaseline");
+    REQUIRE(c.max_entries == 64);
+    REQUIRE(c.num_entries == 3);
+    REQUIRE(c.flags == 1);
+    REQUIRE(c.string_data.str() == create.string_data());
+    REQUIRE(inside(c.string_data, cdata));
+    REQUIRE(c.uncompressed_size == 600);
+    REQUIRE(c.data_compressed);
+    REQUIRE_FALSE(c.using_varint_bitcounts);
+
+    // Newer servers send a field our messages don't have yet
+    const std::string newer = cdata + "\x58\x01";
+    REQUIRE(wire_decode(newer.data(), newer.size(), c));
+    REQUIRE(c.using_varint_bitcounts);
+    REQUIRE(c.name.str() == "instancebaseline");
+
+    ps2::CSVCMsg_UpdateStringTable update;
+    update.set_table_id(7);
+    update.set_num_changed_entries(2);
+    update.set_string_data("abc");
+    const std::string udata = update.SerializeAsString();
+
+    wire_update_string_table u;
+    REQUIRE(wire_decode(udata.data(), udata.size(), u));
+    REQUIRE(u.table_id == 7);
+    REQUIRE(u.num_changed_entries == 2);
+    REQUIRE(u.string_data.str() == "abc");
+}
+
+TEST_CASE( "wire_reader", "[wire.hpp]" ) {
+    // Unknown fields of every wire type are skipped, fields with the wrong wire type as well
+    const char unknown[] =
+        "\x78\x96\x01"                      // field 15, varint 150
+        "\x81\x01" "12345678"               // field 16, fixed64
+        "\x8d\x01" "1234"                   // field 17, fixed32
+        "\x92\x01\x03" "abc"                // field 18, 3 bytes
+        "\x1d" "1234"                       // field 3 (data) as fixed32
+        "\x08\x2a";                         // field 1, varint 42
+
+    wire_update_string_table u;
+    REQUIRE(wire_decode(unknown, sizeof(unknown) - 1, u));
+    REQUIRE(u.table_id == 42);
+    REQUIRE(u.string_data.size == 0);
+
+    // Groups and field number 0 are invalid
+    REQUIRE_FALSE(wire_decode("\x0b\x0c", 2, u));
+    REQUIRE_FALSE(wire_decode("\x00\x01", 2, u));
+
+    // Length past the end of the message
+    REQUIRE_FALSE(wire_decode("\x1a\x05" "abc", 5, u));
+
+    // Varints longer than 10 bytes
+    const std::string overlong("\x08\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 12);
+    REQUIRE_FALSE(wire_decode(overlong.data(), overlong.size(), u));
+
+    wire_reader r("\x96\x01", 2);
+    uint64_t v;
+    REQUIRE(r.varint(v));
+    REQUIRE(v == 150);
+    REQUIRE_FALSE(r.varint(v));
+    REQUIRE(r.error());
+}